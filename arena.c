@@ -0,0 +1,60 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+int arena_init(struct arena *arena, size_t size)
+{
+	assert(arena != NULL);
+
+	arena->used = 0;
+	arena->size = ARENA_SIZE(size);
+	arena->base = NULL;
+
+	if (arena->size == 0) return 0;
+
+	arena->base = malloc(arena->size);
+	if (!arena->base) {
+		arena->size = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void arena_free(struct arena *arena)
+{
+	free(arena->base);
+	arena->base = NULL;
+	arena->size = arena->used = 0;
+}
+
+int arena_reserve(struct arena *arena, size_t size)
+{
+	assert(arena != NULL);
+
+	arena->used = 0;
+	if (size <= arena->size) return 0;
+
+	arena_free(arena);
+	return arena_init(arena, size);
+}
+
+void *arena_push(struct arena *arena, size_t size)
+{
+	void *ptr;
+
+	assert(arena != NULL);
+
+	size = ARENA_SIZE(size);
+	if (size > arena->size - arena->used) return NULL;
+
+	ptr = arena->base + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+	arena->used = 0;
+}
@@ -0,0 +1,27 @@
+#if !defined ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 16
+
+struct arena
+{
+	uint8_t *base;
+	size_t   size;
+	size_t   used;
+};
+
+extern int  arena_init(struct arena *arena, size_t size);
+extern void arena_free(struct arena *arena);
+
+// make sure at least `size` bytes are available, dropping everything pushed
+extern int   arena_reserve(struct arena *arena, size_t size);
+extern void *arena_push(struct arena *arena, size_t size);
+extern void  arena_reset(struct arena *arena);
+
+// bytes consumed by `size` once rounded up to the arena alignment
+#define ARENA_SIZE(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+#endif // ARENA_H
@@ -0,0 +1,335 @@
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "session.h"
+
+struct batch
+{
+	struct path_list     *list;
+	FILE                 *out;
+	struct batch_options *options;
+	int                   failed;
+
+	pthread_mutex_t   lock;
+	pthread_cond_t    turn;
+	uint              next;    // next path to claim
+	uint              written; // next path allowed to write
+};
+
+struct batch_worker
+{
+	pthread_t     thread;
+	struct batch *batch;
+
+	// reused across every file this worker handles
+	struct session session;
+	struct stats   stats;
+	struct verify  verify;
+	struct resync  resync;
+	struct liveness live;
+	struct estimation estimate;
+	struct shrinkage  shrink;
+	struct simulation sim_totals;
+	struct sim     sim;     // 1M of 8086 memory, --sim only
+	struct trace   trace;
+	struct memprof memprof;
+	struct timing  timing;
+	struct lanes  *lanes;   // --lanes only, 16M of lane memory
+};
+
+int path_list_add(struct path_list *list, const char *path)
+{
+	char **tmp;
+
+	assert(list != NULL);
+	assert(path != NULL);
+
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		tmp = realloc(list->paths, list->capacity * sizeof(*list->paths));
+		if (!tmp) return -1;
+		list->paths = tmp;
+	}
+
+	list->paths[list->count] = strdup(path);
+	if (!list->paths[list->count]) return -1;
+
+	list->count++;
+	return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int path_list_add_dir(struct path_list *list, const char *dir)
+{
+	DIR           *d;
+	struct dirent *entry;
+	struct stat    st;
+	char           path[4096];
+	uint           first = list->count;
+
+	d = opendir(dir);
+	if (!d) return -1;
+
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+
+		if (path_list_add(list, path) < 0) {
+			closedir(d);
+			return -1;
+		}
+	}
+
+	closedir(d);
+
+	// readdir order is arbitrary, keep the output stable between runs
+	qsort(list->paths + first, list->count - first, sizeof(*list->paths), compare_paths);
+	return 0;
+}
+
+int path_list_read(struct path_list *list, FILE *in)
+{
+	char   line[4096];
+	size_t len;
+
+	while (fgets(line, sizeof(line), in)) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len == 0) continue;
+
+		if (path_list_add(list, line) < 0) return -1;
+	}
+
+	return 0;
+}
+
+void path_list_free(struct path_list *list)
+{
+	uint i;
+
+	for (i = 0; i < list->count; ++i) free(list->paths[i]);
+	free(list->paths);
+
+	list->paths = NULL;
+	list->count = list->capacity = 0;
+}
+
+static int process_file(struct batch_worker *w, const char *path, uint index)
+{
+	struct batch_options *o = w->batch->options;
+	char trace[4096];
+	int  rc;
+
+	rc = session_load(&w->session, path);
+	if (rc < 0) {
+		fprintf(stderr, "failed to read '%s'\n", path);
+		return rc;
+	}
+
+	if (o->sim) {
+		if (o->trace && w->batch->list->count > 1)
+			snprintf(trace, sizeof(trace), "%s.%u", o->trace, index);
+		else if (o->trace)
+			snprintf(trace, sizeof(trace), "%s", o->trace);
+
+		if (o->lanes) {
+			rc = session_lanes(&w->session, w->lanes, o->lanes, o->seed,
+			                   o->steps ? o->steps : SIM_MAX_STEPS, &w->sim_totals);
+			if (rc < 0) fprintf(stderr, "failed to simulate '%s'\n", path);
+			return rc;
+		}
+
+		rc = session_simulate(&w->session, &w->sim, &w->trace, o->trace ? trace : NULL,
+		                      o->steps ? o->steps : SIM_MAX_STEPS, &w->sim_totals);
+		if (rc < 0) fprintf(stderr, "failed to simulate '%s'\n", path);
+		return rc;
+	}
+
+	if (w->batch->options->stats)
+		return stats_scan(&w->stats, w->session.raw, w->session.size, w->session.flags);
+
+	rc = session_decode(&w->session);
+	if (rc < 0) {
+		fprintf(stderr, "failed to decode '%s'\n", path);
+		return rc;
+	}
+
+	if (w->batch->options->index && session_index(&w->session) < 0)
+		fprintf(stderr, "failed to write the index of '%s'\n", path);
+
+	if (w->batch->options->resync)
+		resync_scan(&w->resync, stderr, path, w->session.instructions, w->session.count);
+
+	if (w->batch->options->verify)
+		return verify_image(&w->verify, w->session.instructions, w->session.count,
+		                    w->session.raw, path);
+
+	if (w->batch->options->live)
+		rc = session_live(&w->session, &w->live);
+	else if (w->batch->options->estimate)
+		rc = session_estimate(&w->session, w->batch->options->trips, &w->estimate);
+	else if (w->batch->options->shrink)
+		rc = session_shrink(&w->session, &w->shrink);
+	else
+		rc = session_render(&w->session);
+	if (rc < 0) fprintf(stderr, "failed to render '%s'\n", path);
+
+	return rc;
+}
+
+static void write_file(struct batch_worker *w, const char *path, int rc)
+{
+	struct batch         *b = w->batch;
+	struct batch_options *o = b->options;
+	struct writer header;
+	char          buf[4352];
+
+	// a failed file keeps its header, and an error record after it, so the
+	// output still lines up with the inputs
+	header = (struct writer){ buf, 0, sizeof(buf), b->out };
+	format_header(&header, o->output, o->headers ? path : NULL, rc, rc == 0 ? w->session.text_size : 0);
+	writer_flush(&header);
+
+	if (rc == 0) fwrite(w->session.text, 1, w->session.text_size, b->out);
+
+	if (o->headers && o->output == OUTPUT_TEXT) fputc('\n', b->out);
+}
+
+static void *batch_worker_run(void *arg)
+{
+	struct batch_worker *w = arg;
+	struct batch        *b = w->batch;
+	uint  i;
+	int   rc;
+
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+
+		if (i >= b->list->count) break;
+
+		rc = process_file(w, b->list->paths[i], i);
+
+		// counters are merged at the end, nothing to order
+		if (b->options->stats || b->options->verify) {
+			if (rc < 0) {
+				pthread_mutex_lock(&b->lock);
+				b->failed = 1;
+				pthread_mutex_unlock(&b->lock);
+			}
+			continue;
+		}
+
+		// wait for every earlier path to be written
+		pthread_mutex_lock(&b->lock);
+		while (b->written != i) pthread_cond_wait(&b->turn, &b->lock);
+		pthread_mutex_unlock(&b->lock);
+
+		write_file(w, b->list->paths[i], rc);
+
+		pthread_mutex_lock(&b->lock);
+		if (rc < 0) b->failed = 1;
+		b->written++;
+		pthread_cond_broadcast(&b->turn);
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	return NULL;
+}
+
+int run_batch(FILE *out, struct path_list *list, struct batch_options *options)
+{
+	struct batch         b;
+	struct batch_worker *workers;
+	uint i, started = 0, threads = options->threads;
+	uint flags = 0;
+
+	if (list->count == 0) return 0;
+	if (threads == 0) threads = 1;
+	if (threads > list->count) threads = list->count;
+
+	memset(&b, 0, sizeof(b));
+	b.list    = list;
+	b.out     = out;
+	b.options = options;
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.turn, NULL);
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers) return -3;
+
+	if (options->resync) flags |= SCAN_TOLERANT;
+	if (options->xref)   flags |= SESSION_XREF;
+	if (options->index)  flags |= SESSION_INDEX;
+	if (options->live)   flags |= SESSION_LIVE;
+	if (options->estimate) flags |= SESSION_ESTIMATE;
+	if (options->shrink) flags |= SESSION_SHRINK;
+	if (options->sim)    flags |= SESSION_SIM;
+	if (options->memprof) flags |= SESSION_MEMPROF;
+	if (options->clocks)  flags |= SESSION_CLOCKS;
+	if (options->compare) flags |= SESSION_COMPARE;
+	if (options->lanes)   flags |= SESSION_LANES;
+
+	for (i = 0; i < threads; ++i) {
+		workers[i].batch = &b;
+		session_init(&workers[i].session, options->output, flags);
+
+		if (options->sim && sim_init(&workers[i].sim) < 0) b.failed = 1;
+		if (options->trace && trace_init(&workers[i].trace) < 0) b.failed = 1;
+		if (options->memprof) workers[i].sim.prof = &workers[i].memprof;
+		if (options->clocks)  workers[i].sim.timing = &workers[i].timing;
+
+		if (options->lanes) {
+			workers[i].lanes = malloc(sizeof(*workers[i].lanes));
+			if (!workers[i].lanes || lanes_init(workers[i].lanes) < 0) b.failed = 1;
+		}
+	}
+
+	// nothing left to claim, every worker returns straight away
+	if (b.failed) {
+		fprintf(stderr, "out of memory for the simulator\n");
+		b.next = list->count;
+	}
+
+	// the calling thread is worker 0
+	for (i = 1; i < threads && !b.failed; ++i, ++started) {
+		if (pthread_create(&workers[i].thread, NULL, batch_worker_run, workers + i) != 0) break;
+	}
+
+	batch_worker_run(workers);
+
+	for (i = 1; i <= started; ++i) pthread_join(workers[i].thread, NULL);
+	for (i = 0; i < threads; ++i) {
+		if (options->stats)  stats_merge(options->stats, &workers[i].stats);
+		if (options->verify) verify_merge(options->verify, &workers[i].verify);
+		if (options->resync) resync_merge(options->resync, &workers[i].resync);
+		if (options->live)   live_merge(options->live, &workers[i].live);
+		if (options->estimate) estimate_merge(options->estimate, &workers[i].estimate);
+		if (options->shrink) shrink_merge(options->shrink, &workers[i].shrink);
+		if (options->sim)    sim_merge(options->sim, &workers[i].sim_totals);
+		session_free(&workers[i].session);
+		sim_free(&workers[i].sim);
+		trace_free(&workers[i].trace);
+		if (workers[i].lanes) lanes_free(workers[i].lanes);
+		free(workers[i].lanes);
+	}
+
+	free(workers);
+	pthread_cond_destroy(&b.turn);
+	pthread_mutex_destroy(&b.lock);
+
+	fflush(out);
+	return b.failed ? -1 : 0;
+}
@@ -0,0 +1,55 @@
+#if !defined BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "decode.h"
+#include "encode.h"
+#include "estimate.h"
+#include "format.h"
+#include "live.h"
+#include "resync.h"
+#include "shrink.h"
+#include "sim.h"
+#include "stats.h"
+
+struct path_list
+{
+	char **paths;
+	uint   count;
+	uint   capacity;
+};
+
+extern int  path_list_add(struct path_list *list, const char *path);
+extern int  path_list_add_dir(struct path_list *list, const char *dir);
+extern int  path_list_read(struct path_list *list, FILE *in);
+extern void path_list_free(struct path_list *list);
+
+struct batch_options
+{
+	uint           threads;
+	int            headers; // per-file header before each listing
+	int            xref;    // list the branches to each label on its line
+	int            index;   // save each image's record boundaries as <path>.idx
+	OUTPUT         output;
+	struct stats  *stats;   // count into this instead of writing listings
+	struct verify *verify;  // re-encode and compare instead of writing listings
+	struct resync *resync;  // decode invalid bytes as db and count them here
+	struct liveness *live;  // report dead register writes instead of listings
+	struct estimation *estimate; // report static clocks per block instead of listings
+	const struct estimate_trips *trips; // with estimate: loop trip counts, may be NULL
+	struct shrinkage *shrink; // report records with a shorter encoding instead of listings
+	struct simulation *sim; // run each image and report its registers instead
+	const char    *trace;   // with sim: trace every step here (".N" per input if several)
+	uint64_t       steps;   // with sim: step limit, 0 for SIM_MAX_STEPS
+	int            memprof; // with sim: heatmap and strides of every load and store
+	int            clocks;  // with sim: book and prefetch-queue clocks for the 8086 and 8088
+	int            compare; // with clocks: one timing_compare_row per image instead
+	uint           lanes;   // with sim: run this many instances in lockstep (lanes.h), 0 for one
+	uint64_t       seed;    // with lanes: random start registers
+};
+
+// disassemble every path on `threads` workers, writing results in input order
+extern int run_batch(FILE *out, struct path_list *list, struct batch_options *options);
+
+#endif // BATCH_H
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "bitmap.h"
 
@@ -19,6 +20,16 @@ int bitmap_init(struct bitmap *map, size_t bit_count)
 	return 0;
 }
 
+void bitmap_init_buf(struct bitmap *map, size_t bit_count, uint32_t *buf)
+{
+	assert(map != NULL);
+	assert(buf != NULL);
+
+	map->size = BITMAP_WORDS(bit_count);
+	map->data = buf;
+	memset(map->data, 0, map->size * sizeof(*map->data));
+}
+
 void bitmap_free(struct bitmap *map)
 {
 	free(map->data);
@@ -32,7 +43,7 @@ int bitmap_set_bit(struct bitmap *map, size_t bit_id)
 
 	if (bit_id >= map->size * BITS_PER_WORD) return -1;
 
-	map->data[WORD_OFFSET(bit_id)] |= (1 << BIT_OFFSET(bit_id));
+	map->data[WORD_OFFSET(bit_id)] |= ((uint32_t)1 << BIT_OFFSET(bit_id));
 	return 0;
 }
 
@@ -43,7 +54,7 @@ int bitmap_clear_bit(struct bitmap *map, size_t bit_id)
 
 	if (bit_id >= map->size * BITS_PER_WORD) return -1;
 
-	map->data[WORD_OFFSET(bit_id)] &= ~(1 << BIT_OFFSET(bit_id));
+	map->data[WORD_OFFSET(bit_id)] &= ~((uint32_t)1 << BIT_OFFSET(bit_id));
 	return 0;
 }
 
@@ -56,7 +67,7 @@ int bitmap_get_bit(struct bitmap *map, size_t bit_id)
 
 	if (bit_id >= map->size * BITS_PER_WORD) return -1;
 
-	bit = map->data[WORD_OFFSET(bit_id)] & (1 << BIT_OFFSET(bit_id));
+	bit = map->data[WORD_OFFSET(bit_id)] & ((uint32_t)1 << BIT_OFFSET(bit_id));
 	return bit != 0;
 }
 
@@ -11,10 +11,14 @@ struct bitmap
 };
 
 extern int  bitmap_init(struct bitmap *map, size_t bit_count);
+extern void bitmap_init_buf(struct bitmap *map, size_t bit_count, uint32_t *buf);
 extern void bitmap_free(struct bitmap *map);
 
 extern int bitmap_set_bit(struct bitmap *map, size_t bit_id);
 extern int bitmap_clear_bit(struct bitmap *map, size_t bit_id);
 extern int bitmap_get_bit(struct bitmap *map, size_t bit_id);
 
+// number of uint32_t words backing `bit_count` bits
+#define BITMAP_WORDS(bit_count) (((bit_count) + 31) / 32)
+
 #endif // BITMAP_H
@@ -0,0 +1,354 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "boundary.h"
+#include "image.h"
+
+void boundary_init_buf(struct boundary *boundary, uint size, void *buf)
+{
+	memset(boundary, 0, sizeof(*boundary));
+	boundary->size = size;
+
+	bitmap_init_buf(&boundary->starts, size, buf);
+	boundary->checkpoints = (uint32_t *)buf + BITMAP_WORDS((size_t)size);
+}
+
+// checkpoints from the start bits
+static void boundary_rank(struct boundary *boundary)
+{
+	const uint32_t *words = boundary->starts.data;
+	size_t c, w;
+	uint   n = 0;
+
+	for (c = 0; c < BOUNDARY_CHECKPOINTS(boundary->size); ++c) {
+		boundary->checkpoints[c] = n;
+
+		for (w = c * 2; w < c * 2 + 2 && w < boundary->starts.size; ++w)
+			n += __builtin_popcount(words[w]);
+	}
+}
+
+void boundary_build(struct boundary *boundary, const Instruction *instructions, uint count,
+                    uint flags)
+{
+	uint i;
+
+	boundary->count = count;
+	boundary->flags = flags;
+
+	for (i = 0; i < count; ++i) bitmap_set_bit(&boundary->starts, instructions[i].offset);
+	boundary_rank(boundary);
+}
+
+// boundary_build without the records: step through the image by length
+// alone, and decode only where instruction_length can't tell, so the
+// records split exactly as scan_segments splits them
+static int boundary_scan(struct boundary *boundary, uint8 *const data, uint size, uint flags)
+{
+	Instruction instruction;
+	uint offset = 0, count = 0;
+	int  len, rc;
+
+	boundary->flags = flags;
+
+	while (offset < size) {
+		len = instruction_length(data + offset, size - offset);
+
+		// an invalid opcode, a record cut off by the end of the image, or a
+		// prefix run up to it (each prefix is its own record then)
+		if (len <= 0) {
+			rc = parse_instruction(&instruction, data, size, offset);
+			if ((rc < 0 || instruction.structure.type == UNKNOWN) && (flags & SCAN_TOLERANT)) {
+				parse_invalid(&instruction, data, size, offset);
+			} else if (rc < 0) {
+				fprintf(stderr, "out of image boundaries (offset: %u, image_size: %u)\n", offset, size);
+				return -1;
+			} else if (instruction.structure.type == UNKNOWN) {
+				fprintf(stderr, "unknown instruction encountered: 0x%02X\n", data[offset]);
+				return -2;
+			}
+
+			len = instruction.structure.size;
+		}
+
+		bitmap_set_bit(&boundary->starts, offset);
+		offset += len;
+		count++;
+	}
+
+	boundary->count = count;
+	boundary_rank(boundary);
+	return 0;
+}
+
+// the last record start at or before x; a record is at most DECODE_MAX_SIZE
+// bytes, so this looks at two words at most
+static int start_at_or_before(const struct boundary *boundary, uint x)
+{
+	const uint32_t *words = boundary->starts.data;
+	size_t   w    = x / 32;
+	uint32_t word = words[w] & (((uint32_t)2 << (x % 32)) - 1);
+
+	while (!word) {
+		if (w == 0) return -1;
+		word = words[--w];
+	}
+
+	return w * 32 + 31 - __builtin_clz(word);
+}
+
+// records starting before `start`
+static uint rank(const struct boundary *boundary, uint start)
+{
+	const uint32_t *words = boundary->starts.data;
+	size_t w = start / BOUNDARY_STEP * 2;
+	uint   n = boundary->checkpoints[start / BOUNDARY_STEP];
+
+	if (start % BOUNDARY_STEP >= 32) n += __builtin_popcount(words[w++]);
+	return n + __builtin_popcount(words[w] & (((uint32_t)1 << (start % 32)) - 1));
+}
+
+int boundary_record(const struct boundary *boundary, uint offset, uint *start)
+{
+	int at;
+
+	if (offset >= boundary->size) return -1;
+
+	at = start_at_or_before(boundary, offset);
+	if (at < 0) return -1;
+
+	*start = at;
+	return rank(boundary, at);
+}
+
+int boundary_previous(const struct boundary *boundary, uint start)
+{
+	return start == 0 ? -1 : start_at_or_before(boundary, start - 1);
+}
+
+static void index_path(char *path, size_t len, const char *image_path)
+{
+	snprintf(path, len, "%s%s", image_path, BOUNDARY_SUFFIX);
+}
+
+static uint64_t file_mtime(const struct stat *st)
+{
+	return (uint64_t)st->st_mtim.tv_sec * 1000000000u + st->st_mtim.tv_nsec;
+}
+
+int boundary_save(const struct boundary *boundary, const char *image_path)
+{
+	struct boundary_header header;
+	struct stat st;
+	char  path[4096];
+	FILE *f;
+	int   rc = 0;
+
+	if (stat(image_path, &st) < 0) return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BOUNDARY_MAGIC, sizeof(header.magic));
+	header.version    = BOUNDARY_VERSION;
+	header.step       = BOUNDARY_STEP;
+	header.size       = boundary->size;
+	header.count      = boundary->count;
+	header.flags      = boundary->flags;
+	header.file_size  = st.st_size;
+	header.file_mtime = file_mtime(&st);
+
+	index_path(path, sizeof(path), image_path);
+	f = fopen(path, "wb");
+	if (!f) return -1;
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+	    fwrite(boundary->starts.data, BOUNDARY_BUF_SIZE(boundary->size), 1, f) != 1)
+		rc = -1;
+
+	if (fclose(f) != 0) rc = -1;
+	return rc;
+}
+
+int boundary_load(struct boundary *boundary, const char *image_path, uint flags)
+{
+	const struct boundary_header *header;
+	struct stat st, image;
+	char   path[4096];
+	void  *map;
+	int    fd;
+
+	index_path(path, sizeof(path), image_path);
+	if (stat(image_path, &image) < 0) return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	header = map;
+	if (memcmp(header->magic, BOUNDARY_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != BOUNDARY_VERSION || header->step != BOUNDARY_STEP ||
+	    (size_t)st.st_size != sizeof(*header) + BOUNDARY_BUF_SIZE(header->size) ||
+	    header->flags != flags || header->file_size != (uint64_t)image.st_size ||
+	    header->file_mtime != file_mtime(&image)) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	// read-only from here, nothing writes to a loaded index
+	memset(boundary, 0, sizeof(*boundary));
+	boundary->size            = header->size;
+	boundary->count           = header->count;
+	boundary->flags           = header->flags;
+	boundary->starts.data     = (uint32_t *)(header + 1);
+	boundary->starts.size     = BITMAP_WORDS((size_t)header->size);
+	boundary->checkpoints     = boundary->starts.data + boundary->starts.size;
+	boundary->mapped          = map;
+	boundary->mapped_size     = st.st_size;
+	return 0;
+}
+
+void boundary_unmap(struct boundary *boundary)
+{
+	if (boundary->mapped) munmap(boundary->mapped, boundary->mapped_size);
+	boundary->mapped = NULL;
+}
+
+// the paragraph scan_segments decodes `offset` under
+static uint16 segment_at(const struct image *image, uint offset)
+{
+	uint   lo = 0, hi = image->segment_count;
+	uint16 segment;
+
+	if (!image->segment_count) return 0;
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+
+		if ((uint32)image->segments[mid] * 16 <= offset) lo = mid + 1;
+		else                                             hi = mid;
+	}
+
+	segment = lo ? image->segments[lo - 1] : 0;
+	while (offset - segment * 16 > 0xFFFF) segment += 0x1000;
+	return segment;
+}
+
+// walk the whole image once into a heap index, freed with *buf; saving it
+// is up to the caller
+static int build_index(struct boundary *boundary, void **buf, const struct image *image, uint flags)
+{
+	int rc;
+
+	*buf = malloc(BOUNDARY_BUF_SIZE(image->size));
+	if (!*buf) return -3;
+
+	boundary_init_buf(boundary, image->size, *buf);
+	rc = boundary_scan(boundary, image->data, image->size, flags);
+	if (rc < 0) {
+		free(*buf);
+		*buf = NULL;
+	}
+
+	return rc;
+}
+
+int boundary_window(FILE *out, const char *image_path, uint offset, uint count, uint flags,
+                    int save)
+{
+	struct boundary boundary;
+	struct image    image;
+	struct stat     st;
+	Instruction     instruction;
+	uint16 *segments = NULL;
+	uint8  *map      = MAP_FAILED;
+	void   *built    = NULL;
+	uint    start, at, n;
+	int     fd, rc = -1, record, previous;
+
+	fd = open(image_path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "failed to read '%s'\n", image_path);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	segments = malloc(IMAGE_MAX_SEGMENTS((size_t)st.st_size) * sizeof(uint16));
+	if (map == MAP_FAILED || !segments) {
+		rc = -3;
+		goto done;
+	}
+
+	rc = image_load(&image, map, st.st_size, image_path, segments);
+	if (rc < 0) goto done;
+
+	// a fresh index is used as built; a file that can't be written only
+	// costs the next run the scan
+	if (boundary_load(&boundary, image_path, flags) < 0) {
+		rc = build_index(&boundary, &built, &image, flags);
+		if (rc < 0) goto done;
+
+		if (save && boundary_save(&boundary, image_path) < 0)
+			fprintf(stderr, "failed to write the index of '%s'\n", image_path);
+	}
+
+	record = boundary_record(&boundary, offset, &start);
+	if (record < 0) {
+		fprintf(stderr, "offset %u is past the end of '%s' (%u bytes)\n", offset, image_path,
+		        image.size);
+		rc = -1;
+		goto unmap;
+	}
+
+	fprintf(out, "; %s: offset 0x%04X is in record %d of %u, at 0x%04X\n", image_path, offset,
+	        record, boundary.count, start);
+
+	// back to where the window starts, then decode forward from there
+	for (at = start, n = 0; n < count / 2; ++n) {
+		previous = boundary_previous(&boundary, at);
+		if (previous < 0) break;
+		at = previous;
+	}
+
+	for (n = 0; n < count && at < image.size; ++n) {
+		rc = parse_instruction(&instruction, image.data, image.size, at);
+
+		if ((rc < 0 || instruction.structure.type == UNKNOWN) && (flags & SCAN_TOLERANT)) {
+			parse_invalid(&instruction, image.data, image.size, at);
+		} else if (rc < 0 || instruction.structure.type == UNKNOWN) {
+			fprintf(stderr, "failed to decode '%s' at 0x%04X\n", image_path, at);
+			rc = -2;
+			goto unmap;
+		}
+
+		instruction.segment = segment_at(&image, at);
+
+		fprintf(out, "%c 0x%04X  ", at == start ? '>' : ' ', at);
+		decode_instruction(out, &instruction);
+		fputc('\n', out);
+
+		at += instruction.structure.size;
+	}
+
+	rc = 0;
+
+unmap:
+	boundary_unmap(&boundary);
+	free(built);
+done:
+	if (map != MAP_FAILED) munmap(map, st.st_size);
+	free(segments);
+	return rc;
+}
@@ -0,0 +1,84 @@
+#if !defined BOUNDARY_H
+#define BOUNDARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bitmap.h"
+#include "decode.h"
+
+#define BOUNDARY_MAGIC   "I86\x1A"
+#define BOUNDARY_VERSION 2
+
+// image bytes per checkpoint: two bitmap words, so a lookup never counts
+// more than two words
+#define BOUNDARY_STEP 64
+
+// saved next to the image as <image>.idx
+#define BOUNDARY_SUFFIX ".idx"
+
+// records starting before each multiple of BOUNDARY_STEP, through the end of the image
+#define BOUNDARY_CHECKPOINTS(size) ((size_t)(size) / BOUNDARY_STEP + 2)
+
+// buffer boundary_init_buf needs for an image of `size` bytes
+#define BOUNDARY_BUF_SIZE(size) \
+	((BITMAP_WORDS((size_t)(size)) + BOUNDARY_CHECKPOINTS(size)) * sizeof(uint32_t))
+
+// records --at prints when no count is given
+#define BOUNDARY_WINDOW 16
+
+// file layout: this header, the bitmap words, then the checkpoints; host byte order
+struct boundary_header
+{
+	char     magic[4];
+	uint16   version;
+	uint16   step;
+	uint32   size;       // load module bytes
+	uint32   count;      // records
+	uint32   flags;      // SCAN_* the image was decoded with
+	uint32   pad;
+	uint64_t file_size;  // the image file it was built from, a mismatch means it's stale
+	uint64_t file_mtime; // nanoseconds
+};
+
+// where every record of a decoded image starts: a bit per image byte plus
+// the rank of every BOUNDARY_STEP-th byte, so any offset maps to its record
+// and record index in constant time without decoding anything before it
+struct boundary
+{
+	uint          size;
+	uint          count;
+	uint          flags;
+	struct bitmap starts;
+	uint32_t     *checkpoints;
+
+	void         *mapped;   // boundary_load: the whole file
+	size_t        mapped_size;
+};
+
+extern void boundary_init_buf(struct boundary *boundary, uint size, void *buf);
+// mark the records of a scanned image
+extern void boundary_build(struct boundary *boundary, const Instruction *instructions, uint count,
+                           uint flags);
+
+// the record `offset` falls in: its index, and its first byte in *start;
+// -1 past the end of the image
+extern int boundary_record(const struct boundary *boundary, uint offset, uint *start);
+// the first byte of the record before the one at `start`, -1 for the first record
+extern int boundary_previous(const struct boundary *boundary, uint start);
+
+// write <image_path>.idx, and map it back read-only; a stale or missing
+// index (the image changed since, or was decoded with other flags) fails
+// to load
+extern int  boundary_save(const struct boundary *boundary, const char *image_path);
+extern int  boundary_load(struct boundary *boundary, const char *image_path, uint flags);
+extern void boundary_unmap(struct boundary *boundary);
+
+// --at: decode `count` records around image offset `offset`, the one it
+// falls in halfway down. Without a current <image>.idx the index is built
+// in memory, and saved as well if `save` is set (--index).
+extern int boundary_window(FILE *out, const char *image_path, uint offset, uint count, uint flags,
+                           int save);
+
+#endif // BOUNDARY_H
@@ -1,789 +1,390 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
 #include "bitmap.h"
-
-typedef unsigned int uint;
-typedef uint8_t      uint8;
-typedef uint16_t     uint16;
-typedef uint32_t     uint32;
-typedef int8_t       int8;
-typedef int16_t      int16;
-
-#define MASK_W     (0b1  << 0)
-#define MASK_D     (0b1  << 1)
-#define MASK_S     (0b1  << 2)
-#define MASK_V     (0b1  << 3)
-#define MASK_ES    (0b00 << 4)
-#define MASK_CS    (0b01 << 4)
-#define MASK_SS    (0b10 << 4)
-#define MASK_DS    (0b11 << 4)
-#define MASK_MO    (0b1  << 6)
-#define MASK_LB    (0b1  << 7)
-#define MASK_MOD   0b11
-#define MASK_RM    0b111
-#define MASK_REG   0b111
-
-#define MODE_MEM0  0b00
-#define MODE_MEM8  0b01
-#define MODE_MEM16 0b10
-#define MODE_REG   0b11
-
-#define PFX_WIDE     (0b1  << 0)
-#define PFX_FAR      (0b1  << 1)
-#define PFX_LOCK     (0b1  << 2)
-#define PFX_SGMNT    (0b1  << 3)
-#define PFX_SGMNT_ES (0b00 << 4)
-#define PFX_SGMNT_CS (0b01 << 4)
-#define PFX_SGMNT_SS (0b10 << 4)
-#define PFX_SGMNT_DS (0b11 << 4)
-#define PFX_REP      (0b1  << 6)
-#define PFX_REPNE    (0b1  << 7)
-
-#define SR_OP(flags) (((flags) >> 4) & 0b11)
-#define W(flags)     (!!(flags & MASK_W))
-
-#define SR(byte)   (((byte) >> 3) & 0b11)
-#define MOD(byte)  (((byte) >> 6) & 0b11)
-#define RM(byte)   (((byte) >> 0) & 0b111)
-#define REG(byte)  (((byte) >> 3) & 0b111)
-#define REG2(byte) (((byte) >> 0) & 0b111)
-#define ESC1(byte) (((byte) >> 0) & 0b111)
-#define ESC2(byte) (((byte) >> 3) & 0b111)
-#define EXTD(byte) (((byte) >> 3) & 0b111)
-
-#define SGMNT_OP(prefixes) (((prefixes) >>  4)  & 0b11)
-#define FIELD_MOD(fields)  (((fields)   >>  0)  & 0b11)
-#define FIELD_SR(fields)   (((fields)   >>  2)  & 0b11)
-#define FIELD_RM(fields)   (((fields)   >>  4)  & 0b111)
-#define FIELD_REG(fields)  (((fields)   >>  7)  & 0b111)
-#define FIELD_ESC(fields)  (((fields)   >> 10)  & 0b111111)
+#include "decode.h"
+#include "profile.h"
+#include "xref.h"
 
 static char *segregs[4] = { "es", "cs", "ss", "ds" };
 static char *regs[2][8] = {
     { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" },
     { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" }
 };
-
-typedef enum {
-    NONE,
-
-    // [mod ... r/m] [disp-lo] [disp-hi]
-    RM,
-    // [mod ... r/m] [disp-lo] [disp-hi] (store 1/cl)
-    RM_V,
-    // [mod 0 sr r/m] [disp-lo] [disp-hi]
-    RM_SR,
-    // [mod reg r/m] [disp-lo] [disp-hi]
-    RM_REG,
-    // [mod ... r/m] [disp-lo] [disp-hi] [data]
-    RM_IMM,
-    // [... xxx] [mod yyy r/m] [disp-lo] [disp-hi]
-    RM_ESC,
-
-    ACC_DX,
-    // [data-8]
-    ACC_IMM8,
-    // [data-lo] [data-hi]
-    ACC_IMM,
-    // [... reg]
-    ACC_REG,
-    // [addr-lo] [addr-hi]
-    ACC_MEM,
-
-    // [... reg]
-    REG,
-    // [...reg] [data-hi] [data-lo]
-    REG_IMM,
-
-    // [... sr ...]
-    SR,
-
-    // [data-lo] [data-hi]
-    IMM,
-
-    // [ip-inc-8]
-    JMP_SHORT,
-    // [ip-inc-lo] [ip-inc-hi]
-    JMP_NEAR,
-    // [ip-lo] [ip-hi] [cs-lo] [cs-hi]
-    JMP_FAR,
- } FORMAT;
-
-typedef enum {
-    UNKNOWN = 0,
-
-    AAA,    AAD,   AAM,   AAS,
-    ADC,    ADD,   AND,   CALL,
-    CALLF,  CBW,   CLC,   CLD,
-    CLI,    CMC,   CMP,   CMPSB,
-    CMPSW,  CWD,   DAA,   DAS,
-    DEC,    DIV,   ESC,   HLT,
-    IDIV,   IMUL,  IN,    INC,
-    INT,    INT3,  INTO,  IRET,
-    JA,     JAE,   JB,    JBE,
-    JCXZ,   JE,    JG,    JGE,
-    JL,     JLE,   JMP,   JMPF,
-    JNE,    JNO,   JNS,   JO,
-    JP,     JPO,   JS,    LAHF,
-    LDS,    LEA,   LES,   LOCK,
-    LODSB,  LODSW, LOOP,  LOOPZ,
-    LOOPNZ, MOV,   MOVSB, MOVSW,
-    MUL,    NEG,   NOP,   NOT,
-    OR,     OUT,   POP,   POPF,
-    PUSH,   PUSHF, RCL,   RCR,
-    REP,    REPNE, RET,   RETF,
-    ROL,    ROR,   SAHF,  SAR,
-    SBB,    SCASB, SCASW, SGMNT,
-    SHL,    SHR,   STC,   STD,
-    STOSB,  STOSW, STI,   SUB,
-    TEST,   WAIT,  XCHG,  XLAT,
-    XOR,
-
-    EXTD,
-} TYPE;
-
-typedef struct {
-    TYPE   type;
-    FORMAT format;
-    uint8  flags;
-    uint8  prefixes;
-    uint8  size;
-} InstructionData;
-
-typedef struct {
-    InstructionData structure;
-    uint16          data;
-    uint16          data_ext;
-    uint16          displacement;
-    uint16          fields;
-    uint            offset;
-} Instruction;
+static char *ea_base[8] = {
+    "bx + si", 
+    "bx + di", 
+    "bp + si", 
+    "bp + di", 
+    "si", 
+    "di", 
+    "bp", 
+    "bx"
+};
 
 InstructionData instruction_table[256] = {
-    { ADD,     RM_REG,    0,                     0, 2 }, // 0x00
-    { ADD,     RM_REG,    MASK_W,                0, 2 }, // 0x01
-    { ADD,     RM_REG,    MASK_D,                0, 2 }, // 0x02
-    { ADD,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x03
-    { ADD,     ACC_IMM,   0,                     0, 2 }, // 0x04
-    { ADD,     ACC_IMM,   MASK_W,                0, 3 }, // 0x05
-    { PUSH,    SR,        MASK_ES,               0, 1 }, // 0x06
-    { POP,     SR,        MASK_ES,               0, 1 }, // 0x07
-    { OR,      RM_REG,    0,                     0, 2 }, // 0x08
-    { OR,      RM_REG,    MASK_W,                0, 2 }, // 0x09
-    { OR,      RM_REG,    MASK_D,                0, 2 }, // 0x0A
-    { OR,      RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x0B
-    { OR,      ACC_IMM,   0,                     0, 2 }, // 0x0C
-    { OR,      ACC_IMM,   MASK_W,                0, 3 }, // 0x0D
-    { PUSH,    SR,        MASK_CS,               0, 1 }, // 0x0E
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x0F
-    { ADC,     RM_REG,    0,                     0, 2 }, // 0x10
-    { ADC,     RM_REG,    MASK_W,                0, 2 }, // 0x11
-    { ADC,     RM_REG,    MASK_D,                0, 2 }, // 0x12
-    { ADC,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x13
-    { ADC,     ACC_IMM,   0,                     0, 2 }, // 0x14
-    { ADC,     ACC_IMM,   MASK_W,                0, 3 }, // 0x15
-    { PUSH,    SR,        MASK_SS,               0, 1 }, // 0x16
-    { POP,     SR,        MASK_SS,               0, 1 }, // 0x17
-    { SBB,     RM_REG,    0,                     0, 2 }, // 0x18
-    { SBB,     RM_REG,    MASK_W,                0, 2 }, // 0x19
-    { SBB,     RM_REG,    MASK_D,                0, 2 }, // 0x1A
-    { SBB,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x1B
-    { SBB,     ACC_IMM,   0,                     0, 2 }, // 0x1C
-    { SBB,     ACC_IMM,   MASK_W,                0, 3 }, // 0x1D
-    { PUSH,    SR,        MASK_DS,               0, 1 }, // 0x1E
-    { POP,     SR,        MASK_DS,               0, 1 }, // 0x1F
-    { AND,     RM_REG,    0,                     0, 2 }, // 0x20
-    { AND,     RM_REG,    MASK_W,                0, 2 }, // 0x21
-    { AND,     RM_REG,    MASK_D,                0, 2 }, // 0x22
-    { AND,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x23
-    { AND,     ACC_IMM,   0,                     0, 2 }, // 0x24
-    { AND,     ACC_IMM,   MASK_W,                0, 3 }, // 0x25
-    { SGMNT,   NONE,      MASK_ES,               0, 1 }, // 0x26
-    { DAA,     NONE,      0,                     0, 1 }, // 0x27
-    { SUB,     RM_REG,    0,                     0, 2 }, // 0x28
-    { SUB,     RM_REG,    MASK_W,                0, 2 }, // 0x29
-    { SUB,     RM_REG,    MASK_D,                0, 2 }, // 0x2A
-    { SUB,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x2B
-    { SUB,     ACC_IMM,   0,                     0, 2 }, // 0x2C
-    { SUB,     ACC_IMM,   MASK_W,                0, 3 }, // 0x2D
-    { SGMNT,   NONE,      MASK_CS,               0, 1 }, // 0x2E
-    { DAS,     NONE,      0,                     0, 1 }, // 0x2F
-    { XOR,     RM_REG,    0,                     0, 2 }, // 0x30
-    { XOR,     RM_REG,    MASK_W,                0, 2 }, // 0x31
-    { XOR,     RM_REG,    MASK_D,                0, 2 }, // 0x32
-    { XOR,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x33
-    { XOR,     ACC_IMM,   0,                     0, 2 }, // 0x34
-    { XOR,     ACC_IMM,   MASK_W,                0, 3 }, // 0x35
-    { SGMNT,   NONE,      MASK_SS,               0, 1 }, // 0x36
-    { AAA,     NONE,      0,                     0, 1 }, // 0x37
-    { CMP,     RM_REG,    0,                     0, 2 }, // 0x38
-    { CMP,     RM_REG,    MASK_W,                0, 2 }, // 0x39
-    { CMP,     RM_REG,    MASK_D,                0, 2 }, // 0x3A
-    { CMP,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x3B
-    { CMP,     ACC_IMM,   0,                     0, 2 }, // 0x3C
-    { CMP,     ACC_IMM,   MASK_W,                0, 3 }, // 0x3D
-    { SGMNT,   NONE,      MASK_DS,               0, 1 }, // 0x3E
-    { AAS,     NONE,      0,                     0, 1 }, // 0x3F
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x40
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x41
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x42
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x43
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x44
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x45
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x46
-    { INC,     REG,       MASK_W,                0, 1 }, // 0x47
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x48
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x49
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4A
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4B
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4C
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4D
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4E
-    { DEC,     REG,       MASK_W,                0, 1 }, // 0x4F
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x50
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x51
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x52
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x53
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x54
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x55
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x56
-    { PUSH,    REG,       MASK_W,                0, 1 }, // 0x57
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x58
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x59
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5A
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5B
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5C
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5D
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5E
-    { POP,     REG,       MASK_W,                0, 1 }, // 0x5F
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x60
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x61
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x62
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x63
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x64
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x65
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x66
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x67
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x68
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x69
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6A
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6B
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6C
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6D
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6E
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0x6F
-    { JO,      JMP_SHORT, 0,                     0, 2 }, // 0x70
-    { JNO,     JMP_SHORT, 0,                     0, 2 }, // 0x71
-    { JB,      JMP_SHORT, 0,                     0, 2 }, // 0x72
-    { JAE,     JMP_SHORT, 0,                     0, 2 }, // 0x73
-    { JE,      JMP_SHORT, 0,                     0, 2 }, // 0x74
-    { JNE,     JMP_SHORT, 0,                     0, 2 }, // 0x75
-    { JBE,     JMP_SHORT, 0,                     0, 2 }, // 0x76
-    { JA,      JMP_SHORT, 0,                     0, 2 }, // 0x77
-    { JS,      JMP_SHORT, 0,                     0, 2 }, // 0x78
-    { JNS,     JMP_SHORT, 0,                     0, 2 }, // 0x79
-    { JP,      JMP_SHORT, 0,                     0, 2 }, // 0x7A
-    { JPO,     JMP_SHORT, 0,                     0, 2 }, // 0x7B
-    { JL,      JMP_SHORT, 0,                     0, 2 }, // 0x7C
-    { JGE,     JMP_SHORT, 0,                     0, 2 }, // 0x7D
-    { JLE,     JMP_SHORT, 0,                     0, 2 }, // 0x7E
-    { JG,      JMP_SHORT, 0,                     0, 2 }, // 0x7F
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x80
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x81
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x82
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x83
-    { TEST,    RM_REG,    0,                     0, 2 }, // 0x84
-    { TEST,    RM_REG,    MASK_W,                0, 2 }, // 0x85
-    { XCHG,    RM_REG,    MASK_D,                0, 2 }, // 0x86
-    { XCHG,    RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x87
-    { MOV,     RM_REG,    0,                     0, 2 }, // 0x88
-    { MOV,     RM_REG,    MASK_W,                0, 2 }, // 0x89
-    { MOV,     RM_REG,    MASK_D,                0, 2 }, // 0x8A
-    { MOV,     RM_REG,    MASK_D|MASK_W,         0, 2 }, // 0x8B
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x8C
-    { LEA,     RM_REG,    MASK_D|MASK_W|MASK_MO, 0, 2 }, // 0x8D
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x8E
-    { EXTD,    NONE,      0,                     0, 0 }, // 0x8F
-    { NOP,     NONE,      MASK_W,                0, 1 }, // 0x90
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x91
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x92
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x93
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x94
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x95
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x96
-    { XCHG,    ACC_REG,   MASK_W,                0, 1 }, // 0x97
-    { CBW,     NONE,      0,                     0, 1 }, // 0x98
-    { CWD,     NONE,      0,                     0, 1 }, // 0x99
-    { CALL,    JMP_FAR,   0,                     0, 5 }, // 0x9A
-    { WAIT,    NONE,      0,                     0, 1 }, // 0x9B
-    { PUSHF,   NONE,      0,                     0, 1 }, // 0x9C
-    { POPF,    NONE,      0,                     0, 1 }, // 0x9D
-    { SAHF,    NONE,      0,                     0, 1 }, // 0x9E
-    { LAHF,    NONE,      0,                     0, 1 }, // 0x9F
-    { MOV,     ACC_MEM,   MASK_MO,               0, 3 }, // 0xA0
-    { MOV,     ACC_MEM,   MASK_W|MASK_MO,        0, 3 }, // 0xA1
-    { MOV,     ACC_MEM,   MASK_D|MASK_MO,        0, 3 }, // 0xA2
-    { MOV,     ACC_MEM,   MASK_D|MASK_W|MASK_MO, 0, 3 }, // 0xA3
-    { MOVSB,   NONE,      0,                     0, 1 }, // 0xA4
-    { MOVSW,   NONE,      MASK_W,                0, 1 }, // 0xA5
-    { CMPSB,   NONE,      0,                     0, 1 }, // 0xA6
-    { CMPSW,   NONE,      MASK_W,                0, 1 }, // 0xA7
-    { TEST,    ACC_IMM,   0,                     0, 2 }, // 0xA8
-    { TEST,    ACC_IMM,   MASK_W,                0, 3 }, // 0xA9
-    { STOSB,   NONE,      0,                     0, 1 }, // 0xAA
-    { STOSW,   NONE,      0,                     0, 1 }, // 0xAB
-    { LODSB,   NONE,      0,                     0, 1 }, // 0xAC
-    { LODSW,   NONE,      0,                     0, 1 }, // 0xAD
-    { SCASB,   NONE,      0,                     0, 1 }, // 0xAE
-    { SCASW,   NONE,      0,                     0, 1 }, // 0xAF
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB0
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB1
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB2
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB3
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB4
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB5
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB6
-    { MOV,     REG_IMM,   0,                     0, 2 }, // 0xB7
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xB8
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xB9
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBA
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBB
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBC
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBD
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBE
-    { MOV,     REG_IMM,   MASK_W,                0, 3 }, // 0xBF
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xC0
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xC1
-    { RET,     IMM,       MASK_W,                0, 3 }, // 0xC2
-    { RET,     NONE,      0,                     0, 1 }, // 0xC3
-    { LES,     RM_REG,    MASK_D|MASK_W|MASK_MO, 0, 2 }, // 0xC4
-    { LDS,     RM_REG,    MASK_D|MASK_W|MASK_MO, 0, 2 }, // 0xC5
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xC6
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xC7
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xC8
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xC9
-    { RETF,    IMM,       MASK_W,                0, 3 }, // 0xCA
-    { RETF,    NONE,      0,                     0, 1 }, // 0xCB
-    { INT3,    NONE,      0,                     0, 1 }, // 0xCC
-    { INT,     IMM,       0,                     0, 2 }, // 0xCD
-    { INTO,    NONE,      0,                     0, 1 }, // 0xCE
-    { IRET,    NONE,      0,                     0, 1 }, // 0xCF
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xD0
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xD1
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xD2
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xD3
-    { AAM,     NONE,      0,                     0, 2 }, // 0xD4
-    { AAD,     NONE,      0,                     0, 2 }, // 0xD5
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xD6
-    { XLAT,    NONE,      0,                     0, 1 }, // 0xD7
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xD8
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xD9
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDA
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDB
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDC
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDD
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDE
-    { ESC,     RM_ESC,    MASK_W,                0, 2 }, // 0xDF
-    { LOOPNZ,  JMP_SHORT, 0,                     0, 2 }, // 0xE0
-    { LOOPZ,   JMP_SHORT, 0,                     0, 2 }, // 0xE1
-    { LOOP,    JMP_SHORT, 0,                     0, 2 }, // 0xE2
-    { JCXZ,    JMP_SHORT, 0,                     0, 2 }, // 0xE3
-    { IN,      ACC_IMM8,  0,                     0, 2 }, // 0xE4
-    { IN,      ACC_IMM8,  MASK_W,                0, 2 }, // 0xE5
-    { OUT,     ACC_IMM8,  MASK_D,                0, 2 }, // 0xE6
-    { OUT,     ACC_IMM8,  MASK_D|MASK_W,         0, 2 }, // 0xE7
-    { CALL,    JMP_NEAR,  0,                     0, 3 }, // 0xE8
-    { JMP,     JMP_NEAR,  0,                     0, 3 }, // 0xE9
-    { JMP,     JMP_FAR,   0,                     0, 5 }, // 0xEA
-    { JMP,     JMP_SHORT, 0,                     0, 2 }, // 0xEB
-    { IN,      ACC_DX,    0,                     0, 1 }, // 0xEC
-    { IN,      ACC_DX,    MASK_W,                0, 1 }, // 0xED
-    { OUT,     ACC_DX,    MASK_D,                0, 1 }, // 0xEE
-    { OUT,     ACC_DX,    MASK_D|MASK_W,         0, 1 }, // 0xEF
-    { LOCK,    NONE,      0,                     0, 1 }, // 0xF0
-    { UNKNOWN, NONE,      0,                     0, 1 }, // 0xF1
-    { REPNE,   NONE,      0,                     0, 1 }, // 0xF2
-    { REP,     NONE,      0,                     0, 1 }, // 0xF3
-    { HLT,     NONE,      0,                     0, 1 }, // 0xF4
-    { CMC,     NONE,      0,                     0, 1 }, // 0xF5
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xF6
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xF7
-    { CLC,     NONE,      0,                     0, 1 }, // 0xF8
-    { STC,     NONE,      0,                     0, 1 }, // 0xF9
-    { CLI,     NONE,      0,                     0, 1 }, // 0xFA
-    { STI,     NONE,      0,                     0, 1 }, // 0xFB
-    { CLD,     NONE,      0,                     0, 1 }, // 0xFC
-    { STD,     NONE,      0,                     0, 1 }, // 0xFD
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xFE
-    { EXTD,    NONE,      0,                     0, 0 }, // 0xFF
+#define OPCODE(byte, type, format, flags, prefixes, size, clocks, alt) [byte] = { type, format, flags, prefixes, size, clocks, alt },
+#define GROUP(byte, index) [byte] = { EXTD, NONE, 0, 0, 0, 0, 0 },
+#include "instructions.def"
 };
 
+// every opcode byte needs exactly one row, -Woverride-init catches duplicates
+_Static_assert(0
+#define OPCODE(byte, type, format, flags, prefixes, size, clocks, alt) + 1
+#define GROUP(byte, index) + 1
+#include "instructions.def"
+    == 256, "instructions.def must cover all 256 opcodes");
+
 InstructionData instruction_table_extd[17][8] = {
-    // [0x00]: 0x80 (0b1000 0000)
-    {
-        { ADD,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { OR,   RM_IMM, 0,            PFX_WIDE, 3 },
-        { ADC,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { SBB,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { AND,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { SUB,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { XOR,  RM_IMM, 0,            PFX_WIDE, 3 },
-        { CMP,  RM_IMM, 0,            PFX_WIDE, 3 },
-    },
-    // [0x01]: 0x81 (0b1000 0001)
-    {
-        { ADD,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { OR,   RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { ADC,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { SBB,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { AND,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { SUB,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { XOR,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { CMP,  RM_IMM, MASK_W,          PFX_WIDE, 4 },
-    },
-    // [0x02]: 0x82 (0b1000 0010)
-    {
-        { ADD,      RM_IMM, MASK_S,       PFX_WIDE, 3 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { ADC,      RM_IMM, MASK_S,       PFX_WIDE, 3 },
-        { SBB,      RM_IMM, MASK_S,       PFX_WIDE, 3 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { SUB,      RM_IMM, MASK_S,       PFX_WIDE, 3 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { CMP,      RM_IMM, MASK_S,       PFX_WIDE, 3 },
-    },
-    // [0x03]: 0x83 (0b1000 0011)
-    {
-        { ADD,     RM_IMM, MASK_S|MASK_W, PFX_WIDE, 3 },
-        { UNKNOWN, NONE,   0,             0,        1 },
-        { ADC,     RM_IMM, MASK_S|MASK_W, PFX_WIDE, 3 },
-        { SBB,     RM_IMM, MASK_S|MASK_W, PFX_WIDE, 3 },
-        { UNKNOWN, NONE,   0,             0,        1 },
-        { SUB,     RM_IMM, MASK_S|MASK_W, PFX_WIDE, 3 },
-        { UNKNOWN, NONE,   0,             0,        1 },
-        { CMP,     RM_IMM, MASK_S|MASK_W, PFX_WIDE, 3 },
-    },
-    // [0x04]: 0x8C (0b1000 1100)
-    {
-        { MOV,     RM_SR,  MASK_ES|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_CS|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_SS|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_DS|MASK_W, 0,        2 },
-        { UNKNOWN, NONE,   0,              0,        1 },
-        { UNKNOWN, NONE,   0,              0,        1 },
-        { UNKNOWN, NONE,   0,              0,        1 },
-        { UNKNOWN, NONE,   0,              0,        1 },
-    },
-    // [0x05]: 0x8E (0b1000 1110)
-    {
-        { MOV,     RM_SR,  MASK_ES|MASK_D|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_CS|MASK_D|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_SS|MASK_D|MASK_W, 0,        2 },
-        { MOV,     RM_SR,  MASK_DS|MASK_D|MASK_W, 0,        2 },
-        { UNKNOWN, NONE,   0,                     0,        1 },
-        { UNKNOWN, NONE,   0,                     0,        1 },
-        { UNKNOWN, NONE,   0,                     0,        1 },
-        { UNKNOWN, NONE,   0,                     0,        1 },
-    },
-    // [0x06]: 0x8F (0b1000 1111)
-    {
-        { POP,      RM,     MASK_W,       PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-    },
-    // [0x07]: 0xC6 (0b1100 0110)
-    {
-        { MOV,      RM_IMM, MASK_MO,      PFX_WIDE, 3 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-    },
-    // [0x08]: 0xC7 (0b1100 0111)
-    {
-        { MOV,      RM_IMM, MASK_W|MASK_MO, PFX_WIDE, 4 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-        { UNKNOWN,  NONE,   0,              0,        1 },
-    },
-    // [0x09]: 0xD0 (0b1101 0000)
-    {
-        { ROL,      RM_V,   0,            PFX_WIDE, 2 },
-        { ROR,      RM_V,   0,            PFX_WIDE, 2 },
-        { RCL,      RM_V,   0,            PFX_WIDE, 2 },
-        { RCR,      RM_V,   0,            PFX_WIDE, 2 },
-        { SHL,      RM_V,   0,            PFX_WIDE, 2 },
-        { SHR,      RM_V,   0,            PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { SAR,      RM_V,   0,            PFX_WIDE, 2 },
-    },
-    // [0x0A]: 0xD1 (0b1101 0001)
-    {
-        { ROL,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { ROR,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { RCL,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { RCR,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { SHL,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { SHR,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,               0,        1 },
-        { SAR,      RM_V,   MASK_W,          PFX_WIDE, 2 },
-    },
-    // [0x0B]: 0xD2 (0b1101 0010)
-    {
-        { ROL,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { ROR,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { RCL,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { RCR,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { SHL,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { SHR,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,               0,        1 },
-        { SAR,      RM_V,   MASK_V,          PFX_WIDE, 2 },
-    },
-    // [0x0C]: 0xD3 (0b1101 0011)
-    {
-        { ROL,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { ROR,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { RCL,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { RCR,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { SHL,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { SHR,      RM_V,   MASK_V|MASK_W,      PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,                  0,        1 },
-        { SAR,      RM_V,   MASK_V| MASK_W,     PFX_WIDE, 2 },
-    },
-    // [0x0D]: 0xF6 (0b1111 0110)
-    {
-        { TEST,     RM_IMM, 0,            PFX_WIDE, 3 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { NOT,      RM,     0,            PFX_WIDE, 2 },
-        { NEG,      RM,     0,            PFX_WIDE, 2 },
-        { MUL,      RM,     0,            PFX_WIDE, 2 },
-        { IMUL,     RM,     0,            PFX_WIDE, 2 },
-        { DIV,      RM,     0,            PFX_WIDE, 2 },
-        { IDIV,     RM,     0,            PFX_WIDE, 2 },
-    },
-    // [0x0E]: 0xF7 (0b1111 0111)
-    {
-        { TEST,     RM_IMM, MASK_W,          PFX_WIDE, 4 },
-        { UNKNOWN,  NONE,   0,               0,        1 },
-        { NOT,      RM,     MASK_W,          PFX_WIDE, 2 },
-        { NEG,      RM,     MASK_W,          PFX_WIDE, 2 },
-        { MUL,      RM,     MASK_W,          PFX_WIDE, 2 },
-        { IMUL,     RM,     MASK_W,          PFX_WIDE, 2 },
-        { DIV,      RM,     MASK_W,          PFX_WIDE, 2 },
-        { IDIV,     RM,     MASK_W,          PFX_WIDE, 2 },
-    },
-    // [0x0F]: 0xFE (0b1111 1110)
-    {
-        { INC,      RM,     0,            PFX_WIDE, 2 },
-        { DEC,      RM,     0,            PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-        { UNKNOWN,  NONE,   0,            0,        1 },
-    },
-    // [0x10]: 0xFF (0b1111 1111)
-    {
-        { INC,      RM,     MASK_W|MASK_MO,  PFX_WIDE, 2 },
-        { DEC,      RM,     MASK_W|MASK_MO,  PFX_WIDE, 2 },
-        { CALL,     RM,     MASK_W,          0,        2 },
-        { CALL,     RM,     MASK_W|MASK_MO,  PFX_FAR,  2 },
-        { JMP,      RM,     MASK_W,          0,        2 },
-        { JMP,      RM,     MASK_W|MASK_MO,  PFX_FAR,  2 },
-        { PUSH,     RM,     MASK_W|MASK_MO,  PFX_WIDE, 2 },
-        { UNKNOWN,  NONE,   0,               PFX_WIDE, 1 },
-    },
+#define GROUP_OP(index, reg, type, format, flags, prefixes, size, clocks, alt) [index][reg] = { type, format, flags, prefixes, size, clocks, alt },
+#include "instructions.def"
+};
+
+// opcode -> instruction_table_extd row
+static const uint8 extd_group[256] = {
+#define GROUP(byte, index) [byte] = index,
+#include "instructions.def"
+};
+
+// instruction_length's view of the tables: size before displacement, plus flags
+#define LEN_SIZE    0x07
+#define LEN_MODRM   0x08 // a modrm byte that may add displacement bytes
+#define LEN_GROUP   0x10 // size depends on the group row modrm.reg picks
+#define LEN_INVALID 0x20
+#define LEN_PREFIX  0x40
+
+#define IS_PREFIX(type) ((type) == LOCK || (type) == REP || (type) == REPNE || (type) == SGMNT)
+
+#define LENGTH_OF(type, format, size) \
+    ((size) | ((format) >= RM && (format) <= RM_ESC ? LEN_MODRM : 0) | ((type) == UNKNOWN ? LEN_INVALID : 0) | \
+     (IS_PREFIX(type) ? LEN_PREFIX : 0))
+
+static const uint8 length_table[256] = {
+#define OPCODE(byte, type, format, flags, prefixes, size, clocks, alt) [byte] = LENGTH_OF(type, format, size),
+#define GROUP(byte, index) [byte] = LEN_GROUP,
+#include "instructions.def"
+};
+
+static const uint8 length_table_extd[17][8] = {
+#define GROUP_OP(index, reg, type, format, flags, prefixes, size, clocks, alt) [index][reg] = LENGTH_OF(type, format, size),
+#include "instructions.def"
+};
+
+// one char array per mnemonic, laid out back to back
+struct name_pool {
+#define MNEMONIC(type, name) char type[sizeof(name)];
+#include "instructions.def"
+};
+
+static const struct name_pool name_pool = {
+#define MNEMONIC(type, name) name,
+#include "instructions.def"
+};
+
+_Static_assert(sizeof(struct name_pool) == 0
+#define MNEMONIC(type, name) + sizeof(name)
+#include "instructions.def"
+    , "mnemonic pool must be packed");
+
+const char *const instruction_name_pool = (const char *)&name_pool;
+
+const InstructionName instruction_names[EXTD] = {
+#define MNEMONIC(type, name) [type] = { offsetof(struct name_pool, type), sizeof(name) - 1 },
+#include "instructions.def"
 };
 
 const char *get_instruction_name(TYPE type) {
-    switch(type) {
-        case AAA:    return "aaa";
-        case AAD:    return "aad";
-        case AAM:    return "aam";
-        case AAS:    return "aas";
-        case ADC:    return "adc";
-        case ADD:    return "add";
-        case AND:    return "and";
-        case CALL:   return "call";
-        case CALLF:  return "callf";
-        case CBW:    return "cbw";
-        case CLC:    return "clc";
-        case CLD:    return "cld";
-        case CLI:    return "cli";
-        case CMC:    return "cmc";
-        case CMP:    return "cmp";
-        case CMPSB:  return "cmpsb";
-        case CMPSW:  return "cmpsw";
-        case CWD:    return "cwd";
-        case DAA:    return "daa";
-        case DAS:    return "das";
-        case DEC:    return "dec";
-        case DIV:    return "div";
-        case ESC:    return "esc";
-        case HLT:    return "hlt";
-        case IDIV:   return "idiv";
-        case IMUL:   return "imul";
-        case IN:     return "in";
-        case INC:    return "inc";
-        case INT:    return "int";
-        case INT3:   return "int3";
-        case INTO:   return "into";
-        case IRET:   return "iret";
-        case JA:     return "ja";
-        case JAE:    return "jae";
-        case JB:     return "jb";
-        case JBE:    return "jbe";
-        case JCXZ:   return "jcxz";
-        case JE:     return "je";
-        case JG:     return "jg";
-        case JGE:    return "jge";
-        case JL:     return "jl";
-        case JLE:    return "jle";
-        case JMP:    return "jmp";
-        case JMPF:   return "jmpf";
-        case JNE:    return "jne";
-        case JNO:    return "jno";
-        case JNS:    return "jns";
-        case JO:     return "jo";
-        case JP:     return "jp";
-        case JPO:    return "jpo";
-        case JS:     return "js";
-        case LAHF:   return "lahf";
-        case LDS:    return "lds";
-        case LEA:    return "lea";
-        case LES:    return "les";
-        case LOCK:   return "lock";
-        case LODSB:  return "lodsb";
-        case LODSW:  return "lodsw";
-        case LOOP:   return "loop";
-        case LOOPZ:  return "loopz";
-        case LOOPNZ: return "loopnz";
-        case MOV:    return "mov";
-        case MOVSB:  return "movsb";
-        case MOVSW:  return "movsw";
-        case MUL:    return "mul";
-        case NEG:    return "neg";
-        case NOP:    return "nop";
-        case NOT:    return "not";
-        case OR:     return "or";
-        case OUT:    return "out";
-        case POP:    return "pop";
-        case POPF:   return "popf";
-        case PUSH:   return "push";
-        case PUSHF:  return "pushf";
-        case RCL:    return "rcl";
-        case RCR:    return "rcr";
-        case REP:    return "rep";
-        case REPNE:  return "repne";
-        case RET:    return "ret";
-        case RETF:   return "retf";
-        case ROL:    return "rol";
-        case ROR:    return "ror";
-        case SAHF:   return "sahf";
-        case SAR:    return "sar";
-        case SBB:    return "sbb";
-        case SCASB:  return "scasb";
-        case SCASW:  return "scasw";
-        case SGMNT:  return "";
-        case SHL:    return "shl";
-        case SHR:    return "shr";
-        case STC:    return "stc";
-        case STD:    return "std";
-        case STOSB:  return "stosb";
-        case STOSW:  return "stosw";
-        case STI:    return "sti";
-        case SUB:    return "sub";
-        case TEST:   return "test";
-        case WAIT:   return "wait";
-        case XCHG:   return "xchg";
-        case XLAT:   return "xlat";
-        case XOR:    return "xor";
-        case UNKNOWN:return "<invalid>";
-        case EXTD:   assert(0 && "EXTD encountered");
-    }
+    assert(type != EXTD && "EXTD encountered");
 
-    return "<unknown>";
+    if ((uint)type >= EXTD) return "<unknown>";
+    return instruction_name_pool + instruction_names[type].offset;
 };
 
 int get_jmp_offset(Instruction *instruction) {
-    int    label_addr = 0;
+    int    label_addr = 0, base;
     uint8  tmp8;
     uint16 tmp16;
 
     switch (instruction->structure.format) {
         case JMP_SHORT:
             tmp8 = instruction->data & 0xFF;
-            label_addr = instruction->offset + 2 + *((int8 *)&tmp8);
+            label_addr = instruction->offset + instruction->structure.size + *((int8 *)&tmp8);
             break;
         case  JMP_NEAR:
             tmp16 = instruction->data;
-            label_addr = instruction->offset + 3 + *((int16 *)&tmp16);
+            label_addr = instruction->offset + instruction->structure.size + *((int16 *)&tmp16);
             break;
         default: return -1;
     }
 
+    // ip arithmetic is 16-bit inside a segment
+    if (instruction->segment) {
+        base = instruction->segment * 16;
+        label_addr = base + ((label_addr - base) & 0xFFFF);
+    }
+
     return label_addr;
 }
 
 
+const char *get_register_name(uint8 w, uint8 reg) {
+    return regs[!!w][reg & 0b111];
+}
+
+const char *get_segment_name(uint8 sr) {
+    return segregs[sr & 0b11];
+}
+
+const char *get_ea_name(uint8 rm) {
+    return ea_base[rm & 0b111];
+}
+
+static Operand operand_rm(Instruction *instruction) {
+    Operand op = { OPERAND_REG, 0, 0, 0, 0 };
+    uint8 mod = FIELD_MOD(instruction->fields);
+    uint8 rm  = FIELD_RM(instruction->fields);
+
+    op.width = W(instruction->structure.flags) + 1;
+    op.reg   = rm;
+
+    if (mod == MODE_REG) return op;
+
+    op.kind  = OPERAND_MEM;
+    op.value = *((int16 *)&instruction->displacement);
+
+    if (mod == MODE_MEM0 && rm == 0b110) {
+        op.reg   = EA_DIRECT;
+        op.value = instruction->displacement;
+    } else if (mod == MODE_MEM8) {
+        op.value = (int8)(instruction->displacement & 0xFF);
+    } else if (mod == MODE_MEM0) {
+        op.value = 0;
+    }
+
+    return op;
+}
+
+int get_operands(Instruction *instruction, Operand ops[2]) {
+    Operand tmp, none = { OPERAND_NONE, 0, 0, 0, 0 };
+    uint8 w = W(instruction->structure.flags) + 1;
+    int count = 2;
+
+    ops[0] = ops[1] = none;
+
+    switch (instruction->structure.format) {
+        case RM:
+        case RM_ESC:
+            ops[0] = operand_rm(instruction);
+            count = 1;
+            break;
+        case RM_V:
+            ops[0] = operand_rm(instruction);
+            if (instruction->structure.flags & MASK_V) {
+                ops[1] = (Operand){ OPERAND_REG, 1, 1, 0, 0 };
+            } else {
+                ops[1] = (Operand){ OPERAND_IMM, 0, 1, 0, 1 };
+            }
+            break;
+        case RM_SR:
+            ops[0] = operand_rm(instruction);
+            ops[1] = (Operand){ OPERAND_SREG, SR_OP(instruction->structure.flags), 2, 0, 0 };
+            break;
+        case RM_REG:
+            ops[0] = operand_rm(instruction);
+            ops[1] = (Operand){ OPERAND_REG, FIELD_REG(instruction->fields), w, 0, 0 };
+            break;
+        case RM_IMM:
+            ops[0] = operand_rm(instruction);
+            ops[1] = (Operand){ OPERAND_IMM, 0, w, 0, *((int16 *)&instruction->data) };
+            break;
+        case ACC_DX:
+            ops[0] = (Operand){ OPERAND_REG, 0, w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_REG, 2, 2, 0, 0 };
+            break;
+        case ACC_IMM8:
+            ops[0] = (Operand){ OPERAND_REG, 0, w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_IMM, 0, 1, 0, instruction->data & 0xFF };
+            break;
+        case ACC_IMM:
+            ops[0] = (Operand){ OPERAND_REG, 0, w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_IMM, 0, w, 0, *((int16 *)&instruction->data) };
+            break;
+        case ACC_REG:
+            ops[0] = (Operand){ OPERAND_REG, 0, w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_REG, FIELD_REG(instruction->fields), w, 0, 0 };
+            break;
+        case ACC_MEM:
+            ops[0] = (Operand){ OPERAND_REG, 0, w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_MEM, EA_DIRECT, w, 0, instruction->data };
+            break;
+        case REG:
+            ops[0] = (Operand){ OPERAND_REG, FIELD_REG(instruction->fields), w, 0, 0 };
+            count = 1;
+            break;
+        case REG_IMM:
+            ops[0] = (Operand){ OPERAND_REG, FIELD_REG(instruction->fields), w, 0, 0 };
+            ops[1] = (Operand){ OPERAND_IMM, 0, w, 0, *((int16 *)&instruction->data) };
+            break;
+        case SR:
+            ops[0] = (Operand){ OPERAND_SREG, SR_OP(instruction->structure.flags), 2, 0, 0 };
+            count = 1;
+            break;
+        case IMM:
+            ops[0] = (Operand){ OPERAND_IMM, 0, w, 0, *((int16 *)&instruction->data) };
+            count = 1;
+            break;
+        case JMP_SHORT:
+        case JMP_NEAR:
+            ops[0] = (Operand){ OPERAND_REL, 0, 2, 0, get_jmp_offset(instruction) };
+            count = 1;
+            break;
+        case JMP_FAR:
+            ops[0] = (Operand){ OPERAND_FAR, 0, 2, instruction->data_ext, instruction->data };
+            count = 1;
+            break;
+        case NONE:
+            count = 0;
+            break;
+    }
+
+    // same operand order decode_instruction prints
+    if (count == 2 && (instruction->structure.flags & MASK_D)) {
+        tmp    = ops[0];
+        ops[0] = ops[1];
+        ops[1] = tmp;
+    }
+
+    return count;
+}
+
+// prefix bytes in front of the instruction at bytes: up to DECODE_MAX_PREFIXES
+// of them, in any order, fold in when an opcode follows; otherwise the first
+// one decodes on its own. -1 if the run reaches avail and it can't tell yet.
+static int prefix_run(const uint8 *bytes, uint avail) {
+    uint n;
+
+    for (n = 0; n < avail && (length_table[bytes[n]] & LEN_PREFIX); ++n) {
+        if (n == DECODE_MAX_PREFIXES) return 0;
+    }
+
+    if (n == avail) return n ? -1 : 0;
+    return n;
+}
+
+// prefix_order codes, by prefix byte
+static const uint8 prefix_bytes[7] = { 0xF0, 0xF2, 0xF3, 0x26, 0x2E, 0x36, 0x3E };
+
+static uint8 prefix_code(uint8 byte) {
+    switch (byte) {
+    case 0xF0: return 0;
+    case 0xF2: return 1;
+    case 0xF3: return 2;
+    default:   return 3 + SR(byte);
+    }
+}
+
+// prefix bits for one prefix byte; a later rep/repne or segment replaces an earlier one
+static void fold_prefix(uint8 byte, uint8 *prefixes) {
+    const InstructionData *data = instruction_table + byte;
+
+    switch (data->type) {
+    case LOCK:
+        *prefixes |= PFX_LOCK;
+        break;
+    case SGMNT:
+        *prefixes &= ~(PFX_SGMNT | PFX_SGMNT_DS);
+        *prefixes |= PFX_SGMNT | (data->flags & PFX_SGMNT_DS);
+        break;
+    case REP:
+        *prefixes &= ~PFX_REPNE;
+        *prefixes |= PFX_REP;
+        break;
+    case REPNE:
+        *prefixes &= ~PFX_REP;
+        *prefixes |= PFX_REPNE;
+        break;
+    default: break;
+    }
+}
+
+int instruction_length(const uint8 *bytes, uint avail) {
+    uint8 len, modrm, mod;
+    int   prefix;
+
+    if (avail == 0) return 0;
+
+    prefix = prefix_run(bytes, avail);
+    if (prefix < 0) return 0;
+
+    bytes += prefix;
+    avail -= prefix;
+
+    len = length_table[bytes[0]];
+    if (len & (LEN_GROUP | LEN_MODRM)) {
+        if (avail < 2) return 0;
+        modrm = bytes[1];
+
+        if (len & LEN_GROUP) len = length_table_extd[extd_group[bytes[0]]][EXTD(modrm)];
+
+        // mod 01: disp8, mod 10: disp16, mod 00 with r/m 110: direct address
+        mod  = MOD(modrm);
+        len += (len & LEN_MODRM) ? (mod == MODE_MEM8) + 2 * (mod == MODE_MEM16 || (modrm & 0xC7) == 0x06) : 0;
+    }
+
+    if (len & LEN_INVALID) return -1;
+
+    len &= LEN_SIZE;
+    return len <= avail ? len + prefix : 0;
+}
+
 int parse_instruction(Instruction *instruction,  uint8 * const data, uint size, uint offset) {
     InstructionData instruction_data;
     uint8 *raw = data + offset;
     uint8 lo = 0, hi = 0, extd_op = 0;
     uint8 i = 0;
     uint8 mod, rm;
+    uint8 prefixes = 0;
     uint data_size = 1, disp_size = 0;
+    uint start;
+    int  prefix;
+    uint16 order;
 
     memset(instruction, 0, sizeof(*instruction));
 
+    // truncated records are the caller's to report, a tolerant scan expects them
+    if (offset >= size) return -1;
+
+    // a prefix run with nothing after it in the image decodes one prefix at a time
+    prefix = prefix_run(raw, size - offset);
+    if (prefix < 0) prefix = 0;
+
+    // later bytes win in fold_prefix; the order is kept only to re-encode them
+    order = prefix;
+    for (i = 0; i < prefix; ++i) {
+        fold_prefix(raw[i], &prefixes);
+        order |= prefix_code(raw[i]) << (2 + 3 * i);
+    }
+
+    start   = offset;
+    offset += prefix;
+    raw    += prefix;
+    i       = 0;
+
     instruction_data = instruction_table[raw[0]];
 
-    //fprintf(stdout, "%d :: ", raw[0]);
     if (instruction_data.type == EXTD) {
-        switch (raw[0]) {
-            case 0x80: i = 0x00; break;
-            case 0x81: i = 0x01; break;
-            case 0x82: i = 0x02; break;
-            case 0x83: i = 0x03; break;
-            case 0x8C: i = 0x04; break;
-            case 0x8E: i = 0x05; break;
-            case 0x8F: i = 0x06; break;
-            case 0xC6: i = 0x07; break;
-            case 0xC7: i = 0x08; break;
-            case 0xD0: i = 0x09; break;
-            case 0xD1: i = 0x0A; break;
-            case 0xD2: i = 0x0B; break;
-            case 0xD3: i = 0x0C; break;
-            case 0xF6: i = 0x0D; break;
-            case 0xF7: i = 0x0E; break;
-            case 0xFE: i = 0x0F; break;
-            case 0xFF: i = 0x10; break;
-        }
+        // the group is picked by the modrm byte
+        if (offset + 2 > size) return -1;
 
+        i = extd_group[raw[0]];
         extd_op = EXTD(raw[1]);
         instruction_data = instruction_table_extd[i][extd_op];
     }
 
-    if (offset + instruction_data.size > size) {
-        fprintf(stderr, "Out of bounds parsing instruction");
-        return -1;
-    }
+    if (offset + instruction_data.size > size) return -1;
 
     switch (instruction_data.format) {
         case RM:
@@ -804,13 +405,22 @@ int parse_instruction(Instruction *instruction,  uint8 * const data, uint size,
                 disp_size = 1;
 
             instruction_data.size += disp_size;
-            instruction->displacement = (raw[3] << 8) * (disp_size > 1) | raw[2];
             instruction->fields |= (mod & 0b11)   << 0;
             instruction->fields |= (rm  & 0b111)  << 4;
+
+            // the coprocessor opcode: low opcode bits, then modrm reg
+            if (instruction_data.format == RM_ESC)
+                instruction->fields |= (ESC1(raw[0]) << 3 | ESC2(raw[1])) << 10;
             break;
         default: break;
     };
 
+    // nothing past here may read beyond the full instruction
+    if (offset + instruction_data.size > size) return -2;
+
+    if (disp_size > 0) instruction->displacement  = raw[2];
+    if (disp_size > 1) instruction->displacement |= raw[3] << 8;
+
     // save sr field
     switch (instruction_data.format) {
         case SR:
@@ -869,110 +479,169 @@ int parse_instruction(Instruction *instruction,  uint8 * const data, uint size,
 	    instruction->data     = (raw[2] << 8) | raw[1];
 	    instruction->data_ext = (raw[4] << 8) | raw[3];
 	    break;
+        // aam/aad carry their base as a second byte
+        case NONE:
+            if (instruction_data.size == 2) instruction->data = raw[1];
+            break;
         default: break;
     }
 
-    if (offset + instruction_data.size > size) {
-        fprintf(stderr, "out of image boundaries (offset: %u, "
-                "inst_size: %u, image_size: %u)\n", offset, instruction_data.size,
-                size);
-        return -2;
-    }
+    instruction_data.size     += prefix;
+    instruction_data.prefixes |= prefixes;
 
-    instruction->offset = offset;
-    instruction->structure = instruction_data;
+    instruction->offset       = start;
+    instruction->prefix_order = order;
+    instruction->structure    = instruction_data;
     return 0;
 };
 
-int scan_instructions(Instruction *const instructions, uint count, uint8 *const data, uint size) {
+// the bytes go where the operands would be: data, then data_ext
+int parse_invalid(Instruction *instruction, uint8 * const data, uint size, uint offset) {
+    uint8 *raw = data + offset;
+    int    len;
+    uint   i;
+
+    memset(instruction, 0, sizeof(*instruction));
+
+    if (offset >= size) return -1;
+
+    // decoding picks up again right after the opcode byte the prefixes led to
+    len = prefix_run(raw, size - offset);
+    if (len < 0) len = 0;
+    len += 1;
+    if ((uint)len > size - offset) len = size - offset;
+
+    for (i = 0; i < (uint)len; ++i) {
+        if (i < 2) instruction->data     |= raw[i] << (8 * i);
+        else       instruction->data_ext |= raw[i] << (8 * (i - 2));
+    }
+
+    instruction->structure.type   = UNKNOWN;
+    instruction->structure.format = NONE;
+    instruction->structure.size   = len;
+    instruction->offset           = offset;
+    return 0;
+}
+
+uint get_prefix_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_PREFIXES]) {
+    uint i, len = PREFIX_SIZE(instruction->prefix_order);
+
+    for (i = 0; i < len; ++i) out[i] = prefix_bytes[PREFIX_CODE(instruction->prefix_order, i)];
+    return len;
+}
+
+uint get_invalid_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_INVALID]) {
     uint i;
-    int rc = 0;
-    uint offset = 0;
-    uint8 prefixes = 0;
-    struct bitmap labels;
-    int label_addr = 0;
-    Instruction instruction;
-
-    // we want to scan and return a count
-    // so we can allocate memory for all the instructions
-    if (!instructions) {
-        for (count = 0; offset < size; ++count) {
-            if (parse_instruction(&instruction, data, size, offset) < 0) {
-                return -1;
-            }
-            
-            if (instruction.structure.type == UNKNOWN) {
-	        fprintf(stderr, "unknown instruction 0x%02X at interation %d\n", data[offset], count);
-		return -2;
-	    }
 
-            offset += instruction.structure.size;
-        }
-        return count;
+    assert(instruction->structure.size <= DECODE_MAX_INVALID);
+
+    for (i = 0; i < instruction->structure.size; ++i) {
+        if (i < 2) out[i] = instruction->data     >> (8 * i);
+        else       out[i] = instruction->data_ext >> (8 * (i - 2));
     }
 
-    if (bitmap_init(&labels, size) < 0) {
-        fprintf(stderr, "failed to initialize bitmap for labels\n");
-        rc = -3;
-        goto free_and_exit;
+    return i;
 }
 
+uint get_esc_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_SIZE]) {
+    uint8 mod = FIELD_MOD(instruction->fields);
+    uint8 rm  = FIELD_RM(instruction->fields);
+    uint  len;
+
+    assert(instruction->structure.format == RM_ESC);
+
+    len = get_prefix_bytes(instruction, out);
+
+    out[len++] = 0xD8 | FIELD_ESC(instruction->fields) >> 3;
+    out[len++] = mod << 6 | (FIELD_ESC(instruction->fields) & 0b111) << 3 | rm;
+
+    if (mod == MODE_MEM8) {
+        out[len++] = instruction->displacement & 0xFF;
+    } else if (mod == MODE_MEM16 || (mod == MODE_MEM0 && rm == 0b110)) {
+        out[len++] = instruction->displacement & 0xFF;
+        out[len++] = instruction->displacement >> 8;
+    }
+
+    return len;
+}
+
+
+int scan_segments(Instruction *const instructions, uint count, uint8 *const data, uint size,
+                  struct bitmap *labels, const uint16 *segments, uint segment_count,
+                  uint flags, struct xref *xref) {
+    uint i, next = 0;
+    int rc;
+    uint offset = 0, end = size;
+    uint16 segment = 0;
+    int label_addr = 0;
+
+    PROFILE_BEGIN(decode);
+
     for (i = 0; i < count && offset < size; ++i) {
-        if (parse_instruction(instructions + i, data, size, offset) < 0) {
-            fprintf(stderr, "failed to get instruction data\n");
-            rc = -1;
-            goto free_and_exit;
+        // a record belongs to the last segment starting at or before it
+        if (segment_count) {
+            while (next < segment_count && (uint32)segments[next] * 16 <= offset) {
+                segment = segments[next++];
+            }
+
+            while (offset - segment * 16 > 0xFFFF) {
+                segment += 0x1000;
+            }
+
+            // labels are named per segment, only mark targets that stay in this one
+            end = segment * 16 + 0x10000;
+            if (next < segment_count && (uint32)segments[next] * 16 < end) end = segments[next] * 16;
+        }
+
+        rc = parse_instruction(instructions + i, data, size, offset);
+        if (rc < 0 && !(flags & SCAN_TOLERANT)) {
+            fprintf(stderr, "out of image boundaries (offset: %u, image_size: %u)\n", offset, size);
+            return -1;
+        }
+
+        // a db record in place of the bad opcode, then carry on right after it
+        if ((rc < 0 || instructions[i].structure.type == UNKNOWN) && (flags & SCAN_TOLERANT)) {
+            parse_invalid(instructions + i, data, size, offset);
+            instructions[i].segment = segment;
+            offset += instructions[i].structure.size;
+            continue;
         }
 
         if (instructions[i].structure.type == UNKNOWN) {
             fprintf(stderr, "unknown instruction encountered: "
                     "0x%02X\n", data[offset]);
-            rc = -2;
-            goto free_and_exit;
+            return -2;
         }
 
-        switch (instructions[i].structure.type) {
-        case LOCK:
-            prefixes |= PFX_LOCK;
-            break;
-        case SGMNT:
-            prefixes |= instructions[i].structure.flags;
-            prefixes |= PFX_SGMNT;
-            break;
-        case REP:
-            prefixes |= PFX_REP;
-            break;
-        case REPNE:
-            prefixes |= PFX_REPNE;
-            break;
-        // if it isn't a prefix instruction, assign accumulated prefixes
-        default:
-            instructions[i].structure.prefixes |= prefixes;
-            prefixes = 0;
-        }
+        instructions[i].segment = segment;
 
         label_addr = get_jmp_offset(instructions + i);
-        if (label_addr >= 0) {
-            bitmap_set_bit(&labels, label_addr);
+        if (label_addr >= (int)(segment * 16) && (uint)label_addr < end) {
+            bitmap_set_bit(labels, label_addr);
         }
 
+        if (xref) xref_add(xref, instructions + i, i, label_addr);
+
         offset += instructions[i].structure.size;
     }
 
+    count = i;
+    if (xref) xref_build(xref, instructions);
+    PROFILE_END(PHASE_DECODE, decode, offset);
+    PROFILE_BEGIN(label);
+
     // setting F_LB flag for label generation
     for (i = 0, offset = 0; i < count && offset < size; ++i) {
-        if (bitmap_get_bit(&labels, offset) > 0) {
+        if (bitmap_get_bit(labels, offset) > 0) {
                 instructions[i].structure.flags |= MASK_LB;
         }
 
         offset += instructions[i].structure.size;
     }
 
-free_and_exit:
-    bitmap_free(&labels);
-
-    return rc;
-}; 
+    PROFILE_END(PHASE_LABELS, label, offset);
+    return count;
+}
 
 typedef void (*decode_fn)(FILE *, Instruction *);
 
@@ -989,69 +658,152 @@ static void decode_addr (FILE *out, Instruction *instruction);
 static void decode_naddr(FILE *out, Instruction *instruction);
 static void decode_faddr(FILE *out, Instruction *instruction);
 
+// "[" + ea_base, so decode_rm only has to append the displacement
+static const struct {
+    const char *text;
+    uint8       len;
+} ea_open[8] = {
+    { "[bx + si", 8 },
+    { "[bx + di", 8 },
+    { "[bp + si", 8 },
+    { "[bp + di", 8 },
+    { "[si",      3 },
+    { "[di",      3 },
+    { "[bp",      3 },
+    { "[bx",      3 },
+};
+
+// write the digits of value backwards, ending at end; returns the first digit
+static char *format_uint(char *end, uint value) {
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    return end;
+}
+
+// signed decimal into buf, returns the length
+static uint format_int(char *buf, int value) {
+    char  tmp[12];
+    char *end = tmp + sizeof(tmp);
+    char *start;
+    uint  len;
+
+    start = format_uint(end, value < 0 ? -(uint)value : (uint)value);
+    if (value < 0) *--start = '-';
+
+    len = end - start;
+    memcpy(buf, start, len);
+    return len;
+}
+
+static void put_int(FILE *out, int value) {
+    char buf[12];
+    fwrite(buf, 1, format_int(buf, value), out);
+}
+
+// label_<offset> for flat images, label_<segment>_<ip> inside a segment
+static void put_label(FILE *out, uint16 segment, uint offset) {
+    if (segment) {
+        fprintf(out, "label_%04X_%u", segment, offset - segment * 16);
+        return;
+    }
+
+    fwrite("label_", 1, 6, out);
+    put_int(out, offset);
+}
+
+// render a memory operand ("word es:[bp + si - 12]") into buf, returns the length
+static uint format_ea(char *buf, uint8 mod, uint8 r_m, int16 disp, uint8 w, uint8 prefixes) {
+    uint len = 0;
+
+    if (prefixes & PFX_WIDE) {
+        memcpy(buf, w ? "word " : "byte ", 5);
+        len += 5;
+    }
+
+    if (prefixes & PFX_SGMNT) {
+        memcpy(buf + len, segregs[SGMNT_OP(prefixes)], 2);
+        buf[len + 2] = ':';
+        len += 3;
+    }
+
+    if (mod == MODE_MEM0 && r_m == 0b110) {
+        buf[len++] = '[';
+        len += format_int(buf + len, (uint16)disp);
+        buf[len++] = ']';
+        return len;
+    }
+
+    // [ ea_base ]
+    if (mod == MODE_MEM0) disp = 0;
+    // [ ea_base + d8 ], only the sign-extended low byte
+    if (mod == MODE_MEM8) disp = (int8)(disp & 0xFF);
+
+    memcpy(buf + len, ea_open[r_m].text, ea_open[r_m].len);
+    len += ea_open[r_m].len;
+
+    if (disp != 0) {
+        buf[len++] = ' ';
+        buf[len++] = disp < 0 ? '-' : '+';
+        buf[len++] = ' ';
+        len += format_int(buf + len, disp < 0 ? -disp : disp);
+    }
+
+    buf[len++] = ']';
+    return len;
+}
+
+// rendered memory operands per thread, direct-mapped on the operand fields; 0 disables it
+#if !defined EA_CACHE_SIZE
+#define EA_CACHE_SIZE 256
+#endif
+
+#if EA_CACHE_SIZE > 0
+static _Thread_local struct {
+    uint32 key;     // 0 = empty, every real key has bit 31 set
+    uint8  len;
+    char   text[27];
+} ea_cache[EA_CACHE_SIZE];
+#endif
+
 void decode_rm(FILE *out, Instruction *instruction) {
-    int   len;
-    char  ea_str[64];
-    char *op;
-
-    uint8  w, mod, r_m;
-
-    int16 disp = *((int16 *)&instruction->displacement);
-
-    static char *ea_base[8] = {
-        "bx + si", 
-        "bx + di", 
-        "bp + si", 
-        "bp + di", 
-        "si", 
-        "di", 
-        "bp", 
-        "bx"
-    };
+    uint8  w, mod, r_m, prefixes;
+    int16  disp = *((int16 *)&instruction->displacement);
+#if EA_CACHE_SIZE > 0
+    uint32 key, slot;
+#else
+    char   buf[32];
+    uint   len;
+#endif
 
     w   = W(instruction->structure.flags);
     mod = FIELD_MOD(instruction->fields);
     r_m = FIELD_RM(instruction->fields);
 
-    op = regs[w][r_m];
-
-    if (mod != MODE_REG) {
-        if (mod == MODE_MEM0 && r_m == 0b110) {
-            len = snprintf(ea_str, sizeof(ea_str), "[%u]", disp & 0xFFFF);
-        } else {
-            // [ ea_base + d8 ]
-            if (mod == MODE_MEM8) {
-                // only low byte
-                disp &= 0x00FF;
-                // if sign bit is set then sign-extend
-                if (disp & 0x80) disp |= 0xFF00;
-
-            // [ ea_base ]
-            } else if (mod == MODE_MEM0) {
-                // no displacement
-                disp = 0;
-            }
-
-            len = snprintf(ea_str, sizeof(ea_str), "[%s", ea_base[r_m]);
-            if (disp != 0) {
-                len += snprintf(ea_str + len, sizeof(ea_str) - len, " %c %d", (disp < 0) ? '-' : '+', abs(disp));
-            }
-
-            len += snprintf(ea_str + len, sizeof(ea_str) - len, "]");
-        }
+    if (mod == MODE_REG) {
+        fwrite(regs[w][r_m], 1, 2, out);
+        return;
+    }
 
-        op = ea_str;
+    // only the bits format_ea looks at
+    prefixes = instruction->structure.prefixes & (PFX_WIDE | PFX_SGMNT | (0b11 << 4));
 
-        if (instruction->structure.prefixes & PFX_WIDE) {
-            fprintf(out, "%s ", w ? "word" : "byte");
-        }
+#if EA_CACHE_SIZE > 0
+    key  = 1u << 31 | (uint32)prefixes << 22 | w << 21 | mod << 19 | r_m << 16 | (uint16)disp;
+    slot = ((key * 0x9E3779B1u) >> 16) % EA_CACHE_SIZE;
 
-        if (instruction->structure.prefixes & PFX_SGMNT) {
-            fprintf(out, "%s:", segregs[SGMNT_OP(instruction->structure.prefixes)]);
-        }
+    if (ea_cache[slot].key != key) {
+        ea_cache[slot].key = key;
+        ea_cache[slot].len = format_ea(ea_cache[slot].text, mod, r_m, disp, w, prefixes);
     }
 
-    fprintf(out, "%s", op);
+    fwrite(ea_cache[slot].text, 1, ea_cache[slot].len, out);
+#else
+    len = format_ea(buf, mod, r_m, disp, w, prefixes);
+    fwrite(buf, 1, len, out);
+#endif
 }
 
 void decode_reg(FILE *out, Instruction *instruction) {
@@ -1060,61 +812,92 @@ void decode_reg(FILE *out, Instruction *instruction) {
     w   = W(instruction->structure.flags);
     reg = FIELD_REG(instruction->fields);
 
-    fprintf(out, "%s", regs[w][reg]);
+    fwrite(regs[w][reg], 1, 2, out);
 }
 
 void decode_sr(FILE *out, Instruction *instruction)
 {
-    fprintf(out, "%s", segregs[SR_OP(instruction->structure.flags)]);
+    fwrite(segregs[SR_OP(instruction->structure.flags)], 1, 2, out);
 }
 
 void decode_v(FILE *out, Instruction *instruction)
 {
-    fprintf(out, "%s", (instruction->structure.flags & MASK_V) ? "cl" : "1");
+    if (instruction->structure.flags & MASK_V) fwrite("cl", 1, 2, out);
+    else                                       fputc('1', out);
 }
 
 void decode_imm(FILE *out, Instruction *instruction)
 {
     int16 imm = *((int16 *)&instruction->data);
-    fprintf(out, "%d", imm);
+    put_int(out, imm);
 }
 
 void decode_acc(FILE *out, Instruction *instruction)
 {
-    fprintf(out, "%s", regs[W(instruction->structure.flags)][0]);
+    fwrite(regs[W(instruction->structure.flags)][0], 1, 2, out);
 }
 
 void decode_dx(FILE *out, Instruction *instruction) {
     (void)instruction;
-    fprintf(out, "dx");
+    fwrite("dx", 1, 2, out);
 }
 
 void decode_imm8(FILE *out, Instruction *instruction) {
-    fprintf(out, "%u", instruction->data & 0xFF);
+    put_int(out, instruction->data & 0xFF);
 }
 
 void decode_mem(FILE *out, Instruction *instruction) {
-    fprintf(out, "[%u]", instruction->data & 0xFFFF);
+    if (instruction->structure.prefixes & PFX_SGMNT) {
+        fwrite(segregs[SGMNT_OP(instruction->structure.prefixes)], 1, 2, out);
+        fputc(':', out);
+    }
+
+    fputc('[', out);
+    put_int(out, instruction->data & 0xFFFF);
+    fputc(']', out);
 }
 
 void decode_addr(FILE *out, Instruction *instruction) {
     int addr = get_jmp_offset(instruction);
-    assert(addr != -1);
+    assert(instruction->structure.format == JMP_SHORT);
 
-    fprintf(out, "label_%d", addr);
+    // targets before the image have no label to point at
+    if (addr < 0) {
+        fprintf(out, "$%+d", addr - (int)instruction->offset);
+        return;
+    }
+
+    put_label(out, instruction->segment, addr);
 }
 
 void decode_naddr(FILE *out, Instruction *instruction) {
-    int16_t addr = get_jmp_offset(instruction);
-    assert(addr != -1);
+    int addr = get_jmp_offset(instruction);
+    assert(instruction->structure.format == JMP_NEAR);
 
-    fprintf(out, "%d", addr);
+    // ip within the segment
+    put_int(out, addr - instruction->segment * 16);
 }
 
 void decode_faddr(FILE *out, Instruction *instruction) {
     fprintf(out, "%u:%u", instruction->data_ext, instruction->data);
 }
 
+// formats that print a memory operand, and the segment override with it
+static int has_memory_operand(const Instruction *instruction) {
+    switch (instruction->structure.format) {
+        case RM:
+        case RM_V:
+        case RM_SR:
+        case RM_REG:
+        case RM_IMM:
+            return FIELD_MOD(instruction->fields) != MODE_REG;
+        case ACC_MEM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
 int decode_instruction(FILE *out, Instruction *instruction) {
     decode_fn op1 = NULL, op2 = NULL, tmp;
 
@@ -1124,10 +907,39 @@ int decode_instruction(FILE *out, Instruction *instruction) {
     }
 
     if (instruction->structure.flags & MASK_LB) {
-        fprintf(out, "label_%u:\n", instruction->offset);
+        put_label(out, instruction->segment, instruction->offset);
+        fwrite(":\n", 1, 2, out);
+    }
+
+    // nasm has no esc mnemonic, so esc is listed as its bytes, prefixes included
+    if (instruction->structure.type == UNKNOWN || instruction->structure.format == RM_ESC) {
+        uint8 bytes[DECODE_MAX_SIZE];
+        uint  i, len = instruction->structure.type == UNKNOWN ?
+                       get_invalid_bytes(instruction, bytes) : get_esc_bytes(instruction, bytes);
+
+        for (i = 0; i < len; ++i) fprintf(out, i ? ", 0x%02X" : "db 0x%02X", bytes[i]);
+        return 0;
+    }
+
+    if (instruction->structure.prefixes & PFX_LOCK)  fwrite("lock ", 1, 5, out);
+    if (instruction->structure.prefixes & PFX_REP)   fwrite("rep ", 1, 4, out);
+    if (instruction->structure.prefixes & PFX_REPNE) fwrite("repne ", 1, 6, out);
+
+    // an override with no memory operand to print it ("es movsb") goes in
+    // front of the mnemonic, where the encoder puts its byte
+    if ((instruction->structure.prefixes & PFX_SGMNT) && !has_memory_operand(instruction)) {
+        fwrite(segregs[SGMNT_OP(instruction->structure.prefixes)], 1, 2, out);
+        fputc(' ', out);
+    }
+
+    // a segment prefix that couldn't fold stands on its own line ("es")
+    if (instruction->structure.type == SGMNT) {
+        fwrite(segregs[SR_OP(instruction->structure.flags)], 1, 2, out);
+        return 0;
     }
 
-    fprintf(out, "%s", get_instruction_name(instruction->structure.type));
+    fwrite(instruction_name_pool + instruction_names[instruction->structure.type].offset, 1,
+           instruction_names[instruction->structure.type].length, out);
 
     if (instruction->structure.prefixes & PFX_FAR) fprintf(out, " far");
 
@@ -1151,9 +963,6 @@ int decode_instruction(FILE *out, Instruction *instruction) {
             op1 = decode_rm;
             op2 = decode_imm;
             break;
-	case RM_ESC:
-            assert(0 && "not implemented");
-            break;
 	case ACC_DX:
             op1 = decode_acc;
             op2 = decode_dx;
@@ -1196,6 +1005,7 @@ int decode_instruction(FILE *out, Instruction *instruction) {
 	case JMP_FAR:
             op1 = decode_faddr;
             break;
+	case RM_ESC:
 	case NONE: break;
     }
 
@@ -1211,62 +1021,47 @@ int decode_instruction(FILE *out, Instruction *instruction) {
     }
 
     if (op2) {
-        fprintf(out, ", ");
+        fwrite(", ", 1, 2, out);
         op2(out, instruction);
     }
 
     return 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Missing file to decode. Usage: decode <filename>\n");
-        return 0;
-    }
-
-    uint size = 0;
-    FILE *f = fopen(argv[1], "rb");
-    assert(f != NULL);
-    assert(fseek(f, 0, SEEK_END) == 0);
-    size = ftell(f);
-    rewind(f);
-
-    uint8 *raw_data = malloc(size);
-    if (raw_data == NULL) exit(137);
-    assert(fread(raw_data, size, 1, f) == 1);
-
-    fclose(f);
+int emit_instruction(FILE *out, Instruction *instruction) {
+    decode_instruction(out, instruction);
+    fputc('\n', out);
 
-    int instruction_count = 0;
-    Instruction *instructions;
-
-    instruction_count = scan_instructions(NULL, 0, raw_data, size);
-    if (instruction_count < 0) return 0;
-
-    instructions = malloc(instruction_count * sizeof(Instruction));
-    if (instructions == NULL) exit(137);
+    return 0;
+}
 
-    scan_instructions(instructions, instruction_count, raw_data, size);
+int render_instructions(FILE *out, Instruction *instructions, uint count,
+                        const struct xref *xref) {
+    Instruction unlabeled;
+    uint   i;
+    uint16 segment = 0;
+
+    fprintf(out, "bits 16\n\n");
+    for (i = 0; i < count; ++i) {
+        if (instructions[i].segment != segment) {
+            segment = instructions[i].segment;
+            fprintf(out, "\n; segment 0x%04X\n", segment);
+        }
 
-    int i;
-    uint offset;
+        if (xref && (instructions[i].structure.flags & MASK_LB)) {
+            put_label(out, instructions[i].segment, instructions[i].offset);
+            fputc(':', out);
+            xref_comment(out, xref, instructions, instructions[i].offset);
+            fputc('\n', out);
 
-    fprintf(stdout, "bits 16\n\n");
-    for (i=0, offset=0; i < instruction_count && offset < size; ++i, offset += instructions[i].structure.size) {
-        decode_instruction(stdout, instructions + i);
-        switch (instructions[i].structure.type) {
-            case SGMNT: continue;
-            case LOCK:
-            case REP:
-            case REPNE:
-                fputc(' ', stdout);
-                continue;
-            default: break;
+            unlabeled = instructions[i];
+            unlabeled.structure.flags &= ~MASK_LB;
+            emit_instruction(out, &unlabeled);
+            continue;
         }
-        fputc('\n', stdout);
+
+        emit_instruction(out, instructions + i);
     }
 
-    free(raw_data);
-    free(instructions);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,236 @@
+#if !defined DECODE_H
+#define DECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bitmap.h"
+
+struct xref;
+
+typedef unsigned int uint;
+typedef uint8_t      uint8;
+typedef uint16_t     uint16;
+typedef uint32_t     uint32;
+typedef int8_t       int8;
+typedef int16_t      int16;
+
+#define MASK_W     (0b1  << 0)
+#define MASK_D     (0b1  << 1)
+#define MASK_S     (0b1  << 2)
+#define MASK_V     (0b1  << 3)
+#define MASK_ES    (0b00 << 4)
+#define MASK_CS    (0b01 << 4)
+#define MASK_SS    (0b10 << 4)
+#define MASK_DS    (0b11 << 4)
+#define MASK_MO    (0b1  << 6)
+#define MASK_LB    (0b1  << 7)
+#define MASK_MOD   0b11
+#define MASK_RM    0b111
+#define MASK_REG   0b111
+
+#define MODE_MEM0  0b00
+#define MODE_MEM8  0b01
+#define MODE_MEM16 0b10
+#define MODE_REG   0b11
+
+#define PFX_WIDE     (0b1  << 0)
+#define PFX_FAR      (0b1  << 1)
+#define PFX_LOCK     (0b1  << 2)
+#define PFX_SGMNT    (0b1  << 3)
+#define PFX_SGMNT_ES (0b00 << 4)
+#define PFX_SGMNT_CS (0b01 << 4)
+#define PFX_SGMNT_SS (0b10 << 4)
+#define PFX_SGMNT_DS (0b11 << 4)
+#define PFX_REP      (0b1  << 6)
+#define PFX_REPNE    (0b1  << 7)
+
+#define SR_OP(flags) (((flags) >> 4) & 0b11)
+#define W(flags)     (!!(flags & MASK_W))
+
+#define SR(byte)   (((byte) >> 3) & 0b11)
+#define MOD(byte)  (((byte) >> 6) & 0b11)
+#define RM(byte)   (((byte) >> 0) & 0b111)
+#define REG(byte)  (((byte) >> 3) & 0b111)
+#define REG2(byte) (((byte) >> 0) & 0b111)
+#define ESC1(byte) (((byte) >> 0) & 0b111)
+#define ESC2(byte) (((byte) >> 3) & 0b111)
+#define EXTD(byte) (((byte) >> 3) & 0b111)
+
+#define SGMNT_OP(prefixes) (((prefixes) >>  4)  & 0b11)
+#define FIELD_MOD(fields)  (((fields)   >>  0)  & 0b11)
+#define FIELD_SR(fields)   (((fields)   >>  2)  & 0b11)
+#define FIELD_RM(fields)   (((fields)   >>  4)  & 0b111)
+#define FIELD_REG(fields)  (((fields)   >>  7)  & 0b111)
+#define FIELD_ESC(fields)  (((fields)   >> 10)  & 0b111111)
+
+// Instruction.prefix_order: how many prefix bytes came before the opcode,
+// then a 3-bit code per byte in the order they came (see get_prefix_bytes)
+#define PREFIX_SIZE(order)    (((order) >>  0)  & 0b11)
+#define PREFIX_CODE(order, i) (((order) >> (2 + 3 * (i))) & 0b111)
+
+typedef enum {
+    NONE,
+
+    // [mod ... r/m] [disp-lo] [disp-hi]
+    RM,
+    // [mod ... r/m] [disp-lo] [disp-hi] (store 1/cl)
+    RM_V,
+    // [mod 0 sr r/m] [disp-lo] [disp-hi]
+    RM_SR,
+    // [mod reg r/m] [disp-lo] [disp-hi]
+    RM_REG,
+    // [mod ... r/m] [disp-lo] [disp-hi] [data]
+    RM_IMM,
+    // [... xxx] [mod yyy r/m] [disp-lo] [disp-hi]
+    RM_ESC,
+
+    ACC_DX,
+    // [data-8]
+    ACC_IMM8,
+    // [data-lo] [data-hi]
+    ACC_IMM,
+    // [... reg]
+    ACC_REG,
+    // [addr-lo] [addr-hi]
+    ACC_MEM,
+
+    // [... reg]
+    REG,
+    // [...reg] [data-hi] [data-lo]
+    REG_IMM,
+
+    // [... sr ...]
+    SR,
+
+    // [data-lo] [data-hi]
+    IMM,
+
+    // [ip-inc-8]
+    JMP_SHORT,
+    // [ip-inc-lo] [ip-inc-hi]
+    JMP_NEAR,
+    // [ip-lo] [ip-hi] [cs-lo] [cs-hi]
+    JMP_FAR,
+ } FORMAT;
+
+typedef enum {
+#define MNEMONIC(type, name) type,
+#include "instructions.def"
+
+    EXTD,
+} TYPE;
+
+typedef struct {
+    TYPE   type;
+    FORMAT format;
+    uint8  flags;
+    uint8  prefixes;
+    uint8  size;
+    uint8  clocks;     // 8086 book clocks, see instructions.def
+    uint8  clocks_alt; // ... with a memory operand, taken, or per rep iteration
+} InstructionData;
+
+// where a mnemonic sits in instruction_name_pool
+typedef struct {
+    uint16 offset;
+    uint8  length;
+} InstructionName;
+
+typedef struct {
+    InstructionData structure;
+    uint16          data;
+    uint16          data_ext;
+    uint16          displacement;
+    uint16          fields;
+    uint16          segment; // paragraph the record was decoded under, 0 for flat images
+    uint16          prefix_order; // prefix bytes folded in front of the opcode, see PREFIX_SIZE
+    uint            offset;  // from the start of the image
+} Instruction;
+
+typedef enum {
+    OPERAND_NONE,
+    // reg: index into the w=width-1 register file
+    OPERAND_REG,
+    // reg: segment register
+    OPERAND_SREG,
+    // reg: ea_base form or EA_DIRECT, value: displacement / address
+    OPERAND_MEM,
+    OPERAND_IMM,
+    // value: branch target offset
+    OPERAND_REL,
+    // segment:value
+    OPERAND_FAR,
+} OPERAND;
+
+#define EA_DIRECT 8
+
+typedef struct {
+    OPERAND kind;
+    uint8   reg;
+    uint8   width;
+    uint16  segment;
+    int32_t value;
+} Operand;
+
+extern InstructionData instruction_table[256];
+extern InstructionData instruction_table_extd[17][8];
+
+// every mnemonic back to back, each one NUL-terminated
+extern const char *const    instruction_name_pool;
+extern const InstructionName instruction_names[EXTD];
+
+extern const char *get_instruction_name(TYPE type);
+// image offset a jump lands on, wrapping within the record's segment
+extern int get_jmp_offset(Instruction *instruction);
+
+extern const char *get_register_name(uint8 w, uint8 reg);
+extern const char *get_segment_name(uint8 sr);
+extern const char *get_ea_name(uint8 rm);
+
+// structured form of the operands decode_instruction prints, in the same order
+extern int get_operands(Instruction *instruction, Operand ops[2]);
+
+// a run of up to this many lock, rep/repne and segment bytes folds into one
+// record, in any order; a longer run leaves its first prefix on its own
+#define DECODE_MAX_PREFIXES 3
+// longest record: prefixes plus the longest encoding the tables describe
+#define DECODE_MAX_SIZE     (6 + DECODE_MAX_PREFIXES)
+
+// upper bound on the text decode_instruction emits for one record (label line included)
+#define DECODE_MAX_LINE 80
+
+// an undecodable run is the prefixes plus the opcode byte they precede
+#define DECODE_MAX_INVALID  (1 + DECODE_MAX_PREFIXES)
+
+// scan_segments flags: undecodable bytes become db records instead of an error
+#define SCAN_TOLERANT 0x1
+
+// size of the instruction at bytes without decoding it: 0 if avail is too
+// short to hold (or tell) it, -1 for an invalid opcode
+extern int instruction_length(const uint8 *bytes, uint avail);
+extern int parse_instruction(Instruction *instruction, uint8 * const data, uint size, uint offset);
+// db record for bytes at offset that don't decode (see DECODE_MAX_INVALID)
+extern int parse_invalid(Instruction *instruction, uint8 * const data, uint size, uint offset);
+// the prefix bytes of a record in the order they came, returns how many
+extern uint get_prefix_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_PREFIXES]);
+// the raw bytes of a parse_invalid record, returns how many
+extern uint get_invalid_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_INVALID]);
+// the raw bytes of an esc record, which decode_instruction lists as db; returns how many
+extern uint get_esc_bytes(const Instruction *instruction, uint8 out[DECODE_MAX_SIZE]);
+// decode `count` records at most into instructions, marking branch targets in
+// caller-owned label bits (size + 1 bits). segments split the image for label
+// names (sorted paragraphs, see image.h, none for a flat image); ranges longer
+// than 64K continue in the next 64K paragraph. Every branch also goes into
+// xref when it isn't NULL (see xref.h).
+extern int scan_segments(Instruction *const instructions, uint count, uint8 *const data, uint size,
+                         struct bitmap *labels, const uint16 *segments, uint segment_count,
+                         uint flags, struct xref *xref);
+extern int decode_instruction(FILE *out, Instruction *instruction);
+// decode_instruction plus the separator that follows it in a listing
+extern int emit_instruction(FILE *out, Instruction *instruction);
+// print a scanned image as nasm text, with xref comments on label lines if xref isn't NULL
+extern int render_instructions(FILE *out, Instruction *instructions, uint count,
+                               const struct xref *xref);
+
+#endif // DECODE_H
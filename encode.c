@@ -0,0 +1,223 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "encode.h"
+
+// the inverse of instruction_table/instruction_table_extd, keyed by the parts
+// of InstructionData that parse_instruction copies verbatim into a record
+#define ENCODE_SLOTS 1024
+
+// prefix bits that come from the tables rather than from prefix records
+#define TABLE_PREFIXES (PFX_WIDE | PFX_FAR)
+
+struct encoding
+{
+	uint32 key;
+	uint8  opcode;
+	uint8  extd;   // modrm reg field for EXTD opcodes
+	uint8  used;
+};
+
+static struct encoding encodings[ENCODE_SLOTS];
+static pthread_once_t  encodings_once = PTHREAD_ONCE_INIT;
+
+// opcodes 0x80.. that go through instruction_table_extd, in table order
+static const uint8 extd_opcodes[17] = {
+	0x80, 0x81, 0x82, 0x83, 0x8C, 0x8E, 0x8F, 0xC6, 0xC7,
+	0xD0, 0xD1, 0xD2, 0xD3, 0xF6, 0xF7, 0xFE, 0xFF,
+};
+
+static uint32 encoding_key(TYPE type, FORMAT format, uint8 flags, uint8 prefixes)
+{
+	return (uint32)type << 16 | (uint32)format << 10 |
+	       (uint32)(flags & ~MASK_LB) << 2 | (prefixes & TABLE_PREFIXES);
+}
+
+static uint encoding_slot(uint32 key)
+{
+	return (key * 2654435761u) >> 22;
+}
+
+static int has_reg_in_opcode(FORMAT format)
+{
+	return format == REG || format == ACC_REG || format == REG_IMM;
+}
+
+static void add_encoding(InstructionData *data, uint8 opcode, uint8 extd)
+{
+	uint32 key;
+	uint   slot;
+
+	// esc keeps part of its operand in the opcode, get_esc_bytes puts it back
+	if (data->type == UNKNOWN || data->type == EXTD || data->type == ESC) return;
+
+	key = encoding_key(data->type, data->format, data->flags, data->prefixes);
+	for (slot = encoding_slot(key); encodings[slot].used; slot = (slot + 1) % ENCODE_SLOTS) {
+		// first (lowest) opcode wins, so [... reg] forms keep reg = 0
+		if (encodings[slot].key == key) return;
+	}
+
+	encodings[slot].key    = key;
+	encodings[slot].opcode = has_reg_in_opcode(data->format) ? opcode & ~0b111 : opcode;
+	encodings[slot].extd   = extd;
+	encodings[slot].used   = 1;
+}
+
+static void build_encodings(void)
+{
+	uint i, j;
+
+	for (i = 0; i < 256; ++i) add_encoding(instruction_table + i, i, 0);
+
+	for (i = 0; i < 17; ++i) {
+		for (j = 0; j < 8; ++j) add_encoding(&instruction_table_extd[i][j], extd_opcodes[i], j);
+	}
+}
+
+static const struct encoding *find_encoding(const InstructionData *data)
+{
+	uint32 key = encoding_key(data->type, data->format, data->flags, data->prefixes);
+	uint   slot;
+
+	for (slot = encoding_slot(key); encodings[slot].used; slot = (slot + 1) % ENCODE_SLOTS) {
+		if (encodings[slot].key == key) return encodings + slot;
+	}
+
+	return NULL;
+}
+
+int encode_instruction(const Instruction *instruction, uint8 out[ENCODE_MAX])
+{
+	const InstructionData *structure = &instruction->structure;
+	const struct encoding *encoding;
+	uint8 mod, rm, reg, op, len;
+
+	pthread_once(&encodings_once, build_encodings);
+
+	// db records from a tolerant scan carry their own bytes
+	if (structure->type == UNKNOWN && structure->size <= DECODE_MAX_INVALID)
+		return get_invalid_bytes(instruction, out);
+	if (structure->format == RM_ESC) return get_esc_bytes(instruction, out);
+
+	encoding = find_encoding(structure);
+	if (!encoding) return -1;
+
+	// folded prefixes, as many and in the order they came
+	len = op = get_prefix_bytes(instruction, out);
+	out[len++] = encoding->opcode;
+
+	switch (structure->format) {
+	case REG:
+	case ACC_REG:
+	case REG_IMM:
+		out[op] |= FIELD_REG(instruction->fields);
+		break;
+	case RM:
+	case RM_V:
+	case RM_SR:
+	case RM_REG:
+	case RM_IMM:
+		mod = FIELD_MOD(instruction->fields);
+		rm  = FIELD_RM(instruction->fields);
+
+		if (structure->format == RM_REG)     reg = FIELD_REG(instruction->fields);
+		else if (structure->format == RM_SR) reg = FIELD_SR(instruction->fields);
+		else                                 reg = encoding->extd;
+
+		out[len++] = mod << 6 | reg << 3 | rm;
+
+		if (mod == MODE_MEM8) {
+			out[len++] = instruction->displacement & 0xFF;
+		} else if (mod == MODE_MEM16 || (mod == MODE_MEM0 && rm == 0b110)) {
+			out[len++] = instruction->displacement & 0xFF;
+			out[len++] = instruction->displacement >> 8;
+		}
+		break;
+	default: break;
+	}
+
+	switch (structure->format) {
+	case IMM:
+	case ACC_IMM:
+	case REG_IMM:
+	case RM_IMM:
+		out[len++] = instruction->data & 0xFF;
+		if (W(structure->flags) && !(structure->flags & MASK_S))
+			out[len++] = instruction->data >> 8;
+		break;
+	case ACC_IMM8:
+	case JMP_SHORT:
+		out[len++] = instruction->data & 0xFF;
+		break;
+	case ACC_MEM:
+	case JMP_NEAR:
+		out[len++] = instruction->data & 0xFF;
+		out[len++] = instruction->data >> 8;
+		break;
+	case JMP_FAR:
+		out[len++] = instruction->data & 0xFF;
+		out[len++] = instruction->data >> 8;
+		out[len++] = instruction->data_ext & 0xFF;
+		out[len++] = instruction->data_ext >> 8;
+		break;
+	case NONE:
+		if (structure->size - PREFIX_SIZE(instruction->prefix_order) == 2) out[len++] = instruction->data & 0xFF;
+		break;
+	default: break;
+	}
+
+	return len;
+}
+
+int verify_image(struct verify *verify, Instruction *instructions, uint count,
+                 uint8 *const data, const char *path)
+{
+	uint8 bytes[ENCODE_MAX];
+	uint  i, j;
+	int   len, rc = 0;
+
+	verify->files++;
+
+	for (i = 0; i < count; ++i) {
+		Instruction *instruction = instructions + i;
+
+		verify->instructions++;
+
+		len = encode_instruction(instruction, bytes);
+		if (len < 0) {
+			verify->unsupported++;
+			continue;
+		}
+
+		if ((uint)len == instruction->structure.size &&
+		    memcmp(bytes, data + instruction->offset, len) == 0) continue;
+
+		verify->mismatches++;
+		rc = -1;
+
+		fprintf(stderr, "%s:%u: %s encodes as", path, instruction->offset,
+		        get_instruction_name(instruction->structure.type));
+		for (j = 0; j < (uint)len; ++j) fprintf(stderr, " %02X", bytes[j]);
+		fprintf(stderr, ", image has");
+		for (j = 0; j < instruction->structure.size; ++j)
+			fprintf(stderr, " %02X", data[instruction->offset + j]);
+		fputc('\n', stderr);
+	}
+
+	return rc;
+}
+
+void verify_merge(struct verify *into, const struct verify *from)
+{
+	into->files        += from->files;
+	into->instructions += from->instructions;
+	into->mismatches   += from->mismatches;
+	into->unsupported  += from->unsupported;
+}
+
+void verify_print(FILE *out, const struct verify *verify)
+{
+	fprintf(out, "verified %llu instructions in %llu files: %llu mismatches, %llu not encodable\n",
+	        (unsigned long long)verify->instructions, (unsigned long long)verify->files,
+	        (unsigned long long)verify->mismatches, (unsigned long long)verify->unsupported);
+}
@@ -0,0 +1,27 @@
+#if !defined ENCODE_H
+#define ENCODE_H
+
+#include "decode.h"
+
+// longest record, folded prefixes included
+#define ENCODE_MAX DECODE_MAX_SIZE
+
+struct verify
+{
+	uint64_t files;
+	uint64_t instructions;
+	uint64_t mismatches;
+	uint64_t unsupported;
+};
+
+// encode a record produced by parse_instruction back into bytes, returns the
+// length or -1 if no table entry produces that record
+extern int encode_instruction(const Instruction *instruction, uint8 out[ENCODE_MAX]);
+
+// re-encode every record and compare with the image it was decoded from
+extern int  verify_image(struct verify *verify, Instruction *instructions, uint count,
+                         uint8 *const data, const char *path);
+extern void verify_merge(struct verify *into, const struct verify *from);
+extern void verify_print(FILE *out, const struct verify *verify);
+
+#endif // ENCODE_H
@@ -0,0 +1,530 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estimate.h"
+#include "timing.h"
+
+static const uint16 word_regs[8] = {
+	LIVE_AX, LIVE_CX, LIVE_DX, LIVE_BX, LIVE_SP, LIVE_BP, LIVE_SI, LIVE_DI,
+};
+
+void estimate_init_buf(struct estimate *estimate, uint count, void *buf)
+{
+	size_t n = (size_t)count + 1;
+
+	memset(estimate, 0, sizeof(*estimate));
+
+	// widest first so everything stays aligned
+	estimate->clocks = buf;
+	estimate->loops  = (struct estimate_loop *)(estimate->clocks + n);
+	estimate->post   = (uint *)(estimate->loops + n);
+	estimate->order  = estimate->post + n;
+	estimate->cost   = estimate->order + n;
+	estimate->stack  = estimate->cost + n;
+	estimate->idom   = (int *)(estimate->stack + 4 * n);
+	estimate->owner  = estimate->idom + n;
+	estimate->root   = (uint8 *)(estimate->owner + n);
+	estimate->edge   = estimate->root + n;
+}
+
+int estimate_parse_trips(struct estimate_trips *trips, const char *arg)
+{
+	unsigned long a, b;
+	char *end;
+
+	for (;;) {
+		a = strtoul(arg, &end, 0);
+		if (end == arg) return -1;
+
+		if (*end == ':') {
+			arg = end + 1;
+			b   = strtoul(arg, &end, 0);
+			if (end == arg || b == 0 || trips->count == ESTIMATE_GIVEN_MAX) return -1;
+
+			trips->offset[trips->count] = a;
+			trips->trips[trips->count]  = b;
+			trips->count++;
+		} else {
+			if (a == 0) return -1;
+			trips->fallback = a;
+		}
+
+		if (*end == '\0') return 0;
+		if (*end != ',') return -1;
+		arg = end + 1;
+	}
+}
+
+// the root sits past the last block and dominates everything
+static int dominates(const struct estimate *e, uint h, uint b)
+{
+	while (b != h && b != e->block_count) b = e->idom[b];
+	return b == h;
+}
+
+static uint intersect(const struct estimate *e, uint a, uint b)
+{
+	while (a != b) {
+		while (e->post[a] < e->post[b]) a = e->idom[a];
+		while (e->post[b] < e->post[a]) b = e->idom[b];
+	}
+
+	return a;
+}
+
+// depth first from `start`, numbering blocks as they finish
+static void number_from(struct estimate *e, const struct live *live, uint start, uint *next)
+{
+	uint top = 0, b;
+	int  s;
+
+	e->post[start] = 0;
+	e->edge[start] = 0;
+	e->stack[top++] = start;
+
+	while (top) {
+		b = e->stack[top - 1];
+
+		if (e->edge[b] == 2) {
+			e->order[*next] = b;
+			e->post[b]      = (*next)++;
+			top--;
+			continue;
+		}
+
+		s = live->blocks[b].succ[e->edge[b]++];
+		if (s < 0 || e->post[s] != UINT32_MAX) continue;
+
+		// on the stack, not numbered yet
+		e->post[s] = 0;
+		e->edge[s] = 0;
+		e->stack[top++] = s;
+	}
+}
+
+// Cooper, Harvey and Kennedy: intersect the predecessors' dominators in
+// reverse postorder until nothing changes
+static void dominators(struct estimate *e, const struct live *live)
+{
+	uint n = e->block_count, b, k, i, next = 0, p, d;
+	int  changed = 1;
+
+	for (b = 0; b < n; ++b) {
+		e->post[b] = UINT32_MAX;
+		e->idom[b] = -1;
+		e->root[b] = b == 0 || live->blocks[b].entry || live->pred_first[b] == live->pred_first[b + 1];
+	}
+
+	// code only reachable from itself (a cycle nothing jumps into) gets a root too
+	for (b = 0; b < n; ++b)
+		if (e->root[b] && e->post[b] == UINT32_MAX) number_from(e, live, b, &next);
+
+	for (b = 0; b < n; ++b) {
+		if (e->post[b] != UINT32_MAX) continue;
+		e->root[b] = 1;
+		number_from(e, live, b, &next);
+	}
+
+	assert(next == n);
+	e->post[n] = n;
+	e->idom[n] = n;
+
+	while (changed) {
+		changed = 0;
+
+		for (k = n; k-- > 0;) {
+			b = e->order[k];
+			d = e->root[b] ? n : UINT32_MAX;
+
+			for (i = live->pred_first[b]; i < live->pred_first[b + 1]; ++i) {
+				p = live->preds[i];
+				if (e->idom[p] < 0) continue;
+				d = d == UINT32_MAX ? p : intersect(e, p, d);
+			}
+
+			if (d != UINT32_MAX && e->idom[b] != (int)d) {
+				e->idom[b] = d;
+				changed    = 1;
+			}
+		}
+	}
+}
+
+static void push_preds(struct estimate *e, const struct live *live, uint h, uint b, uint *top)
+{
+	uint i;
+
+	for (i = live->pred_first[b]; i < live->pred_first[b + 1]; ++i)
+		if (dominates(e, h, live->preds[i])) e->stack[(*top)++] = live->preds[i];
+}
+
+// inner headers finish first in the depth first walk, so loops come out
+// innermost first and a loop's parent always has a higher index
+static void find_loops(struct estimate *e, const struct live *live)
+{
+	struct estimate_loop *loop;
+	uint n = e->block_count, k, h, b, i, top;
+	int  l, back;
+
+	for (b = 0; b < n; ++b) e->owner[b] = -1;
+
+	for (k = 0; k < n; ++k) {
+		h = e->order[k];
+
+		for (i = live->pred_first[h], back = 0; i < live->pred_first[h + 1] && !back; ++i)
+			back = dominates(e, h, live->preds[i]);
+		if (!back || e->owner[h] >= 0) continue;
+
+		loop = e->loops + e->loop_count;
+		memset(loop, 0, sizeof(*loop));
+		loop->header = h;
+		loop->parent = -1;
+		e->owner[h]  = e->loop_count++;
+
+		top = 0;
+		push_preds(e, live, h, h, &top);
+
+		while (top) {
+			b = e->stack[--top];
+
+			if (e->owner[b] < 0) {
+				e->owner[b] = loop - e->loops;
+				push_preds(e, live, h, b, &top);
+				continue;
+			}
+
+			// inside a loop found earlier: its outermost one nests in this one
+			for (l = e->owner[b]; e->loops[l].parent >= 0; l = e->loops[l].parent) {}
+			if (l == loop - e->loops) continue;
+
+			e->loops[l].parent = loop - e->loops;
+			push_preds(e, live, h, e->loops[l].header, &top);
+		}
+	}
+}
+
+static int in_loop(const struct estimate *e, int l, int loop)
+{
+	while (l >= 0 && l != loop) l = e->loops[l].parent;
+	return l == loop;
+}
+
+// the record that steps the loop counter at the end of a back edge block:
+// loop (cx) or dec r16 followed by jnz; -1 if there is none
+static int counter_step(const struct live *live, Instruction *instructions, uint b, uint *reg)
+{
+	const struct live_block *block = live->blocks + b;
+	Instruction *last = instructions + block->last;
+	Operand ops[2];
+
+	if (last->structure.type == LOOP) {
+		*reg = 1;
+		return block->last;
+	}
+
+	if (last->structure.type != JNE || block->last == block->first) return -1;
+	if (instructions[block->last - 1].structure.type != DEC) return -1;
+
+	get_operands(instructions + block->last - 1, ops);
+	if (ops[0].kind != OPERAND_REG || ops[0].width != 2) return -1;
+
+	*reg = ops[0].reg & 7;
+	return block->last - 1;
+}
+
+// registers each loop body writes, leaving out the counter step of loops
+// with one; a call or interrupt may write anything
+static void body_defs(struct estimate *e, const struct live *live, const int *step)
+{
+	const struct live_block *block;
+	uint b, i;
+	int  l;
+
+	for (b = 0; b < e->block_count; ++b) {
+		if ((l = e->owner[b]) < 0) continue;
+		block = live->blocks + b;
+
+		for (i = block->first; i <= block->last; ++i) {
+			if ((int)i == step[l]) continue;
+			e->loops[l].def |= live->use[i] == LIVE_ALL ? LIVE_ALL : live->def[i];
+		}
+	}
+
+	for (l = 0; l < (int)e->loop_count; ++l)
+		if (e->loops[l].parent >= 0) e->loops[e->loops[l].parent].def |= e->loops[l].def;
+}
+
+// the one back edge into the loop, -1 if there are several
+static int back_edge(const struct estimate *e, const struct live *live, uint l)
+{
+	uint h = e->loops[l].header, i;
+	int  source = -1;
+
+	for (i = live->pred_first[h]; i < live->pred_first[h + 1]; ++i) {
+		if (!in_loop(e, e->owner[live->preds[i]], l)) continue;
+		if (source >= 0) return -1;
+		source = live->preds[i];
+	}
+
+	return source;
+}
+
+// the counter's value on entry, the same from every block outside the loop
+static int entry_value(const struct estimate *e, const struct live *live, uint l, uint reg,
+                       uint16 *value)
+{
+	const struct live_block *p;
+	uint h = e->loops[l].header, i, seen = 0;
+
+	if (e->root[h]) return 0;
+
+	for (i = live->pred_first[h]; i < live->pred_first[h + 1]; ++i) {
+		if (in_loop(e, e->owner[live->preds[i]], l)) continue;
+
+		p = live->blocks + live->preds[i];
+		if (!(p->known & (1u << reg))) return 0;
+		if (seen && p->value[reg] != *value) return 0;
+
+		*value = p->value[reg];
+		seen   = 1;
+	}
+
+	return seen;
+}
+
+static void trip_counts(struct estimate *e, const struct live *live, Instruction *instructions,
+                        const struct estimate_trips *trips, int *step)
+{
+	struct estimate_loop *loop;
+	uint   l, i, reg, offset;
+	int    source;
+	uint16 value;
+
+	// the counter step of each loop, then what the rest of its body writes
+	for (l = 0; l < e->loop_count; ++l) {
+		step[l] = -1;
+		source  = back_edge(e, live, l);
+		if (source < 0 || e->owner[source] != (int)l) continue;
+
+		step[l] = counter_step(live, instructions, source, &reg);
+		if (step[l] >= 0) e->loops[l].counter = reg;
+	}
+
+	body_defs(e, live, step);
+
+	for (l = 0; l < e->loop_count; ++l) {
+		loop         = e->loops + l;
+		loop->trips  = trips && trips->fallback ? trips->fallback : ESTIMATE_TRIPS;
+		loop->source = ESTIMATE_FALLBACK;
+
+		if (step[l] >= 0 && !(loop->def & word_regs[loop->counter]) &&
+		    entry_value(e, live, l, loop->counter, &value)) {
+			// a zero count wraps around first
+			loop->trips  = value ? value : 0x10000;
+			loop->source = ESTIMATE_DERIVED;
+		}
+
+		offset = instructions[live->blocks[loop->header].first].offset;
+		for (i = 0; trips && i < trips->count; ++i) {
+			if (trips->offset[i] != offset) continue;
+			loop->trips  = trips->trips[i];
+			loop->source = ESTIMATE_GIVEN;
+		}
+
+		if (loop->source == ESTIMATE_DERIVED) e->derived++;
+	}
+}
+
+// the value cx holds before record i of block b: loaded earlier in the block,
+// or on exit from its only predecessor
+static int known_cx(const struct live *live, Instruction *instructions, uint b, uint i,
+                    uint16 *value)
+{
+	const struct live_block *block = live->blocks + b;
+	uint   reg, p;
+
+	while (i-- > block->first) {
+		if (!(live->def[i] & LIVE_CX) && live->use[i] != LIVE_ALL) continue;
+		return live_constant(instructions + i, &reg, value) && reg == 1;
+	}
+
+	if (block->entry || live->pred_first[b] + 1 != live->pred_first[b + 1]) return 0;
+
+	p = live->preds[live->pred_first[b]];
+	if (p >= b || !(live->blocks[p].known & (1u << 1))) return 0;
+
+	*value = live->blocks[p].value[1];
+	return 1;
+}
+
+static uint record_clocks(const struct live *live, Instruction *instructions, uint b, uint i,
+                          uint fallback)
+{
+	Instruction *instruction = instructions + i;
+	Operand ops[2];
+	uint16  cx;
+	uint    n, first;
+
+	get_operands(instruction, ops);
+
+	if (instruction->structure.flags & MASK_V && ops[1].kind == OPERAND_REG)
+		return timing_clocks(instruction, ops, known_cx(live, instructions, b, i, &cx) ? cx & 0xFF : 1,
+		                     0, 1);
+
+	if (!(instruction->structure.prefixes & (PFX_REP | PFX_REPNE)))
+		return timing_clocks(instruction, ops, 1, 0, 1);
+
+	switch (instruction->structure.type) {
+	case MOVSB: case MOVSW: case CMPSB: case CMPSW: case SCASB: case SCASW:
+	case LODSB: case LODSW: case STOSB: case STOSW:
+		n = known_cx(live, instructions, b, i, &cx) ? cx : fallback;
+		if (n == 0) return timing_clocks(instruction, ops, 0, 0, 1);
+
+		first = timing_clocks(instruction, ops, 1, 0, 1);
+		return first + (n - 1) * timing_clocks(instruction, ops, 1, 0, 0);
+	default:
+		return timing_clocks(instruction, ops, 1, 0, 1);
+	}
+}
+
+void estimate_solve(struct estimate *estimate, const struct live *live,
+                    Instruction *instructions, const struct estimate_trips *trips)
+{
+	struct estimate *e = estimate;
+	struct estimate_loop *loop;
+	const struct live_block *block;
+	Operand ops[2];
+	uint    n = live->block_count, b, i, fallback, taken, fall;
+	int     l, *step;
+	double  entries;
+
+	e->block_count = n;
+	e->loop_count  = e->derived = 0;
+	if (n == 0) return;
+
+	fallback = trips && trips->fallback ? trips->fallback : ESTIMATE_TRIPS;
+
+	dominators(e, live);
+	find_loops(e, live);
+
+	// a counter step per loop, in room the dfs no longer needs
+	step = (int *)e->stack;
+	trip_counts(e, live, instructions, trips, step);
+
+	// outer loops have the higher index: runs come down from them, blocks
+	// and clocks go up
+	for (l = e->loop_count; l-- > 0;) {
+		loop = e->loops + l;
+		loop->runs  = (loop->parent >= 0 ? e->loops[loop->parent].runs : 1.0) * loop->trips;
+		loop->depth = loop->parent >= 0 ? e->loops[loop->parent].depth + 1 : 1;
+	}
+
+	for (b = 0; b < n; ++b) {
+		block = live->blocks + b;
+		l     = e->owner[b];
+
+		e->cost[b] = 0;
+		for (i = block->first; i <= block->last; ++i)
+			e->cost[b] += record_clocks(live, instructions, b, i, fallback);
+
+		e->clocks[b] = (l >= 0 ? e->loops[l].runs : 1.0) * e->cost[b];
+
+		// the back edge is taken on all but the last iteration
+		if (l >= 0 && block->succ[1] == (int)e->loops[l].header) {
+			get_operands(instructions + block->last, ops);
+			taken   = timing_clocks(instructions + block->last, ops, 1, 1, 1);
+			fall    = timing_clocks(instructions + block->last, ops, 1, 0, 1);
+			entries = e->loops[l].parent >= 0 ? e->loops[e->loops[l].parent].runs : 1.0;
+
+			e->clocks[b] += e->loops[l].runs * (taken - fall) - entries * (taken - fall);
+		}
+
+		if (l >= 0) {
+			e->loops[l].clocks += e->clocks[b];
+			e->loops[l].blocks++;
+			if (b > e->loops[l].last) e->loops[l].last = b;
+		}
+	}
+
+	for (l = 0; l < (int)e->loop_count; ++l) {
+		loop = e->loops + l;
+		if (loop->parent < 0) continue;
+
+		e->loops[loop->parent].clocks += loop->clocks;
+		e->loops[loop->parent].blocks += loop->blocks;
+		if (loop->last > e->loops[loop->parent].last) e->loops[loop->parent].last = loop->last;
+	}
+}
+
+void estimate_report(FILE *out, const struct estimate *estimate, const struct live *live,
+                     Instruction *instructions, struct estimation *totals)
+{
+	const struct estimate *e = estimate;
+	const struct estimate_loop *loop;
+	const struct live_block *block;
+	static const char *const sources[] = { "?", "given", "" };
+	uint   b, i, bytes;
+	double total = 0;
+	char   trips[16];
+
+	fprintf(out, "; 8086 table clocks; runs: with every loop at its trip count\n");
+	fprintf(out, "block   last    instrs  bytes  clocks        runs         total\n");
+
+	for (b = 0; b < e->block_count; ++b) {
+		block = live->blocks + b;
+
+		for (i = block->first, bytes = 0; i <= block->last; ++i)
+			bytes += instructions[i].structure.size;
+
+		fprintf(out, "0x%04X  0x%04X  %6u  %5u  %6u  %10.0f  %12.0f\n",
+		        instructions[block->first].offset, instructions[block->last].offset,
+		        block->last - block->first + 1, bytes, e->cost[b],
+		        e->owner[b] >= 0 ? e->loops[e->owner[b]].runs : 1.0, e->clocks[b]);
+		total += e->clocks[b];
+	}
+
+	if (e->loop_count)
+		fprintf(out, "loop    last    depth  blocks        trips   per iteration         total\n");
+
+	// in the order the headers appear, a header's owner is its own loop
+	for (b = 0; b < e->block_count; ++b) {
+		if (e->owner[b] < 0 || e->loops[e->owner[b]].header != b) continue;
+
+		loop = e->loops + e->owner[b];
+		snprintf(trips, sizeof(trips), "%u %s", loop->trips,
+		         loop->source == ESTIMATE_DERIVED ? get_register_name(1, loop->counter) :
+		                                            sources[loop->source]);
+
+		fprintf(out, "0x%04X  0x%04X  %5u  %6u  %11s  %14.1f  %12.0f\n",
+		        instructions[live->blocks[loop->header].first].offset,
+		        instructions[live->blocks[loop->last].last].offset, loop->depth, loop->blocks, trips,
+		        loop->clocks / loop->runs, loop->clocks);
+	}
+
+	fprintf(out, "; %u blocks, %u loops (%u trip counts derived): %.0f clocks\n", e->block_count,
+	        e->loop_count, e->derived, total);
+
+	totals->files++;
+	totals->blocks  += e->block_count;
+	totals->loops   += e->loop_count;
+	totals->derived += e->derived;
+	totals->clocks  += total;
+}
+
+void estimate_merge(struct estimation *into, const struct estimation *from)
+{
+	into->files   += from->files;
+	into->blocks  += from->blocks;
+	into->loops   += from->loops;
+	into->derived += from->derived;
+	into->clocks  += from->clocks;
+}
+
+void estimate_print(FILE *out, const struct estimation *totals)
+{
+	fprintf(out, "estimate: %.0f clocks in %llu blocks, %llu loops (%llu trip counts derived), "
+	        "%llu files\n",
+	        totals->clocks, (unsigned long long)totals->blocks, (unsigned long long)totals->loops,
+	        (unsigned long long)totals->derived, (unsigned long long)totals->files);
+}
@@ -0,0 +1,106 @@
+#if !defined ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "live.h"
+
+// loops with no trip count of their own: the default for --trips
+#define ESTIMATE_TRIPS 10
+
+// --trips=OFFSET:N pairs
+#define ESTIMATE_GIVEN_MAX 64
+
+// column headings and totals, then a line per block and per loop
+#define ESTIMATE_LINE 72
+#define ESTIMATE_REPORT_SIZE(count) (512 + (size_t)(count) * 2 * ESTIMATE_LINE)
+
+// where a loop's trip count came from
+typedef enum {
+	ESTIMATE_FALLBACK, // nothing known, --trips=N or ESTIMATE_TRIPS
+	ESTIMATE_GIVEN,    // --trips=OFFSET:N for its header
+	ESTIMATE_DERIVED,  // counter loaded with a constant before the loop
+} ESTIMATE_SOURCE;
+
+struct estimate_trips
+{
+	uint fallback;
+	uint count;
+	uint offset[ESTIMATE_GIVEN_MAX]; // loop header, as the listing shows it
+	uint trips[ESTIMATE_GIVEN_MAX];
+};
+
+// a natural loop: its header and every block that reaches a back edge to it
+// without going through the header
+struct estimate_loop
+{
+	uint   header;   // block index
+	int    parent;   // enclosing loop, -1 for none
+	uint   last;     // highest block index in the body
+	uint   blocks;   // nested loops' blocks included
+	uint   depth;    // 1 outermost
+	uint   trips;
+	uint8  source;   // ESTIMATE_SOURCE
+	uint8  counter;  // word register the derived count is in
+	uint16 def;      // registers the body writes, the counter step aside
+	double runs;     // header runs over the whole program
+	double clocks;   // every block of the body, all iterations of all entries
+};
+
+struct estimate
+{
+	uint    block_count;
+	uint    loop_count;
+	uint    derived;     // loops with ESTIMATE_DERIVED trips
+
+	uint   *post;        // postorder number per block, the root one past the last
+	uint   *order;       // block at each postorder number
+	int    *idom;        // immediate dominator, block_count for the root
+	int    *owner;       // innermost loop of each block, -1 for none
+	uint8  *root;        // entered from outside: the start, call targets, no predecessors
+	uint   *stack;       // every predecessor list twice at most
+	uint8  *edge;
+
+	uint   *cost;        // clocks for one run of each block, falling through at its end
+	double *clocks;      // each block's share of the total
+	struct estimate_loop *loops;
+};
+
+// totals over every file, merged after the batch like struct liveness
+struct estimation
+{
+	uint64_t files;
+	uint64_t blocks;
+	uint64_t loops;
+	uint64_t derived;
+	double   clocks;
+};
+
+// buffer estimate_init_buf needs for `count` records
+#define ESTIMATE_BUF_SIZE(count) (((size_t)(count) + 1) * (7 * sizeof(uint) + 2 * sizeof(int) + \
+                                                         2 + sizeof(double) + \
+                                                         sizeof(struct estimate_loop)) + \
+                                  sizeof(double))
+
+extern void estimate_init_buf(struct estimate *estimate, uint count, void *buf);
+
+// --trips: N for every loop without a count of its own, OFFSET:N for the
+// loop at that header, comma separated; -1 on a malformed list
+extern int estimate_parse_trips(struct estimate_trips *trips, const char *arg);
+
+// dominators and natural loops over the blocks live_solve found, trip
+// counts, and clocks per block from the 8086 tables. A conditional branch
+// counts as not taken, except a loop's back edge, which is taken on every
+// iteration but the last. Every block in a loop runs once per iteration.
+extern void estimate_solve(struct estimate *estimate, const struct live *live,
+                           Instruction *instructions, const struct estimate_trips *trips);
+
+extern void estimate_report(FILE *out, const struct estimate *estimate, const struct live *live,
+                            Instruction *instructions, struct estimation *totals);
+extern void estimate_merge(struct estimation *into, const struct estimation *from);
+extern void estimate_print(FILE *out, const struct estimation *totals);
+
+#endif // ESTIMATE_H
@@ -0,0 +1,383 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "format.h"
+
+_Static_assert(sizeof(struct bin_record) == BIN_RECORD_SIZE, "bin_record layout changed");
+_Static_assert(offsetof(struct bin_record, target) == 28, "bin_record layout changed");
+_Static_assert(sizeof(struct bin_file) == BIN_RECORD_SIZE, "bin_file layout changed");
+_Static_assert(offsetof(struct bin_file, size) == offsetof(struct bin_record, size), "bin_file layout changed");
+
+static const char *operand_kinds[] = { "none", "reg", "sreg", "mem", "imm", "rel", "far" };
+
+int parse_output(const char *name, OUTPUT *output)
+{
+	if      (strcmp(name, "text")  == 0) *output = OUTPUT_TEXT;
+	else if (strcmp(name, "jsonl") == 0) *output = OUTPUT_JSONL;
+	else if (strcmp(name, "csv")   == 0) *output = OUTPUT_CSV;
+	else if (strcmp(name, "bin")   == 0) *output = OUTPUT_BIN;
+	else return -1;
+
+	return 0;
+}
+
+size_t output_max_record(OUTPUT output)
+{
+	switch (output) {
+	case OUTPUT_TEXT:  return DECODE_MAX_LINE;
+	case OUTPUT_JSONL: return 400;
+	case OUTPUT_CSV:   return 160;
+	case OUTPUT_BIN:   return BIN_RECORD_SIZE;
+	}
+
+	return 0;
+}
+
+void writer_flush(struct writer *w)
+{
+	if (w->out && w->len) fwrite(w->buf, 1, w->len, w->out);
+	w->len = 0;
+}
+
+static void put(struct writer *w, const void *src, size_t len)
+{
+	if (w->len + len > w->cap) {
+		if (!w->out) {
+			// fixed buffers are sized by output_max_record, clip rather than overrun
+			len = w->cap - w->len;
+		} else {
+			writer_flush(w);
+			if (len > w->cap) {
+				fwrite(src, 1, len, w->out);
+				return;
+			}
+		}
+	}
+
+	memcpy(w->buf + w->len, src, len);
+	w->len += len;
+}
+
+static void put_char(struct writer *w, char c)
+{
+	put(w, &c, 1);
+}
+
+static void put_str(struct writer *w, const char *str)
+{
+	put(w, str, strlen(str));
+}
+
+static void put_uint(struct writer *w, uint32_t value)
+{
+	char  tmp[10];
+	char *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	put(w, p, tmp + sizeof(tmp) - p);
+}
+
+static void put_int(struct writer *w, int32_t value)
+{
+	if (value < 0) {
+		put_char(w, '-');
+		put_uint(w, -(uint32_t)value);
+		return;
+	}
+
+	put_uint(w, value);
+}
+
+static void put_hex(struct writer *w, const uint8 *bytes, uint count)
+{
+	static const char digits[] = "0123456789abcdef";
+	char tmp[2];
+	uint i;
+
+	for (i = 0; i < count; ++i) {
+		tmp[0] = digits[bytes[i] >> 4];
+		tmp[1] = digits[bytes[i] & 0xF];
+		put(w, tmp, 2);
+	}
+}
+
+static void put_le16(struct writer *w, uint16_t value)
+{
+	uint8 tmp[2] = { value & 0xFF, value >> 8 };
+	put(w, tmp, 2);
+}
+
+static void put_le32(struct writer *w, uint32_t value)
+{
+	uint8 tmp[4] = { value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24 };
+	put(w, tmp, 4);
+}
+
+static void put_json_str(struct writer *w, const char *str)
+{
+	put_char(w, '"');
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			put_char(w, '\\');
+			put_char(w, *str);
+		} else if ((unsigned char)*str < 0x20) {
+			put_char(w, '?');
+		} else {
+			put_char(w, *str);
+		}
+	}
+	put_char(w, '"');
+}
+
+// nasm spelling of a memory operand, "es:[bp + si - 12]"
+static void put_mem(struct writer *w, Instruction *instruction, Operand *op)
+{
+	if (instruction->structure.prefixes & PFX_SGMNT) {
+		put_str(w, get_segment_name(SGMNT_OP(instruction->structure.prefixes)));
+		put_char(w, ':');
+	}
+
+	put_char(w, '[');
+	if (op->reg == EA_DIRECT) {
+		put_uint(w, op->value & 0xFFFF);
+	} else {
+		put_str(w, get_ea_name(op->reg));
+		if (op->value) {
+			put_str(w, op->value < 0 ? " - " : " + ");
+			put_uint(w, op->value < 0 ? -op->value : op->value);
+		}
+	}
+	put_char(w, ']');
+}
+
+static void put_operand_value(struct writer *w, Instruction *instruction, Operand *op)
+{
+	switch (op->kind) {
+	case OPERAND_REG:  put_str(w, get_register_name(op->width == 2, op->reg)); break;
+	case OPERAND_SREG: put_str(w, get_segment_name(op->reg)); break;
+	case OPERAND_MEM:  put_mem(w, instruction, op); break;
+	case OPERAND_IMM:
+	case OPERAND_REL:  put_int(w, op->value); break;
+	case OPERAND_FAR:
+		put_uint(w, op->segment);
+		put_char(w, ':');
+		put_uint(w, op->value & 0xFFFF);
+		break;
+	case OPERAND_NONE: break;
+	}
+}
+
+static void format_jsonl(struct writer *w, Instruction *instruction, uint8 *const data)
+{
+	Operand ops[2];
+	int     i, count, target;
+
+	count  = get_operands(instruction, ops);
+	target = get_jmp_offset(instruction);
+
+	put_str(w, "{\"offset\":");
+	put_uint(w, instruction->offset);
+	put_str(w, ",\"size\":");
+	put_uint(w, instruction->structure.size);
+	put_str(w, ",\"bytes\":\"");
+	put_hex(w, data + instruction->offset, instruction->structure.size);
+	put_str(w, "\",\"id\":");
+	put_uint(w, instruction->structure.type);
+	put_str(w, ",\"mnemonic\":");
+	put_json_str(w, get_instruction_name(instruction->structure.type));
+	put_str(w, ",\"prefixes\":");
+	put_uint(w, instruction->structure.prefixes);
+	put_str(w, ",\"target\":");
+	if (target >= 0) put_int(w, target);
+	else             put_str(w, "null");
+
+	put_str(w, ",\"operands\":[");
+	for (i = 0; i < count; ++i) {
+		if (i) put_char(w, ',');
+
+		put_str(w, "{\"kind\":\"");
+		put_str(w, operand_kinds[ops[i].kind]);
+		put_str(w, "\",\"width\":");
+		put_uint(w, ops[i].width);
+
+		switch (ops[i].kind) {
+		case OPERAND_REG:
+		case OPERAND_SREG:
+			put_str(w, ",\"reg\":\"");
+			put_operand_value(w, instruction, ops + i);
+			put_char(w, '"');
+			break;
+		case OPERAND_MEM:
+			put_str(w, ",\"ea\":");
+			if (ops[i].reg == EA_DIRECT) put_str(w, "null");
+			else                         put_json_str(w, get_ea_name(ops[i].reg));
+			put_str(w, ",\"disp\":");
+			put_int(w, ops[i].value);
+			put_str(w, ",\"segment\":");
+			if (instruction->structure.prefixes & PFX_SGMNT) {
+				put_char(w, '"');
+				put_str(w, get_segment_name(SGMNT_OP(instruction->structure.prefixes)));
+				put_char(w, '"');
+			} else {
+				put_str(w, "null");
+			}
+			break;
+		case OPERAND_IMM:
+			put_str(w, ",\"value\":");
+			put_int(w, ops[i].value);
+			break;
+		case OPERAND_REL:
+			put_str(w, ",\"target\":");
+			put_int(w, ops[i].value);
+			break;
+		case OPERAND_FAR:
+			put_str(w, ",\"segment\":");
+			put_uint(w, ops[i].segment);
+			put_str(w, ",\"offset\":");
+			put_uint(w, ops[i].value & 0xFFFF);
+			break;
+		case OPERAND_NONE: break;
+		}
+
+		put_char(w, '}');
+	}
+	put_str(w, "]}\n");
+}
+
+static void format_csv(struct writer *w, Instruction *instruction, uint8 *const data)
+{
+	Operand ops[2];
+	int     i, target;
+
+	get_operands(instruction, ops);
+	target = get_jmp_offset(instruction);
+
+	put_uint(w, instruction->offset);
+	put_char(w, ',');
+	put_uint(w, instruction->structure.size);
+	put_char(w, ',');
+	put_hex(w, data + instruction->offset, instruction->structure.size);
+	put_char(w, ',');
+	put_uint(w, instruction->structure.type);
+	put_char(w, ',');
+	put(w, instruction_name_pool + instruction_names[instruction->structure.type].offset,
+	    instruction_names[instruction->structure.type].length);
+	put_char(w, ',');
+	put_uint(w, instruction->structure.prefixes);
+	put_char(w, ',');
+	if (target >= 0) put_int(w, target);
+
+	for (i = 0; i < 2; ++i) {
+		put_char(w, ',');
+		if (ops[i].kind != OPERAND_NONE) put_str(w, operand_kinds[ops[i].kind]);
+		put_char(w, ',');
+		put_operand_value(w, instruction, ops + i);
+	}
+	put_char(w, '\n');
+}
+
+static void format_bin(struct writer *w, Instruction *instruction, uint8 *const data)
+{
+	Operand ops[2];
+	uint8   bytes[6] = { 0 };
+	uint8   count;
+	int     i;
+
+	count = get_operands(instruction, ops);
+	// prefixes are in the prefixes bits, size still counts their bytes
+	memcpy(bytes, data + instruction->offset + PREFIX_SIZE(instruction->prefix_order),
+	       instruction->structure.size - PREFIX_SIZE(instruction->prefix_order));
+
+	// field by field so the stream is little-endian whatever the host is
+	put_le32(w, instruction->offset);
+	put_char(w, instruction->structure.size);
+	put_char(w, instruction->structure.type);
+	put_char(w, instruction->structure.format);
+	put_char(w, instruction->structure.flags);
+	put_char(w, instruction->structure.prefixes);
+	put(w, bytes, sizeof(bytes));
+	put_char(w, count);
+	for (i = 0; i < 2; ++i) put_char(w, ops[i].kind);
+	for (i = 0; i < 2; ++i) put_char(w, ops[i].reg);
+	for (i = 0; i < 2; ++i) put_le16(w, ops[i].value);
+	put_le16(w, ops[0].segment);
+	for (i = 0; i < 2; ++i) put_char(w, ops[i].width);
+	put_le32(w, get_jmp_offset(instruction));
+}
+
+static void format_bin_file(struct writer *w, const char *path, int status, size_t size)
+{
+	static const uint8 zeros[BIN_RECORD_SIZE];
+	uint32_t len = strlen(path);
+
+	put_le32(w, status < 0 ? 0 : size / BIN_RECORD_SIZE);
+	put(w, zeros, 4);
+	put_le32(w, status);
+	put_le32(w, len);
+	put(w, zeros, 16);
+
+	put(w, path, len);
+	put(w, zeros, -len % BIN_RECORD_SIZE);
+}
+
+void format_header(struct writer *w, OUTPUT output, const char *path, int status, size_t size)
+{
+	switch (output) {
+	case OUTPUT_TEXT:
+		if (!path) break;
+		put_str(w, "; ");
+		put_str(w, path);
+		put_char(w, '\n');
+		if (status < 0) {
+			put_str(w, "; error ");
+			put_int(w, status);
+			put_char(w, '\n');
+		}
+		break;
+	case OUTPUT_JSONL:
+		if (!path) break;
+		put_str(w, "{\"file\":");
+		put_json_str(w, path);
+		put_str(w, "}\n");
+		if (status < 0) {
+			put_str(w, "{\"error\":");
+			put_int(w, status);
+			put_str(w, "}\n");
+		}
+		break;
+	case OUTPUT_CSV:
+		if (path) {
+			put_str(w, "# ");
+			put_str(w, path);
+			put_char(w, '\n');
+			if (status < 0) {
+				put_str(w, "# error ");
+				put_int(w, status);
+				put_char(w, '\n');
+			}
+		}
+		put_str(w, "offset,size,bytes,id,mnemonic,prefixes,target,op1_kind,op1,op2_kind,op2\n");
+		break;
+	case OUTPUT_BIN:
+		// offsets restart at 0 for every file
+		if (path) format_bin_file(w, path, status, size);
+		break;
+	}
+}
+
+void format_instruction(struct writer *w, OUTPUT output, Instruction *instruction, uint8 *const data)
+{
+	switch (output) {
+	case OUTPUT_JSONL: format_jsonl(w, instruction, data); break;
+	case OUTPUT_CSV:   format_csv(w, instruction, data);   break;
+	case OUTPUT_BIN:   format_bin(w, instruction, data);   break;
+	case OUTPUT_TEXT:
+		assert(0 && "text goes through decode_instruction");
+		break;
+	}
+}
@@ -0,0 +1,71 @@
+#if !defined FORMAT_H
+#define FORMAT_H
+
+#include <stdio.h>
+
+#include "decode.h"
+
+typedef enum {
+	OUTPUT_TEXT,
+	OUTPUT_JSONL,
+	OUTPUT_CSV,
+	OUTPUT_BIN,
+} OUTPUT;
+
+// byte sink that never goes through printf; flushes to `out` when full, or
+// just stops at `cap` when there is no stream behind it
+struct writer
+{
+	char  *buf;
+	size_t len;
+	size_t cap;
+	FILE  *out;
+};
+
+// one `bin` record, little-endian, naturally aligned so the file can be
+// mmap'd as an array of these
+struct bin_record
+{
+	uint32_t offset;
+	uint8_t  size;
+	uint8_t  type;      // TYPE
+	uint8_t  format;    // FORMAT
+	uint8_t  flags;
+	uint8_t  prefixes;
+	uint8_t  bytes[6];  // encoding after the prefix bytes, zero padded
+	uint8_t  op_count;
+	uint8_t  op_kind[2];  // OPERAND
+	uint8_t  op_reg[2];
+	uint16_t op_value[2];
+	uint16_t segment;     // OPERAND_FAR segment
+	uint8_t  op_width[2];
+	int32_t  target;      // branch target, -1 if none
+};
+
+#define BIN_RECORD_SIZE 32
+
+// ahead of each file's records when a `bin` stream has per-file headers: one
+// record's worth, told from a bin_record by its size of 0, then the path
+// zero padded to a whole number of records
+struct bin_file
+{
+	uint32_t records;     // bin_records after the path
+	uint8_t  size;        // always 0
+	uint8_t  pad[3];
+	int32_t  status;      // 0, or the negative error the file failed with
+	uint32_t path_length; // without the padding
+	uint8_t  reserved[16];
+};
+
+extern int    parse_output(const char *name, OUTPUT *output);
+// upper bound of bytes one instruction takes in `output`
+extern size_t output_max_record(OUTPUT output);
+
+extern void writer_flush(struct writer *w);
+
+// per-file header ahead of `size` bytes of records, then an error record when
+// status is negative; nothing but the csv column names when path is NULL
+extern void format_header(struct writer *w, OUTPUT output, const char *path, int status, size_t size);
+extern void format_instruction(struct writer *w, OUTPUT output, Instruction *instruction, uint8 *const data);
+
+#endif // FORMAT_H
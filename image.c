@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "image.h"
+
+#define MZ_HEADER   28
+#define MZ_PAGE     512
+#define PARAGRAPH   16
+
+static uint16 read_le16(const uint8 *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+	return *(const uint16 *)a - *(const uint16 *)b;
+}
+
+static int is_com(const char *name)
+{
+	const char *dot = name ? strrchr(name, '.') : NULL;
+	return dot && strcasecmp(dot, ".com") == 0;
+}
+
+// keep segments that start inside the module, sorted and unique
+static uint finish_segments(uint16 *segments, uint count, uint size)
+{
+	uint i, n = 0;
+
+	qsort(segments, count, sizeof(*segments), compare_segments);
+
+	for (i = 0; i < count; ++i) {
+		if ((uint32)segments[i] * PARAGRAPH >= size) break;
+		if (n > 0 && segments[n - 1] == segments[i]) continue;
+		segments[n++] = segments[i];
+	}
+
+	return n;
+}
+
+// an mz header whose sizes fit the file: anything else with the signature
+// is raw code that happens to start with dec bp; pop dx
+static int is_mz(const uint8 *file, uint size)
+{
+	uint last, pages, end;
+
+	if (size < MZ_HEADER) return 0;
+	if (!(file[0] == 'M' && file[1] == 'Z') && !(file[0] == 'Z' && file[1] == 'M')) return 0;
+
+	last  = read_le16(file + 2);
+	pages = read_le16(file + 4);
+
+	// the last page only holds `last` bytes, 0 means a full page
+	end = pages * MZ_PAGE;
+	if (last) end -= MZ_PAGE - last;
+
+	return pages > 0 && last < MZ_PAGE && end <= size &&
+	       (uint)read_le16(file + 8) * PARAGRAPH >= MZ_HEADER &&
+	       (uint)read_le16(file + 8) * PARAGRAPH <= end &&
+	       read_le16(file + 24) + (uint)read_le16(file + 6) * 4 <= size;
+}
+
+static void load_mz(struct image *image, uint8 *file)
+{
+	uint   pages, last, header, table, count, end, i, n = 0;
+	uint32 site;
+	uint8 *entry;
+
+	last   = read_le16(file + 2);
+	pages  = read_le16(file + 4);
+	count  = read_le16(file + 6);
+	header = read_le16(file + 8) * PARAGRAPH;
+	table  = read_le16(file + 24);
+
+	end = pages * MZ_PAGE;
+	if (last) end -= MZ_PAGE - last;
+
+	image->kind        = IMAGE_MZ;
+	image->data        = file + header;
+	image->size        = end - header;
+	image->entry_ip    = read_le16(file + 20);
+	image->entry_cs    = read_le16(file + 22);
+	image->entry_ss    = read_le16(file + 14);
+	image->entry_sp    = read_le16(file + 16);
+	image->relocations = count;
+
+	image->segments[n++] = 0;
+	image->segments[n++] = image->entry_cs;
+
+	// every relocation is a segment value the program uses, and sits in one;
+	// the words stay as they are, the module is listed and run at segment 0
+	for (i = 0; i < count; ++i) {
+		entry = file + table + i * 4;
+		site  = (uint32)read_le16(entry + 2) * PARAGRAPH + read_le16(entry);
+		if (site + 2 > image->size) {
+			fprintf(stderr, "mz relocation %u points outside the image\n", i);
+			continue;
+		}
+
+		image->segments[n++] = read_le16(entry + 2);
+		image->segments[n++] = read_le16(image->data + site);
+	}
+
+	image->segment_count = finish_segments(image->segments, n, image->size);
+}
+
+int image_load(struct image *image, uint8 *file, uint size, const char *name, uint16 *segments)
+{
+	memset(image, 0, sizeof(*image));
+	image->kind     = IMAGE_RAW;
+	image->data     = file;
+	image->size     = size;
+	image->segments = segments;
+
+	if (is_mz(file, size)) {
+		load_mz(image, file);
+		return 0;
+	}
+
+	if (is_com(name)) {
+		// loaded at cs:0100, one segment
+		image->kind          = IMAGE_COM;
+		image->entry_ip      = 0x100;
+		image->segments[0]   = 0;
+		image->segment_count = size > 0;
+
+		if (size > 0x10000 - 0x100)
+			fprintf(stderr, "warning: com image larger than a segment (%u bytes)\n", size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#if !defined IMAGE_H
+#define IMAGE_H
+
+#include "decode.h"
+
+typedef enum {
+	IMAGE_RAW,
+	IMAGE_COM,
+	IMAGE_MZ,
+} IMAGE;
+
+// what gets decoded out of a file: the load module and where its segments start
+struct image
+{
+	IMAGE   kind;
+
+	uint8  *data;       // load module, inside the file buffer
+	uint    size;
+
+	uint16  entry_cs;
+	uint16  entry_ip;
+	uint16  entry_ss;   // initial stack, mz only
+	uint16  entry_sp;
+	uint    relocations;
+
+	// sorted segment values, each starting at paragraph * 16 in data;
+	// empty for raw images, which decode as one flat range
+	uint16 *segments;
+	uint    segment_count;
+};
+
+// room image_load needs in `segments` for a file of `size` bytes
+#define IMAGE_MAX_SEGMENTS(size) ((size) / 2 + 4)
+
+// recognise MZ (by a signature and header that fit the file) and COM (by
+// extension) images in file; anything else is a raw image. MZ images load at
+// segment 0, so relocated words already hold module-relative segments, the
+// same ones the labels use, and the file is never written.
+extern int image_load(struct image *image, uint8 *file, uint size, const char *name, uint16 *segments);
+
+#endif // IMAGE_H
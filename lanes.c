@@ -0,0 +1,575 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lanes.h"
+
+#define MEMORY_MASK (SIM_MEMORY - 1)
+
+// lane masks are 0xFFFF for the lanes an op applies to and 0 for the rest, so
+// every update is a blend the compiler can keep in vector registers
+#define BLEND(old, new, m) (((new) & (m)) | ((old) & (uint16)~(m)))
+
+// no register: reads as 0 in an effective address
+static const uint16 zero[LANES];
+
+int lanes_init(struct lanes *lanes)
+{
+	uint l;
+
+	memset(lanes, 0, sizeof(*lanes));
+
+	for (l = 0; l < LANES; ++l) {
+		lanes->block.memory[l] = calloc(SIM_MEMORY, 1);
+		if (!lanes->block.memory[l]) return -3;
+	}
+
+	return 0;
+}
+
+void lanes_free(struct lanes *lanes)
+{
+	uint l;
+
+	for (l = 0; l < LANES; ++l) {
+		free(lanes->block.memory[l]);
+		lanes->block.memory[l] = NULL;
+	}
+}
+
+static uint32 linear(uint16 segment, uint16 offset)
+{
+	return ((uint32)segment * 16 + offset) & MEMORY_MASK;
+}
+
+static uint64_t splitmix(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// clear what the last run in lane l wrote, then load the image over it
+static void load_lane(struct lanes *lanes, uint l, const struct image *image)
+{
+	struct lane_block *b = &lanes->block;
+	uint   page, r;
+
+	for (page = 0; page < SIM_PAGES; ++page) {
+		if (!(b->dirty[l][page / 32] & (1u << (page % 32)))) continue;
+		memset(b->memory[l] + ((size_t)page << SIM_PAGE_SHIFT), 0, (size_t)1 << SIM_PAGE_SHIFT);
+	}
+	memset(b->dirty[l], 0, sizeof(b->dirty[l]));
+
+	lanes->scalar.memory = b->memory[l];
+	sim_place(&lanes->scalar, image);
+
+	// the next image may be shorter, its load clears this one
+	for (page = lanes->scalar.code_start >> SIM_PAGE_SHIFT;
+	     page < (lanes->scalar.code_end + (1u << SIM_PAGE_SHIFT) - 1) >> SIM_PAGE_SHIFT; ++page)
+		b->dirty[l][page / 32] |= 1u << (page % 32);
+
+	for (r = 0; r < 8; ++r) b->regs[r][l] = lanes->scalar.state.regs[r];
+	for (r = 0; r < 4; ++r) b->sregs[r][l] = lanes->scalar.state.sregs[r];
+	b->ip[l]       = lanes->scalar.state.ip;
+	b->flags[l]    = lanes->scalar.state.flags;
+	b->steps[l]    = 0;
+	b->stop[l]     = SIM_RUNNING;
+	b->own_code[l] = 0;
+}
+
+// one lane through sim_step, for everything the lockstep ops don't cover
+static void step_scalar(struct lanes *lanes, uint l)
+{
+	struct lane_block *b   = &lanes->block;
+	struct sim        *sim = &lanes->scalar;
+	SIM_STOP stop;
+	uint     r;
+
+	for (r = 0; r < 8; ++r) sim->state.regs[r] = b->regs[r][l];
+	for (r = 0; r < 4; ++r) sim->state.sregs[r] = b->sregs[r][l];
+	sim->state.ip    = b->ip[l];
+	sim->state.flags = b->flags[l];
+	sim->steps       = b->steps[l];
+	sim->memory      = b->memory[l];
+	sim->dirty       = b->dirty[l];
+
+	stop = sim_step(sim);
+	if (stop != SIM_RUNNING) {
+		b->stop[l] = stop;
+		return;
+	}
+
+	lanes->scalar_steps++;
+
+	for (r = 0; r < 8; ++r) b->regs[r][l] = sim->state.regs[r];
+	for (r = 0; r < 4; ++r) b->sregs[r][l] = sim->state.sregs[r];
+	b->ip[l]    = sim->state.ip;
+	b->flags[l] = sim->state.flags;
+	b->steps[l] = sim->steps;
+
+	// a call far pushes two words below the one sim->write_addr has
+	if (sim->write_width && sim->write_addr + 4 > sim->code_start &&
+	    sim->write_addr < sim->code_end)
+		b->own_code[l] = 1;
+}
+
+// offset and segment of a memory operand in every lane
+static void lane_address(const struct lane_block *b, const Instruction *instruction,
+                         const Operand *op, uint16 *offset, const uint16 **segment)
+{
+	// ea_base forms as two registers, -1 for none
+	static const int8 base[EA_DIRECT + 1][2] = {
+		{ SIM_BX, SIM_SI }, { SIM_BX, SIM_DI }, { SIM_BP, SIM_SI }, { SIM_BP, SIM_DI },
+		{ SIM_SI, -1 },     { SIM_DI, -1 },     { SIM_BP, -1 },     { SIM_BX, -1 },
+		{ -1, -1 },
+	};
+	const uint16 *x = base[op->reg][0] < 0 ? zero : b->regs[(uint8)base[op->reg][0]];
+	const uint16 *y = base[op->reg][1] < 0 ? zero : b->regs[(uint8)base[op->reg][1]];
+	uint16 disp = (uint16)op->value;
+	uint8  sr   = base[op->reg][0] == SIM_BP ? SIM_SS : SIM_DS;
+	uint   l;
+
+	for (l = 0; l < LANES; ++l) offset[l] = x[l] + y[l] + disp;
+
+	if (instruction->structure.prefixes & PFX_SGMNT) sr = SGMNT_OP(instruction->structure.prefixes);
+	*segment = b->sregs[sr];
+}
+
+static void lane_read(const struct lane_block *b, const Instruction *instruction,
+                      const Operand *op, uint16 *out)
+{
+	const uint16 *segment;
+	uint16 offset[LANES];
+	uint   l;
+
+	switch (op->kind) {
+	case OPERAND_REG:
+		if (op->width == 2) {
+			memcpy(out, b->regs[op->reg], sizeof(b->regs[0]));
+		} else if (op->reg < 4) {
+			for (l = 0; l < LANES; ++l) out[l] = b->regs[op->reg][l] & 0xFF;
+		} else {
+			for (l = 0; l < LANES; ++l) out[l] = b->regs[op->reg - 4][l] >> 8;
+		}
+		break;
+	case OPERAND_SREG:
+		memcpy(out, b->sregs[op->reg], sizeof(b->sregs[0]));
+		break;
+	case OPERAND_IMM:
+		for (l = 0; l < LANES; ++l) out[l] = op->width == 2 ? (uint16)op->value : op->value & 0xFF;
+		break;
+	case OPERAND_MEM:
+		// every lane reads its own memory, the ones outside the group too:
+		// cheaper than a branch and nothing changes
+		lane_address(b, instruction, op, offset, &segment);
+		for (l = 0; l < LANES; ++l) {
+			out[l] = b->memory[l][linear(segment[l], offset[l])];
+			if (op->width == 2) out[l] |= b->memory[l][linear(segment[l], offset[l] + 1)] << 8;
+		}
+		break;
+	default:
+		memset(out, 0, LANES * sizeof(*out));
+		break;
+	}
+}
+
+static void mark_write(struct lane_block *b, uint l, uint32 address, uint32 code_start,
+                       uint32 code_end)
+{
+	uint32 page = address >> SIM_PAGE_SHIFT;
+
+	b->dirty[l][page / 32] |= 1u << (page % 32);
+	if (address >= code_start && address < code_end) b->own_code[l] = 1;
+}
+
+static void lane_write(struct lanes *lanes, const Instruction *instruction, const Operand *op,
+                       const uint16 *value, const uint16 *m)
+{
+	struct lane_block *b = &lanes->block;
+	const uint16 *segment;
+	uint16 offset[LANES], *reg;
+	uint32 at;
+	uint   l;
+
+	switch (op->kind) {
+	case OPERAND_REG:
+		if (op->width == 2) {
+			reg = b->regs[op->reg];
+			for (l = 0; l < LANES; ++l) reg[l] = BLEND(reg[l], value[l], m[l]);
+		} else if (op->reg < 4) {
+			reg = b->regs[op->reg];
+			for (l = 0; l < LANES; ++l)
+				reg[l] = BLEND(reg[l], (reg[l] & 0xFF00) | (value[l] & 0xFF), m[l]);
+		} else {
+			reg = b->regs[op->reg - 4];
+			for (l = 0; l < LANES; ++l)
+				reg[l] = BLEND(reg[l], (reg[l] & 0x00FF) | (value[l] & 0xFF) << 8, m[l]);
+		}
+		break;
+	case OPERAND_SREG:
+		reg = b->sregs[op->reg];
+		for (l = 0; l < LANES; ++l) reg[l] = BLEND(reg[l], value[l], m[l]);
+		break;
+	case OPERAND_MEM:
+		lane_address(b, instruction, op, offset, &segment);
+		for (l = 0; l < LANES; ++l) {
+			if (!m[l]) continue;
+
+			at = linear(segment[l], offset[l]);
+			b->memory[l][at] = value[l] & 0xFF;
+			mark_write(b, l, at, lanes->scalar.code_start, lanes->scalar.code_end);
+
+			if (op->width == 2) {
+				at = linear(segment[l], offset[l] + 1);
+				b->memory[l][at] = value[l] >> 8;
+				mark_write(b, l, at, lanes->scalar.code_start, lanes->scalar.code_end);
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// sign, zero and parity of a result, on top of the other flags in f
+static uint16 szp(uint16 f, uint16 r, uint8 width)
+{
+	uint16 sign = width == 2 ? 0x8000 : 0x80;
+	uint8  low  = r & 0xFF;
+
+	low ^= low >> 4;
+
+	f &= ~(SIM_SF | SIM_ZF | SIM_PF);
+	f |= (r & sign) ? SIM_SF : 0;
+	f |= r == 0 ? SIM_ZF : 0;
+	f |= (0x6996 >> (low & 0xF)) & 1 ? 0 : SIM_PF;
+	return f;
+}
+
+// sim.c's alu() in every lane at once; flags change only where m is set
+static void lane_alu(struct lane_block *b, TYPE type, const uint16 *a, const uint16 *v,
+                     uint16 *r, uint8 width, const uint16 *m)
+{
+	uint32 mask = width == 2 ? 0xFFFF : 0xFF;
+	uint32 sign = width == 2 ? 0x8000 : 0x80;
+	uint32 x, carry;
+	uint16 f[LANES];
+	int    with_carry = type == ADC || type == SBB;
+	uint   l;
+
+	switch (type) {
+	case ADD:
+	case ADC:
+		for (l = 0; l < LANES; ++l) {
+			carry = with_carry ? b->flags[l] & SIM_CF : 0;
+			x     = (uint32)a[l] + v[l] + carry;
+			f[l]  = (b->flags[l] & ~(SIM_CF | SIM_OF | SIM_AF)) |
+			        (x > mask ? SIM_CF : 0) |
+			        ((a[l] ^ x) & (v[l] ^ x) & sign ? SIM_OF : 0) |
+			        ((a[l] ^ v[l] ^ x) & 0x10 ? SIM_AF : 0);
+			r[l]  = x & mask;
+		}
+		break;
+	case SUB:
+	case SBB:
+	case CMP:
+		for (l = 0; l < LANES; ++l) {
+			carry = with_carry ? b->flags[l] & SIM_CF : 0;
+			x     = (uint32)a[l] - v[l] - carry;
+			f[l]  = (b->flags[l] & ~(SIM_CF | SIM_OF | SIM_AF)) |
+			        ((uint32)v[l] + carry > a[l] ? SIM_CF : 0) |
+			        ((a[l] ^ v[l]) & (a[l] ^ x) & sign ? SIM_OF : 0) |
+			        ((a[l] ^ v[l] ^ x) & 0x10 ? SIM_AF : 0);
+			r[l]  = x & mask;
+		}
+		break;
+	case AND:
+	case TEST:
+		for (l = 0; l < LANES; ++l) r[l] = a[l] & v[l] & mask;
+		goto logic;
+	case OR:
+		for (l = 0; l < LANES; ++l) r[l] = (a[l] | v[l]) & mask;
+		goto logic;
+	default: // XOR
+		for (l = 0; l < LANES; ++l) r[l] = (a[l] ^ v[l]) & mask;
+	logic:
+		for (l = 0; l < LANES; ++l) f[l] = b->flags[l] & ~(SIM_CF | SIM_OF | SIM_AF);
+		break;
+	}
+
+	for (l = 0; l < LANES; ++l) b->flags[l] = BLEND(b->flags[l], szp(f[l], r[l], width), m[l]);
+}
+
+static int lane_condition(uint16 f, TYPE type)
+{
+	int cf = !!(f & SIM_CF), zf = !!(f & SIM_ZF), sf = !!(f & SIM_SF);
+	int of = !!(f & SIM_OF), pf = !!(f & SIM_PF);
+
+	switch (type) {
+	case JO:  return of;
+	case JNO: return !of;
+	case JB:  return cf;
+	case JAE: return !cf;
+	case JE:  return zf;
+	case JNE: return !zf;
+	case JBE: return cf || zf;
+	case JA:  return !cf && !zf;
+	case JS:  return sf;
+	case JNS: return !sf;
+	case JP:  return pf;
+	case JPO: return !pf;
+	case JL:  return sf != of;
+	case JGE: return sf == of;
+	case JLE: return zf || sf != of;
+	case JG:  return !zf && sf == of;
+	default:  return 1;
+	}
+}
+
+// the instructions a whole group runs together; the rest go through sim_step
+static int lockstep(const Instruction *instruction, const Operand ops[2])
+{
+	if (ops[0].kind == OPERAND_REL || ops[0].kind == OPERAND_FAR) {
+		return instruction->structure.format == JMP_SHORT ||
+		       (instruction->structure.format == JMP_NEAR && instruction->structure.type == JMP);
+	}
+
+	switch (instruction->structure.type) {
+	case MOV: case ADD: case ADC: case SUB: case SBB: case AND: case OR: case XOR:
+	case CMP: case TEST: case INC: case DEC: case NEG: case NOT: case LEA:
+	case CLC: case STC: case CMC: case CLD: case STD: case NOP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// one instruction in every lane of m, which all have the same cs:ip
+static void step_group(struct lanes *lanes, const Instruction *instruction, const Operand ops[2],
+                       const uint16 *m)
+{
+	struct lane_block *b = &lanes->block;
+	const uint16 *segment;
+	TYPE   type  = instruction->structure.type;
+	uint16 a[LANES], v[LANES], r[LANES], taken[LANES], *cx = b->regs[SIM_CX];
+	uint16 next  = instruction->structure.size, disp = 0, bit;
+	uint8  width = ops[0].width;
+	uint   l;
+
+	memset(taken, 0, sizeof(taken));
+
+	switch (type) {
+	case MOV:
+		lane_read(b, instruction, ops + 1, v);
+		lane_write(lanes, instruction, ops, v, m);
+		break;
+	case ADD: case ADC: case SUB: case SBB: case AND: case OR: case XOR:
+		lane_read(b, instruction, ops, a);
+		lane_read(b, instruction, ops + 1, v);
+		lane_alu(b, type, a, v, r, width, m);
+		lane_write(lanes, instruction, ops, r, m);
+		break;
+	case CMP:
+	case TEST:
+		lane_read(b, instruction, ops, a);
+		lane_read(b, instruction, ops + 1, v);
+		lane_alu(b, type, a, v, r, width, m);
+		break;
+	case INC:
+	case DEC:
+		// cf is left alone
+		memcpy(v, b->flags, sizeof(v));
+		lane_read(b, instruction, ops, a);
+		for (l = 0; l < LANES; ++l) r[l] = 1;
+		lane_alu(b, type == INC ? ADD : SUB, a, r, r, width, m);
+		for (l = 0; l < LANES; ++l) b->flags[l] = (b->flags[l] & ~SIM_CF) | (v[l] & SIM_CF);
+		lane_write(lanes, instruction, ops, r, m);
+		break;
+	case NEG:
+		lane_read(b, instruction, ops, v);
+		lane_alu(b, SUB, zero, v, r, width, m);
+		lane_write(lanes, instruction, ops, r, m);
+		break;
+	case NOT:
+		lane_read(b, instruction, ops, a);
+		for (l = 0; l < LANES; ++l) r[l] = ~a[l];
+		lane_write(lanes, instruction, ops, r, m);
+		break;
+	case LEA:
+		lane_address(b, instruction, ops + 1, r, &segment);
+		lane_write(lanes, instruction, ops, r, m);
+		break;
+
+	case CLC: case STC: case CMC: case CLD: case STD:
+		bit = type == CLD || type == STD ? SIM_DF : SIM_CF;
+		for (l = 0; l < LANES; ++l) {
+			r[l] = type == CMC ? b->flags[l] ^ bit :
+			       type == STC || type == STD ? b->flags[l] | bit : b->flags[l] & ~bit;
+			b->flags[l] = BLEND(b->flags[l], r[l], m[l]);
+		}
+		break;
+	case NOP:
+		break;
+
+	case LOOP: case LOOPZ: case LOOPNZ:
+		for (l = 0; l < LANES; ++l) {
+			cx[l]    = BLEND(cx[l], (uint16)(cx[l] - 1), m[l]);
+			taken[l] = cx[l] != 0 &&
+			           (type == LOOP || !!(b->flags[l] & SIM_ZF) == (type == LOOPZ));
+		}
+		break;
+	case JCXZ:
+		for (l = 0; l < LANES; ++l) taken[l] = cx[l] == 0;
+		break;
+	default: // conditional jumps and jmp
+		for (l = 0; l < LANES; ++l) taken[l] = lane_condition(b->flags[l], type);
+		break;
+	}
+
+	if (instruction->structure.format == JMP_SHORT) disp = (int8)(instruction->data & 0xFF);
+	if (instruction->structure.format == JMP_NEAR)  disp = instruction->data;
+
+	for (l = 0; l < LANES; ++l) {
+		b->ip[l]     = BLEND(b->ip[l], (uint16)(b->ip[l] + next + (taken[l] ? disp : 0)), m[l]);
+		b->steps[l] += m[l] & 1;
+	}
+}
+
+// run one block of lanes until every lane has stopped
+static void run_block(struct lanes *lanes, uint64_t max_steps)
+{
+	struct lane_block *b = &lanes->block;
+	Instruction instruction;
+	Operand  ops[2];
+	uint32   pc[LANES], low;
+	uint16   m[LANES];
+	uint     l, first, group;
+
+	for (;;) {
+		// the lowest address any lane is at: lanes that branched apart meet
+		// again there
+		low = UINT32_MAX;
+		for (l = 0; l < LANES; ++l) {
+			pc[l] = b->stop[l] == SIM_RUNNING ? linear(b->sregs[SIM_CS][l], b->ip[l]) : UINT32_MAX;
+			if (pc[l] < low) low = pc[l];
+		}
+		if (low == UINT32_MAX) break;
+
+		first = LANES;
+		group = 0;
+		for (l = 0; l < LANES; ++l) {
+			if (pc[l] == low && b->steps[l] >= max_steps) {
+				b->stop[l] = SIM_STEPS;
+				pc[l]      = UINT32_MAX;
+			}
+
+			// a lane that rewrote its code can't share the decode
+			m[l] = pc[l] == low && !b->own_code[l] ? 0xFFFF : 0;
+			if (m[l] && first == LANES) first = l;
+			group += m[l] & 1;
+
+			if (pc[l] == low && b->own_code[l]) step_scalar(lanes, l);
+		}
+
+		if (group == 0) continue;
+
+		if (low >= lanes->scalar.code_start && low < lanes->scalar.code_end &&
+		    parse_instruction(&instruction, b->memory[first], SIM_MEMORY, low) >= 0 &&
+		    instruction.structure.type != UNKNOWN &&
+		    get_operands(&instruction, ops) >= 0 && lockstep(&instruction, ops)) {
+			step_group(lanes, &instruction, ops, m);
+			lanes->group_steps++;
+		} else {
+			for (l = 0; l < LANES; ++l) {
+				if (m[l]) step_scalar(lanes, l);
+			}
+		}
+	}
+}
+
+// the registers a lane starts from, sp is the same in every lane
+static const uint8 order[] = { SIM_AX, SIM_CX, SIM_DX, SIM_BX, SIM_BP, SIM_SI, SIM_DI };
+static const char *const start_names[] = { "ax", "cx", "dx", "bx", "bp", "si", "di" };
+
+static void report_lane(FILE *out, const struct lane_block *b, uint l, uint index)
+{
+	char flags[16];
+	uint i;
+
+	fprintf(out, "%6u ", index);
+	for (i = 0; i < sizeof(order); ++i) fprintf(out, " %04x", b->initial[order[i]][l]);
+
+	fputs("  ->", out);
+	for (i = 0; i < 8; ++i) fprintf(out, " %04x", b->regs[i][l]);
+
+	if (!sim_flag_names(flags, b->flags[l])) strcpy(flags, "-");
+	fprintf(out, "  %04x  %-9s %10llu  %s\n", b->ip[l], flags, (unsigned long long)b->steps[l],
+	        sim_stop_name(b->stop[l]));
+}
+
+int lanes_run(FILE *out, struct lanes *lanes, const struct image *image, uint count,
+              uint64_t seed, uint64_t max_steps, struct simulation *totals)
+{
+	struct lane_block *b = &lanes->block;
+	uint64_t state, bits;
+	uint     start, l, r, n, stopped = 0;
+
+	lanes->steps = lanes->group_steps = lanes->scalar_steps = 0;
+	memset(lanes->stops, 0, sizeof(lanes->stops));
+
+	fprintf(out, "%6s ", "lane");
+	for (r = 0; r < 7; ++r) fprintf(out, " %4s", start_names[r]);
+	fputs("    ", out);
+	for (r = 0; r < 8; ++r) fprintf(out, " %4s", get_register_name(1, r));
+	fprintf(out, "  %4s  %-9s %10s  %s\n", "ip", "flags", "steps", "stop");
+
+	for (start = 0; start < count; start += LANES) {
+		n = count - start < LANES ? count - start : LANES;
+
+		for (l = 0; l < LANES; ++l) {
+			if (l >= n) {
+				b->stop[l] = SIM_END;
+				continue;
+			}
+
+			load_lane(lanes, l, image);
+
+			// lane 0 keeps the plain --sim start
+			state = seed ^ (uint64_t)(start + l) * 0xD1B54A32D192ED03ull;
+			for (r = 0; r < 8; ++r) {
+				bits = splitmix(&state);
+				if (start + l != 0 && r != SIM_SP) b->regs[r][l] = (uint16)bits;
+				b->initial[r][l] = b->regs[r][l];
+			}
+		}
+
+		run_block(lanes, max_steps);
+
+		for (l = 0; l < n; ++l) {
+			report_lane(out, b, l, start + l);
+
+			lanes->steps += b->steps[l];
+			lanes->stops[b->stop[l]]++;
+			stopped += sim_stopped_early(b->stop[l]);
+		}
+	}
+
+	fprintf(out, "; %u lanes, %llu instructions: %llu run in lockstep groups of %.1f lanes, "
+	        "%llu one lane at a time\n", count, (unsigned long long)lanes->steps,
+	        (unsigned long long)(lanes->steps - lanes->scalar_steps),
+	        lanes->group_steps ? (double)(lanes->steps - lanes->scalar_steps) / lanes->group_steps : 0.0,
+	        (unsigned long long)lanes->scalar_steps);
+
+	fputs("; stops:", out);
+	for (r = 0; r <= SIM_STEPS; ++r) {
+		if (lanes->stops[r]) fprintf(out, " %s %llu", sim_stop_name(r), (unsigned long long)lanes->stops[r]);
+	}
+	fputc('\n', out);
+
+	totals->files++;
+	totals->steps   += lanes->steps;
+	totals->stopped += stopped;
+	return 0;
+}
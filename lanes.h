@@ -0,0 +1,59 @@
+#if !defined LANES_H
+#define LANES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "sim.h"
+
+// instances stepped together: sixteen 16-bit registers, two 128-bit SSE2 vectors
+#define LANES 16
+
+// --lanes upper bound
+#define LANES_MAX 16384
+
+// summary lines, then one line per lane
+#define LANES_REPORT_SIZE(count) (1024 + (size_t)(count) * 112)
+
+// LANES instances of one program, each register one array across the lanes
+// so the lockstep ops compile to vector code
+struct lane_block
+{
+	uint16   regs[8][LANES];
+	uint16   sregs[4][LANES];
+	uint16   ip[LANES];
+	uint16   flags[LANES];
+	uint16   initial[8][LANES]; // registers the lane started from
+
+	uint64_t steps[LANES];
+	uint8    stop[LANES];       // SIM_STOP, SIM_RUNNING while the lane runs
+	uint8    own_code[LANES];   // wrote into its image: decoded on its own from then on
+
+	uint8   *memory[LANES];     // 1M each
+	uint32   dirty[LANES][SIM_PAGES / 32];
+};
+
+struct lanes
+{
+	struct lane_block block;
+	struct sim        scalar;   // runs what the lockstep ops don't cover, one lane at a time
+
+	uint64_t steps;             // instructions over every lane
+	uint64_t group_steps;       // instructions decoded for a group of lanes
+	uint64_t scalar_steps;      // lane instructions the scalar simulator ran
+	uint64_t stops[SIM_STEPS + 1];
+};
+
+extern int  lanes_init(struct lanes *lanes);
+extern void lanes_free(struct lanes *lanes);
+
+// run `count` instances of image, LANES at a time, and report every lane's
+// registers. Lane 0 starts like --sim; the others get random ax cx dx bx bp
+// si di from seed. A group is the lanes at the lowest cs:ip: it runs one
+// instruction together, so lanes split off on branches and merge again when
+// they reach the same address.
+extern int  lanes_run(FILE *out, struct lanes *lanes, const struct image *image, uint count,
+                      uint64_t seed, uint64_t max_steps, struct simulation *totals);
+
+#endif // LANES_H
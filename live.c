@@ -0,0 +1,719 @@
+#include <assert.h>
+#include <string.h>
+
+#include "live.h"
+
+enum {
+	FLOW_NEXT,   // falls through to the next record
+	FLOW_BRANCH, // its target or the next record
+	FLOW_JUMP,   // its target only
+	FLOW_EXIT,   // somewhere we can't follow: ret, indirect and far jumps
+};
+
+static const uint16 byte_regs[8] = {
+	LIVE_AL, LIVE_CL, LIVE_DL, LIVE_BL, LIVE_AH, LIVE_CH, LIVE_DH, LIVE_BH,
+};
+
+static const uint16 word_regs[8] = {
+	LIVE_AX, LIVE_CX, LIVE_DX, LIVE_BX, LIVE_SP, LIVE_BP, LIVE_SI, LIVE_DI,
+};
+
+// es cs ss ds, cs has no bit
+static const uint16 segment_regs[4] = { LIVE_ES, 0, LIVE_SS, LIVE_DS };
+
+// base and index registers of each r/m encoding
+static const uint16 ea_regs[8] = {
+	LIVE_BX | LIVE_SI, LIVE_BX | LIVE_DI, LIVE_BP | LIVE_SI, LIVE_BP | LIVE_DI,
+	LIVE_SI,           LIVE_DI,           LIVE_BP,           LIVE_BX,
+};
+
+static const char *const names[16] = {
+	"al", "ah", "cl", "ch", "dl", "dh", "bl", "bh",
+	"sp", "bp", "si", "di", "es", "ss", "ds", "flags",
+};
+
+static const char *const word_names[4] = { "ax", "cx", "dx", "bx" };
+
+void live_init_buf(struct live *live, uint count, void *buf)
+{
+	uint *words;
+
+	memset(live, 0, sizeof(*live));
+	live->count  = count;
+	live->blocks = buf;
+
+	words = (uint *)(live->blocks + count);
+	live->block_of   = words;
+	live->pred_first = words + count;
+	live->preds      = words + count * 2 + 1;
+	live->work       = words + count * 4 + 1;
+
+	live->use  = (uint16 *)(words + count * 5 + 1);
+	live->def  = live->use + count;
+	live->out  = live->def + count;
+	live->flags = (uint8 *)(live->out + count);
+}
+
+// segment register a memory operand goes through
+static uint16 ea_segment(const Instruction *instruction, const Operand *op)
+{
+	if (instruction->structure.prefixes & PFX_SGMNT)
+		return segment_regs[SGMNT_OP(instruction->structure.prefixes)];
+
+	// bp-based forms default to ss
+	if (op->reg == 2 || op->reg == 3 || op->reg == 6) return LIVE_SS;
+	return LIVE_DS;
+}
+
+// registers reading the operand needs
+static uint16 operand_use(const Instruction *instruction, const Operand *op)
+{
+	switch (op->kind) {
+	case OPERAND_REG:  return op->width == 2 ? word_regs[op->reg & 7] : byte_regs[op->reg & 7];
+	case OPERAND_SREG: return segment_regs[op->reg & 3];
+	case OPERAND_MEM:
+		return (op->reg == EA_DIRECT ? 0 : ea_regs[op->reg & 7]) | ea_segment(instruction, op);
+	default:           return 0;
+	}
+}
+
+// registers writing the operand defines; memory only needs its address
+static uint16 operand_def(const Operand *op)
+{
+	switch (op->kind) {
+	case OPERAND_REG:  return op->width == 2 ? word_regs[op->reg & 7] : byte_regs[op->reg & 7];
+	case OPERAND_SREG: return segment_regs[op->reg & 3];
+	default:           return 0;
+	}
+}
+
+static uint16 operand_address(const Instruction *instruction, const Operand *op)
+{
+	return op->kind == OPERAND_MEM ? operand_use(instruction, op) : 0;
+}
+
+int live_effects(Instruction *instruction, uint16 *use, uint16 *def)
+{
+	Operand ops[2];
+	const Operand *dst = ops, *src = ops + 1;
+	TYPE   type = instruction->structure.type;
+	uint16 acc, seg;
+	int    wide, pure = 1;
+
+	get_operands(instruction, ops);
+
+	*use = *def = 0;
+	wide = W(instruction->structure.flags);
+
+	switch (type) {
+	case ADD:
+	case OR:
+	case AND:
+	case SUB:
+	case XOR:
+	case ADC:
+	case SBB:
+		*use = operand_use(instruction, dst) | operand_use(instruction, src);
+		*def = operand_def(dst) | LIVE_FLAGS;
+
+		// xor r, r and sub r, r don't depend on r
+		if ((type == XOR || type == SUB) && dst->kind == OPERAND_REG && src->kind == OPERAND_REG &&
+		    dst->reg == src->reg && dst->width == src->width)
+			*use = 0;
+
+		if (type == ADC || type == SBB) *use |= LIVE_FLAGS;
+		break;
+	case CMP:
+	case TEST:
+		*use = operand_use(instruction, dst) | operand_use(instruction, src);
+		*def = LIVE_FLAGS;
+		break;
+	case MOV:
+		*use = operand_address(instruction, dst) | operand_use(instruction, src);
+		*def = operand_def(dst);
+		break;
+	case LEA:
+		// only the address, no segment and no memory read
+		*use = src->reg == EA_DIRECT ? 0 : ea_regs[src->reg & 7];
+		*def = operand_def(dst);
+		break;
+	case LDS:
+	case LES:
+		*use = operand_use(instruction, src);
+		*def = operand_def(dst) | (type == LDS ? LIVE_DS : LIVE_ES);
+		break;
+	case XCHG:
+		*use = operand_use(instruction, dst) | operand_use(instruction, src);
+		*def = operand_def(dst) | operand_def(src);
+		break;
+	case INC:
+	case DEC:
+		// carry passes through, so the flags are only partly written
+		*use = operand_use(instruction, dst) | LIVE_FLAGS;
+		*def = operand_def(dst) | LIVE_FLAGS;
+		break;
+	case NEG:
+		*use = operand_use(instruction, dst);
+		*def = operand_def(dst) | LIVE_FLAGS;
+		break;
+	case NOT:
+		*use = operand_use(instruction, dst);
+		*def = operand_def(dst);
+		break;
+	case ROL:
+	case ROR:
+	case RCL:
+	case RCR:
+	case SHL:
+	case SHR:
+	case SAR:
+		*use = operand_use(instruction, dst) | operand_use(instruction, src);
+		*def = operand_def(dst) | LIVE_FLAGS;
+
+		// a zero count in cl leaves the flags alone, rcl/rcr shift carry in
+		if (src->kind == OPERAND_REG || type == RCL || type == RCR) *use |= LIVE_FLAGS;
+		break;
+	case MUL:
+	case IMUL:
+		*use = operand_use(instruction, dst) | (wide ? LIVE_AX : LIVE_AL);
+		*def = LIVE_AX | (wide ? LIVE_DX : 0) | LIVE_FLAGS;
+		break;
+	case DIV:
+	case IDIV:
+		// divide overflow traps
+		*use = operand_use(instruction, dst) | LIVE_AX | (wide ? LIVE_DX : 0);
+		*def = LIVE_AX | (wide ? LIVE_DX : 0) | LIVE_FLAGS;
+		pure = 0;
+		break;
+	case CBW:
+		*use = LIVE_AL;
+		*def = LIVE_AH;
+		break;
+	case CWD:
+		*use = LIVE_AX;
+		*def = LIVE_DX;
+		break;
+	case AAA:
+	case AAS:
+		*use = LIVE_AX | LIVE_FLAGS;
+		*def = LIVE_AX | LIVE_FLAGS;
+		break;
+	case DAA:
+	case DAS:
+		*use = LIVE_AL | LIVE_FLAGS;
+		*def = LIVE_AL | LIVE_FLAGS;
+		break;
+	case AAM:
+		// aam 0 traps
+		*use = LIVE_AL;
+		*def = LIVE_AX | LIVE_FLAGS;
+		pure = 0;
+		break;
+	case AAD:
+		*use = LIVE_AX;
+		*def = LIVE_AX | LIVE_FLAGS;
+		break;
+	case MOVSB:
+	case MOVSW:
+	case CMPSB:
+	case CMPSW:
+	case LODSB:
+	case LODSW:
+	case STOSB:
+	case STOSW:
+	case SCASB:
+	case SCASW:
+		acc = (type == LODSW || type == STOSW || type == SCASW) ? LIVE_AX : LIVE_AL;
+		seg = (instruction->structure.prefixes & PFX_SGMNT) ?
+		      segment_regs[SGMNT_OP(instruction->structure.prefixes)] : LIVE_DS;
+
+		// every string op steps by the direction flag
+		*use = LIVE_FLAGS;
+		switch (type) {
+		case MOVSB:
+		case MOVSW:
+			*use |= LIVE_SI | LIVE_DI | LIVE_ES | seg;
+			*def  = LIVE_SI | LIVE_DI;
+			pure  = 0;
+			break;
+		case CMPSB:
+		case CMPSW:
+			*use |= LIVE_SI | LIVE_DI | LIVE_ES | seg;
+			*def  = LIVE_SI | LIVE_DI | LIVE_FLAGS;
+			break;
+		case LODSB:
+		case LODSW:
+			*use |= LIVE_SI | seg;
+			*def  = LIVE_SI | acc;
+			break;
+		case STOSB:
+		case STOSW:
+			*use |= LIVE_DI | LIVE_ES | acc;
+			*def  = LIVE_DI;
+			pure  = 0;
+			break;
+		default:
+			*use |= LIVE_DI | LIVE_ES | acc;
+			*def  = LIVE_DI | LIVE_FLAGS;
+			break;
+		}
+
+		if (instruction->structure.prefixes & (PFX_REP | PFX_REPNE)) {
+			*use |= LIVE_CX;
+			*def |= LIVE_CX;
+		}
+		break;
+	case XLAT:
+		*use = LIVE_BX | LIVE_AL |
+		       ((instruction->structure.prefixes & PFX_SGMNT) ?
+		        segment_regs[SGMNT_OP(instruction->structure.prefixes)] : LIVE_DS);
+		*def = LIVE_AL;
+		break;
+	case LAHF:
+		*use = LIVE_FLAGS;
+		*def = LIVE_AH;
+		break;
+	case SAHF:
+		// overflow isn't in ah
+		*use = LIVE_AH | LIVE_FLAGS;
+		*def = LIVE_FLAGS;
+		break;
+	case CLC:
+	case STC:
+	case CMC:
+	case CLD:
+	case STD:
+		*use = LIVE_FLAGS;
+		*def = LIVE_FLAGS;
+		break;
+	case CLI:
+	case STI:
+		*use = LIVE_FLAGS;
+		*def = LIVE_FLAGS;
+		pure = 0;
+		break;
+	case PUSH:
+		*use = operand_use(instruction, dst) | LIVE_SP | LIVE_SS;
+		*def = LIVE_SP;
+		pure = 0;
+		break;
+	case POP:
+		*use = operand_address(instruction, dst) | LIVE_SP | LIVE_SS;
+		*def = operand_def(dst) | LIVE_SP;
+		pure = 0;
+		break;
+	case PUSHF:
+		*use = LIVE_FLAGS | LIVE_SP | LIVE_SS;
+		*def = LIVE_SP;
+		pure = 0;
+		break;
+	case POPF:
+		*use = LIVE_SP | LIVE_SS;
+		*def = LIVE_FLAGS | LIVE_SP;
+		pure = 0;
+		break;
+	case IN:
+		*use = operand_use(instruction, src);
+		*def = operand_def(dst);
+		pure = 0;
+		break;
+	case OUT:
+		*use = operand_use(instruction, dst) | operand_use(instruction, src);
+		pure = 0;
+		break;
+	case JA:  case JAE: case JB:  case JBE: case JE:  case JG:  case JGE:
+	case JL:  case JLE: case JNE: case JNO: case JNS: case JO:  case JP:
+	case JPO: case JS:
+		*use = LIVE_FLAGS;
+		pure = 0;
+		break;
+	case JCXZ:
+		*use = LIVE_CX;
+		pure = 0;
+		break;
+	case LOOP:
+	case LOOPZ:
+	case LOOPNZ:
+		*use = LIVE_CX | (type == LOOP ? 0 : LIVE_FLAGS);
+		*def = LIVE_CX;
+		pure = 0;
+		break;
+	case JMP:
+	case JMPF:
+		*use = operand_use(instruction, dst);
+		pure = 0;
+		break;
+	case NOP:
+	case HLT:
+	case WAIT:
+	case LOCK:
+	case REP:
+	case REPNE:
+	case SGMNT:
+		pure = 0;
+		break;
+	default:
+		// calls, returns, interrupts, esc and whatever didn't decode may read anything
+		*use = LIVE_ALL;
+		pure = 0;
+		break;
+	}
+
+	// stores, locked or not, and cs writes (a jump) are never dead
+	if (instruction->structure.prefixes & PFX_LOCK) pure = 0;
+	if (ops[0].kind == OPERAND_MEM && type != CMP && type != TEST && type != PUSH) pure = 0;
+	if (ops[1].kind == OPERAND_MEM && type == XCHG) pure = 0;
+	if (ops[0].kind == OPERAND_SREG && ops[0].reg == 1 && type != PUSH) pure = 0;
+
+	return pure;
+}
+
+static int flow(const Instruction *instruction)
+{
+	TYPE type = instruction->structure.type;
+
+	switch (instruction->structure.format) {
+	case JMP_SHORT:
+		return type == JMP ? FLOW_JUMP : FLOW_BRANCH;
+	case JMP_NEAR:
+		return type == JMP ? FLOW_JUMP : FLOW_NEXT;
+	case JMP_FAR:
+		return type == CALL ? FLOW_NEXT : FLOW_EXIT;
+	default:
+		break;
+	}
+
+	switch (type) {
+	case RET:
+	case RETF:
+	case IRET:
+	case JMP:
+	case JMPF:
+		return FLOW_EXIT;
+	case MOV:
+		// mov cs, r/m
+		if (instruction->structure.format == RM_SR && (instruction->structure.flags & MASK_D) &&
+		    SR_OP(instruction->structure.flags) == 1)
+			return FLOW_EXIT;
+		return FLOW_NEXT;
+	default:
+		return FLOW_NEXT;
+	}
+}
+
+// record starting at `offset`, -1 when the target is mid-record or outside
+static int find_record(const Instruction *instructions, uint count, int offset)
+{
+	uint lo = 0, hi = count;
+
+	if (offset < 0) return -1;
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+
+		if (instructions[mid].offset < (uint)offset) lo = mid + 1;
+		else                                         hi = mid;
+	}
+
+	return lo < count && instructions[lo].offset == (uint)offset ? (int)lo : -1;
+}
+
+int live_constant(Instruction *instruction, uint *reg, uint16 *value)
+{
+	Operand ops[2];
+	TYPE    type = instruction->structure.type;
+
+	if (get_operands(instruction, ops) != 2 || ops[0].kind != OPERAND_REG || ops[0].width != 2)
+		return 0;
+
+	if ((type == XOR || type == SUB) && ops[1].kind == OPERAND_REG && ops[1].reg == ops[0].reg &&
+	    ops[1].width == 2) {
+		*value = 0;
+	} else if (type == MOV && ops[1].kind == OPERAND_IMM) {
+		*value = ops[1].value;
+	} else {
+		return 0;
+	}
+
+	*reg = ops[0].reg & 7;
+	return 1;
+}
+
+static void push_block(struct live *live, uint *top, uint b)
+{
+	if (live->blocks[b].queued) return;
+
+	live->blocks[b].queued = 1;
+	live->work[(*top)++]   = b;
+}
+
+void live_solve(struct live *live, Instruction *instructions, uint count)
+{
+	struct live_block *block;
+	uint   i, b, n, p, r, top = 0;
+	int    target, kind, s;
+	uint16 in, out, v, value[8];
+	uint8  known;
+
+	assert(count <= live->count);
+	live->count = count;
+	if (count == 0) return;
+
+	// leaders: the first record, branch and call targets and whatever follows
+	// a branch; block_of holds 1 for a leader (3 for a call target) until the
+	// blocks are numbered
+	memset(live->block_of, 0, (size_t)count * sizeof(uint));
+	live->block_of[0] = 1;
+
+	for (i = 0; i < count; ++i) {
+		live->flags[i] = live_effects(instructions + i, live->use + i, live->def + i) ? LIVE_PURE : 0;
+
+		if (instructions[i].structure.type == CALL && instructions[i].structure.format == JMP_NEAR) {
+			target = find_record(instructions, count, get_jmp_offset(instructions + i));
+			if (target >= 0) live->block_of[target] = 3;
+		}
+
+		kind = flow(instructions + i);
+		if (kind == FLOW_NEXT) continue;
+
+		if (i + 1 < count) live->block_of[i + 1] = 1;
+		if (kind == FLOW_EXIT) continue;
+
+		target = find_record(instructions, count, get_jmp_offset(instructions + i));
+		if (target >= 0) live->block_of[target] |= 1;
+	}
+
+	for (i = 0, n = 0; i < count; ++i) {
+		if (live->block_of[i]) {
+			if (n) live->blocks[n - 1].last = i - 1;
+			live->blocks[n].first = i;
+			live->blocks[n].entry = live->block_of[i] >> 1;
+			n++;
+		}
+
+		live->block_of[i] = n - 1;
+	}
+
+	live->blocks[n - 1].last = count - 1;
+	live->block_count = n;
+
+	// successors, block use/def from the back, and predecessor counts
+	memset(live->pred_first, 0, ((size_t)n + 1) * sizeof(uint));
+
+	for (b = 0; b < n; ++b) {
+		block = live->blocks + b;
+		block->succ[0] = block->succ[1] = LIVE_NONE;
+		block->use = block->def = block->in = block->out = 0;
+		block->queued = 0;
+
+		for (i = block->last + 1; i-- > block->first;) {
+			block->use = live->use[i] | (block->use & ~live->def[i]);
+			block->def |= live->def[i];
+		}
+
+		kind = flow(instructions + block->last);
+		if (kind == FLOW_EXIT) {
+			block->succ[0] = LIVE_EXIT;
+			continue;
+		}
+
+		// falling off the end of the image, anything may be read after it
+		if (kind != FLOW_JUMP)
+			block->succ[0] = b + 1 < n ? (int)b + 1 : LIVE_EXIT;
+
+		if (kind == FLOW_JUMP || kind == FLOW_BRANCH) {
+			target = find_record(instructions, count, get_jmp_offset(instructions + block->last));
+			block->succ[1] = target >= 0 ? (int)live->block_of[target] : LIVE_EXIT;
+		}
+
+		for (s = 0; s < 2; ++s)
+			if (block->succ[s] >= 0) live->pred_first[block->succ[s]]++;
+	}
+
+	// counts to row starts, then fill; same layout as the xref index
+	for (b = 0, i = 0; b <= n; ++b) {
+		uint tmp = live->pred_first[b];
+		live->pred_first[b] = i;
+		i += tmp;
+	}
+
+	for (b = 0; b < n; ++b) {
+		for (s = 0; s < 2; ++s) {
+			target = live->blocks[b].succ[s];
+			if (target >= 0) live->preds[live->pred_first[target]++] = b;
+		}
+	}
+
+	memmove(live->pred_first + 1, live->pred_first, (size_t)n * sizeof(uint));
+	live->pred_first[0] = 0;
+
+	// backwards problem, so start from the last block; in only ever gains
+	// bits, which bounds the work at 16 updates per block
+	for (b = 0; b < n; ++b) push_block(live, &top, b);
+
+	while (top) {
+		b     = live->work[--top];
+		block = live->blocks + b;
+		block->queued = 0;
+
+		out = 0;
+		for (s = 0; s < 2; ++s) {
+			if (block->succ[s] == LIVE_EXIT) out |= LIVE_ALL;
+			else if (block->succ[s] >= 0)    out |= live->blocks[block->succ[s]].in;
+		}
+
+		in = block->use | (out & ~block->def);
+		block->out = out;
+		if (in == block->in) continue;
+
+		block->in = in;
+		for (i = live->pred_first[b]; i < live->pred_first[b + 1]; ++i)
+			push_block(live, &top, live->preds[i]);
+	}
+
+	// live after each record, walking every block back from its exit
+	for (b = 0; b < n; ++b) {
+		block = live->blocks + b;
+		out   = block->out;
+
+		for (i = block->last + 1; i-- > block->first;) {
+			live->out[i] = out;
+			out = live->use[i] | (out & ~live->def[i]);
+		}
+	}
+
+	// constants in ax..di, met over the predecessors already visited; a back
+	// edge or a call into the block leaves nothing known on entry
+	for (b = 0; b < n; ++b) {
+		block = live->blocks + b;
+		known = 0;
+
+		if (b > 0 && !block->entry && live->pred_first[b] < live->pred_first[b + 1]) {
+			p = live->preds[live->pred_first[b]];
+			if (p < b) {
+				known = live->blocks[p].known;
+				memcpy(value, live->blocks[p].value, sizeof(value));
+			}
+
+			for (i = live->pred_first[b] + 1; i < live->pred_first[b + 1] && known; ++i) {
+				p = live->preds[i];
+				if (p >= b) {
+					known = 0;
+					break;
+				}
+
+				known &= live->blocks[p].known;
+				for (r = 0; r < 8; ++r)
+					if (value[r] != live->blocks[p].value[r]) known &= ~(1u << r);
+			}
+		}
+
+		for (i = block->first; i <= block->last; ++i) {
+			if (live_constant(instructions + i, &r, &v)) {
+				// the flags it sets still count if anyone reads them
+				if ((known & (1u << r)) && value[r] == v && !(live->def[i] & live->out[i] & LIVE_FLAGS))
+					live->flags[i] |= LIVE_REDUNDANT;
+
+				known   |= 1u << r;
+				value[r] = v;
+				continue;
+			}
+
+			// calls and interrupts may change any register
+			if (live->use[i] == LIVE_ALL) known = 0;
+
+			for (r = 0; r < 8; ++r)
+				if (live->def[i] & word_regs[r]) known &= ~(1u << r);
+		}
+
+		block->known = known;
+		memcpy(block->value, value, sizeof(value));
+	}
+}
+
+uint16 live_dead(const struct live *live, uint index)
+{
+	if (!(live->flags[index] & LIVE_PURE) || live->def[index] == 0) return 0;
+	if (live->def[index] & live->out[index]) return 0;
+
+	return live->def[index];
+}
+
+int live_names(char *buf, uint16 mask)
+{
+	uint i;
+	int  len = 0;
+
+	for (i = 0; i < 16; ++i) {
+		if (!(mask & (1u << i))) continue;
+
+		// both halves of ax..bx print as the word register
+		if (i < 8 && !(i & 1) && (mask & (2u << i))) {
+			len += sprintf(buf + len, "%s%s", len ? " " : "", word_names[i / 2]);
+			++i;
+			continue;
+		}
+
+		len += sprintf(buf + len, "%s%s", len ? " " : "", names[i]);
+	}
+
+	return len;
+}
+
+void live_report(FILE *out, const struct live *live, Instruction *instructions,
+                 struct liveness *totals)
+{
+	Instruction unlabeled;
+	char   regs[64];
+	uint   i, reg, dead = 0, redundant = 0;
+	uint16 mask, value;
+
+	for (i = 0; i < live->count; ++i) {
+		mask = live_dead(live, i);
+		if (!mask && !(live->flags[i] & LIVE_REDUNDANT)) continue;
+
+		unlabeled = instructions[i];
+		unlabeled.structure.flags &= ~MASK_LB;
+
+		fprintf(out, "0x%04X  ", instructions[i].offset);
+		decode_instruction(out, &unlabeled);
+
+		if (mask) {
+			live_names(regs, mask);
+			fprintf(out, " ; dead %s\n", regs);
+			dead++;
+		} else {
+			live_constant(instructions + i, &reg, &value);
+			live_names(regs, word_regs[reg]);
+			fprintf(out, " ; redundant, %s is already %u\n", regs, value);
+			redundant++;
+		}
+	}
+
+	fprintf(out, "; %u dead writes, %u redundant loads in %u instructions, %u blocks\n", dead,
+	        redundant, live->count, live->block_count);
+
+	totals->files++;
+	totals->instructions += live->count;
+	totals->blocks       += live->block_count;
+	totals->dead         += dead;
+	totals->redundant    += redundant;
+}
+
+void live_merge(struct liveness *into, const struct liveness *from)
+{
+	into->files        += from->files;
+	into->instructions += from->instructions;
+	into->blocks       += from->blocks;
+	into->dead         += from->dead;
+	into->redundant    += from->redundant;
+}
+
+void live_print(FILE *out, const struct liveness *totals)
+{
+	fprintf(out, "liveness: %llu dead writes, %llu redundant loads in %llu instructions, "
+	        "%llu blocks, %llu files\n",
+	        (unsigned long long)totals->dead, (unsigned long long)totals->redundant,
+	        (unsigned long long)totals->instructions,
+	        (unsigned long long)totals->blocks, (unsigned long long)totals->files);
+}
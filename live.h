@@ -0,0 +1,116 @@
+#if !defined LIVE_H
+#define LIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// one bit per register byte, so al/ah writes don't kill each other; cs has
+// no bit, nothing a listing decodes can write it
+#define LIVE_AL    (1u << 0)
+#define LIVE_AH    (1u << 1)
+#define LIVE_CL    (1u << 2)
+#define LIVE_CH    (1u << 3)
+#define LIVE_DL    (1u << 4)
+#define LIVE_DH    (1u << 5)
+#define LIVE_BL    (1u << 6)
+#define LIVE_BH    (1u << 7)
+#define LIVE_SP    (1u << 8)
+#define LIVE_BP    (1u << 9)
+#define LIVE_SI    (1u << 10)
+#define LIVE_DI    (1u << 11)
+#define LIVE_ES    (1u << 12)
+#define LIVE_SS    (1u << 13)
+#define LIVE_DS    (1u << 14)
+#define LIVE_FLAGS (1u << 15)
+
+#define LIVE_AX    (LIVE_AL | LIVE_AH)
+#define LIVE_CX    (LIVE_CL | LIVE_CH)
+#define LIVE_DX    (LIVE_DL | LIVE_DH)
+#define LIVE_BX    (LIVE_BL | LIVE_BH)
+#define LIVE_ALL   0xFFFFu
+
+// "; dead ax bx cx dx sp bp si di es ss ds flags" and the record in front of it
+#define LIVE_LINE  (16 + DECODE_MAX_LINE + 48)
+
+// per-record flags
+#define LIVE_PURE      0x1 // only writes registers and flags
+#define LIVE_REDUNDANT 0x2 // loads a constant the register already holds
+
+struct live_block
+{
+	uint   first;    // record range [first, last]
+	uint   last;
+	int    succ[2];  // block index, LIVE_EXIT or LIVE_NONE
+	uint16 use;      // read before any write in the block
+	uint16 def;
+	uint16 in;
+	uint16 out;
+	uint8  queued;
+	uint8  entry;    // a call lands here, nothing is known on entry
+	uint8  known;    // word registers (ax..di) holding value[] on exit
+	uint16 value[8];
+};
+
+// successor of a block that leaves the analysed code: everything is live there
+#define LIVE_EXIT -1
+#define LIVE_NONE -2
+
+struct live
+{
+	uint    count;       // records
+	uint16 *use;         // per record
+	uint16 *def;
+	uint16 *out;         // live right after each record
+	uint8  *flags;       // LIVE_PURE, LIVE_REDUNDANT
+	uint   *block_of;
+
+	uint               block_count;
+	struct live_block *blocks;
+
+	uint   *pred_first;  // predecessors of block b are preds[pred_first[b] .. pred_first[b + 1])
+	uint   *preds;
+	uint   *work;
+};
+
+// totals over every file, flat so per-thread copies merge with a straight add
+struct liveness
+{
+	uint64_t files;
+	uint64_t instructions;
+	uint64_t blocks;
+	uint64_t dead;
+	uint64_t redundant;
+};
+
+// buffer live_init_buf needs for `count` records
+#define LIVE_BUF_SIZE(count) ((size_t)(count) * (3 * sizeof(uint16) + 1 + sizeof(struct live_block) + \
+                                                 5 * sizeof(uint)) + sizeof(uint))
+
+extern void live_init_buf(struct live *live, uint count, void *buf);
+
+// registers a record reads and writes; 1 when writing registers and flags is
+// all it does, so it can be dropped if nothing reads them
+extern int live_effects(Instruction *instruction, uint16 *use, uint16 *def);
+
+// mov r16, imm and the xor/sub r16, r16 idiom: 1 with the register (0..7)
+// and the value it loads
+extern int live_constant(Instruction *instruction, uint *reg, uint16 *value);
+
+// basic blocks and live registers after every record, to a fixed point, then
+// one forward pass for constants loaded twice
+extern void live_solve(struct live *live, Instruction *instructions, uint count);
+// registers a record writes that nobody reads, 0 unless that's all it writes
+extern uint16 live_dead(const struct live *live, uint index);
+// register names in `mask`, space separated; returns the length
+extern int live_names(char *buf, uint16 mask);
+
+// one line per dead write or redundant load, then a summary; counts into totals
+extern void live_report(FILE *out, const struct live *live, Instruction *instructions,
+                        struct liveness *totals);
+extern void live_merge(struct liveness *into, const struct liveness *from);
+extern void live_print(FILE *out, const struct liveness *totals);
+
+#endif // LIVE_H
@@ -0,0 +1,373 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "boundary.h"
+#include "decode.h"
+#include "format.h"
+#include "lanes.h"
+#include "profile.h"
+#include "serve.h"
+#include "stats.h"
+#include "stream.h"
+#include "sweep.h"
+#include "trace.h"
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+            "Usage: decode [options] <filename|dir|->...\n"
+            "  -j, --jobs <n>   decode files on <n> threads (default: all cores)\n"
+            "  -s, --stream     decode stdin (or one file) as a stream in constant memory\n"
+            "      --format=<f> text (default), jsonl, csv or bin records\n"
+            "      --stats      print instruction-mix counters instead of listings\n"
+            "      --verify     re-encode every instruction and compare with the input\n"
+            "      --tolerant   emit invalid bytes as db and list them instead of stopping\n"
+            "      --xref       list the branches to each label as a comment on its line\n"
+            "      --live       list register writes nothing reads instead of listings\n"
+            "      --estimate   list 8086 clocks per basic block and loop without running\n"
+            "      --trips=<l>  with --estimate, loop trip counts: <n> for loops with no\n"
+            "                   known count, <offset>:<n> for the loop at <offset>\n"
+            "      --shrink     list instructions with a shorter encoding and the bytes and\n"
+            "                   fetch clocks each block would save\n"
+            "      --sim        run each image and print its final registers\n"
+            "      --steps=<n>  stop a simulation after <n> instructions\n"
+            "      --memprof    with --sim, add a load/store heatmap and per-instruction strides\n"
+            "      --clocks     with --sim, add 8086/8088 clock totals with a prefetch-queue model\n"
+            "      --compare    simulate every image and list instructions, clocks and clocks\n"
+            "                   per loop iteration side by side, one row each\n"
+            "      --lanes=<n>  run <n> copies of each image in lockstep from random registers\n"
+            "      --seed=<s>   with --lanes, seed for the start registers (default 1)\n"
+            "      --trace=<f>  with --sim, record every step to <f> (<f>.N for several inputs)\n"
+            "      --replay=<f> print the steps of trace <f> with their instructions\n"
+            "      --window=<first>[,<count>]  steps --replay prints\n"
+            "      --serve=<s>  decode requests on unix socket <s> until interrupted\n"
+            "      --connect=<s> decode the files through the server at <s>\n"
+            "      --index      also save where every instruction starts as <file>.idx\n"
+            "      --at=<offset>[,<count>]  list <count> instructions (default 16) around\n"
+            "                   <offset> of each file, from its .idx (built if missing)\n"
+            "      --sweep      decode every opcode/modrm/prefix combination and check it\n"
+            "      --profile    print per-phase timings at exit (make PROFILE=1)\n"
+            "  -                read the list of files from stdin\n");
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        { "jobs",     required_argument, NULL, 'j' },
+        { "stream",   no_argument,       NULL, 's' },
+        { "format",   required_argument, NULL, 'f' },
+        { "stats",    no_argument,       NULL, 'S' },
+        { "verify",   no_argument,       NULL, 'V' },
+        { "tolerant", no_argument,       NULL, 'T' },
+        { "xref",     no_argument,       NULL, 'X' },
+        { "live",     no_argument,       NULL, 'L' },
+        { "estimate", no_argument,       NULL, 'E' },
+        { "trips",    required_argument, NULL, 't' },
+        { "shrink",   no_argument,       NULL, 'Z' },
+        { "sim",      no_argument,       NULL, 'M' },
+        { "steps",    required_argument, NULL, 'N' },
+        { "memprof",  no_argument,       NULL, 'H' },
+        { "clocks",   no_argument,       NULL, 'C' },
+        { "compare",  no_argument,       NULL, 'K' },
+        { "lanes",    required_argument, NULL, 'l' },
+        { "seed",     required_argument, NULL, 'e' },
+        { "trace",    required_argument, NULL, 'R' },
+        { "replay",   required_argument, NULL, 'Y' },
+        { "window",   required_argument, NULL, 'w' },
+        { "serve",    required_argument, NULL, 'D' },
+        { "connect",  required_argument, NULL, 'c' },
+        { "index",    no_argument,       NULL, 'I' },
+        { "at",       required_argument, NULL, 'A' },
+        { "sweep",    no_argument,       NULL, 'W' },
+        { "profile",  no_argument,       NULL, 'P' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL,       0,                 NULL,  0  },
+    };
+
+    struct path_list     list    = { 0 };
+    struct batch_options options = { .seed = 1 };
+    struct stats         stats   = { 0 };
+    struct verify        verify  = { 0 };
+    struct sweep         sweep   = { 0 };
+    struct resync        resync  = { 0 };
+    struct liveness      live    = { 0 };
+    struct estimation    estimate = { 0 };
+    struct estimate_trips trips  = { 0 };
+    struct shrinkage     shrink  = { 0 };
+    struct simulation    sim     = { 0 };
+    struct stat st;
+    const char *replay = NULL, *listen = NULL, *server = NULL;
+    unsigned long long first = 0, count = 0;
+    unsigned long at = 0, around = BOUNDARY_WINDOW;
+    char *end;
+    int  opt, i, rc = 0, plain = 1, stream = 0, sweeping = 0, locate = 0, fd;
+
+    while ((opt = getopt_long(argc, argv, "j:sh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                options.threads = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                stream = 1;
+                break;
+            case 'f':
+                if (parse_output(optarg, &options.output) < 0) {
+                    fprintf(stderr, "unknown format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                options.stats = &stats;
+                break;
+            case 'V':
+                options.verify = &verify;
+                break;
+            case 'T':
+                options.resync = &resync;
+                break;
+            case 'L':
+                options.live = &live;
+                break;
+            case 'X':
+                options.xref = 1;
+                break;
+            case 'E':
+                options.estimate = &estimate;
+                break;
+            case 't':
+                options.estimate = &estimate;
+                options.trips    = &trips;
+                if (estimate_parse_trips(&trips, optarg) < 0) {
+                    fprintf(stderr, "bad trip counts '%s', expected <n> or <offset>:<n>, comma separated\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case 'Z':
+                options.shrink = &shrink;
+                break;
+            case 'M':
+                options.sim = &sim;
+                break;
+            case 'N':
+                options.steps = strtoull(optarg, NULL, 10);
+                break;
+            case 'H':
+                options.sim     = &sim;
+                options.memprof = 1;
+                break;
+            case 'C':
+                options.sim    = &sim;
+                options.clocks = 1;
+                break;
+            case 'K':
+                options.sim     = &sim;
+                options.clocks  = 1;
+                options.compare = 1;
+                break;
+            case 'l':
+                options.sim   = &sim;
+                options.lanes = strtoul(optarg, NULL, 10);
+                if (options.lanes == 0 || options.lanes > LANES_MAX) {
+                    fprintf(stderr, "--lanes takes 1 to %u instances\n", LANES_MAX);
+                    return 1;
+                }
+                break;
+            case 'e':
+                options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'R':
+                options.sim   = &sim;
+                options.trace = optarg;
+                break;
+            case 'Y':
+                replay = optarg;
+                break;
+            case 'w':
+                first = strtoull(optarg, &end, 10);
+                if (*end == ',') count = strtoull(end + 1, &end, 10);
+                if (*end != '\0') {
+                    fprintf(stderr, "bad window '%s', expected <first>[,<count>]\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                listen = optarg;
+                break;
+            case 'c':
+                server = optarg;
+                break;
+            case 'I':
+                options.index = 1;
+                break;
+            case 'A':
+                locate = 1;
+                at     = strtoul(optarg, &end, 0);
+                if (*end == ',') around = strtoul(end + 1, &end, 10);
+                if (*end != '\0' || end == optarg) {
+                    fprintf(stderr, "bad offset '%s', expected <offset>[,<count>]\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'W':
+                sweeping = 1;
+                break;
+            case 'P':
+                if (profile_start() < 0) {
+                    fprintf(stderr, "built without profiling, rebuild with make PROFILE=1\n");
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 1;
+        }
+    }
+
+    if (options.threads == 0) options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (sweeping) {
+        rc = run_sweep(&sweep, options.threads, stderr);
+        sweep_print(stdout, &sweep);
+        return rc < 0;
+    }
+
+    if (replay) {
+        rc = trace_replay(stdout, replay, first, count);
+        return rc < 0;
+    }
+
+    if (listen) {
+        rc = serve(listen);
+        return rc < 0;
+    }
+
+    if (server && (options.stats || options.verify || options.live || options.estimate || options.shrink || options.sim || stream)) {
+        fprintf(stderr, "--connect only decodes, with --format, --tolerant and --xref\n");
+        return 1;
+    }
+
+    if (options.sim && (options.output != OUTPUT_TEXT || options.stats || options.verify || options.live)) {
+        fprintf(stderr, "--sim only supports text output\n");
+        return 1;
+    }
+
+    if (options.estimate && (options.output != OUTPUT_TEXT || options.stats || options.verify ||
+                             options.live || options.sim)) {
+        fprintf(stderr, "--estimate only supports text output\n");
+        return 1;
+    }
+
+    if (options.shrink && (options.output != OUTPUT_TEXT || options.stats || options.verify ||
+                           options.live || options.estimate || options.sim)) {
+        fprintf(stderr, "--shrink only supports text output\n");
+        return 1;
+    }
+
+    if (options.lanes && (options.memprof || options.clocks || options.trace)) {
+        fprintf(stderr, "--lanes reports registers only, no --memprof, --clocks or --trace\n");
+        return 1;
+    }
+
+    if (options.compare && options.memprof) {
+        fprintf(stderr, "--compare prints one row per image, not the memory profile\n");
+        return 1;
+    }
+
+    if (stream && (options.output != OUTPUT_TEXT || options.stats || options.verify || options.xref || options.live || options.estimate || options.shrink || options.sim)) {
+        fprintf(stderr, "--stream only supports text output\n");
+        return 1;
+    }
+
+    if (stream) {
+        fd = STDIN_FILENO;
+        if (optind < argc && strcmp(argv[optind], "-") != 0) {
+            fd = open(argv[optind], O_RDONLY);
+            if (fd < 0) {
+                fprintf(stderr, "failed to open '%s'\n", argv[optind]);
+                return 1;
+            }
+        }
+
+        rc = stream_decode(fd, stdout, options.resync);
+        if (fd != STDIN_FILENO) close(fd);
+        if (options.resync) resync_print(stderr, &resync);
+        profile_report(stderr);
+        return rc < 0;
+    }
+
+    if (optind >= argc) {
+        printf("Missing file to decode. Usage: decode <filename>\n");
+        return 0;
+    }
+
+    for (i = optind; i < argc && rc == 0; ++i) {
+        if (strcmp(argv[i], "-") == 0) {
+            rc = path_list_read(&list, stdin);
+            plain = 0;
+        } else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            rc = path_list_add_dir(&list, argv[i]);
+            plain = 0;
+        } else {
+            rc = path_list_add(&list, argv[i]);
+        }
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "failed to collect input files\n");
+        path_list_free(&list);
+        return 1;
+    }
+
+    // a single plain file keeps the bare listing so it can be fed back to nasm
+    options.headers = !plain || list.count > 1;
+
+    // the rows make one table, the file names are in it
+    if (options.compare) {
+        options.headers = 0;
+        timing_compare_header(stdout);
+        fflush(stdout);
+    }
+
+    // one window per file, each through its own index
+    if (locate) {
+        for (i = 0; i < (int)list.count; ++i) {
+            if (boundary_window(stdout, list.paths[i], at, around,
+                                options.resync ? SCAN_TOLERANT : 0, options.index) < 0)
+                rc = -1;
+        }
+
+        path_list_free(&list);
+        return rc < 0;
+    }
+
+    if (server) {
+        rc = serve_client(stdout, server, list.paths, list.count, options.output,
+                          (options.resync ? SERVE_TOLERANT : 0) | (options.xref ? SERVE_XREF : 0),
+                          options.headers);
+        path_list_free(&list);
+        return rc < 0;
+    }
+
+    rc = run_batch(stdout, &list, &options);
+
+    if (options.stats)  stats_print(stdout, &stats);
+    if (options.verify) verify_print(stdout, &verify);
+    if (options.live)   live_print(stdout, &live);
+    if (options.estimate) estimate_print(stdout, &estimate);
+    if (options.shrink) shrink_print(stdout, &shrink);
+    if (options.sim && options.headers) sim_print(stdout, &sim);
+    if (options.resync && !options.stats) resync_print(stderr, &resync);
+    profile_report(stderr);
+
+    path_list_free(&list);
+    return rc < 0;
+}
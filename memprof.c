@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memprof.h"
+
+// longest bar in the heatmap
+#define BAR 40
+
+void memprof_init_buf(struct memprof *prof, uint32 code_start, uint size, void *buf)
+{
+	memset(prof, 0, sizeof(*prof));
+
+	prof->code_start = code_start;
+	prof->site_count = size;
+	prof->sites      = buf;
+	memset(prof->sites, 0, MEMPROF_BUF_SIZE(size));
+}
+
+void memprof_access(struct memprof *prof, uint32 site, int first, uint32 address,
+                    uint8 width, uint8 form, int store)
+{
+	struct memprof_site *s;
+	int32_t stride;
+	int     odd = width == 2 && (address & 1);
+
+	if (store) {
+		prof->stores[address >> MEMPROF_BUCKET_SHIFT]++;
+		prof->form_stores[form]++;
+	} else {
+		prof->loads[address >> MEMPROF_BUCKET_SHIFT]++;
+		prof->form_loads[form]++;
+	}
+
+	prof->words += width == 2;
+	prof->odd   += odd;
+
+	if (site >= prof->site_count) return;
+
+	s = prof->sites + site;
+	s->accesses++;
+	s->odd += odd;
+	if (!first) return;
+
+	if (s->executions) {
+		stride = (int32_t)(address - s->last);
+		if (s->executions > 1 && stride == s->stride) s->strided++;
+		s->stride = stride;
+	}
+
+	s->last = address;
+	s->executions++;
+}
+
+// keep the `limit` largest keys seen so far in top[], largest first
+static uint insert_top(uint32 *top, uint64_t *keys, uint count, uint limit,
+                       uint32 index, uint64_t key)
+{
+	uint at;
+
+	if (count == limit && key <= keys[count - 1]) return count;
+	if (count < limit) count++;
+
+	for (at = count - 1; at > 0 && keys[at - 1] < key; --at) {
+		top[at]  = top[at - 1];
+		keys[at] = keys[at - 1];
+	}
+
+	top[at]  = index;
+	keys[at] = key;
+	return count;
+}
+
+static int compare_index(const void *a, const void *b)
+{
+	uint32 x = *(const uint32 *)a, y = *(const uint32 *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void report_heatmap(FILE *out, const struct memprof *prof)
+{
+	uint32   top[MEMPROF_ROWS], b;
+	uint64_t keys[MEMPROF_ROWS], heat, max = 0;
+	uint     i, count = 0, used = 0;
+	char     bar[BAR + 1];
+
+	for (b = 0; b < MEMPROF_BUCKETS; ++b) {
+		heat = (uint64_t)prof->loads[b] + prof->stores[b];
+		if (heat == 0) continue;
+
+		used++;
+		if (heat > max) max = heat;
+		count = insert_top(top, keys, count, MEMPROF_ROWS, b, heat);
+	}
+
+	if (count == 0) return;
+
+	// hottest rows, shown in address order
+	qsort(top, count, sizeof(*top), compare_index);
+
+	fprintf(out, "; heatmap, %u-byte buckets, %u touched\n", 1u << MEMPROF_BUCKET_SHIFT, used);
+
+	for (i = 0; i < count; ++i) {
+		b    = top[i];
+		heat = (uint64_t)prof->loads[b] + prof->stores[b];
+
+		memset(bar, '#', BAR);
+		bar[(heat * BAR + max - 1) / max] = '\0';
+
+		fprintf(out, ";   0x%05X  %10u loads %10u stores  %s\n", b << MEMPROF_BUCKET_SHIFT,
+		        prof->loads[b], prof->stores[b], bar);
+	}
+
+	if (used > count) fprintf(out, ";   %u cooler buckets not shown\n", used - count);
+}
+
+static void report_forms(FILE *out, const struct memprof *prof)
+{
+	uint i;
+
+	fprintf(out, "; %-12s %12s %12s\n", "form", "loads", "stores");
+
+	for (i = 0; i < MEMPROF_FORMS; ++i) {
+		if (prof->form_loads[i] == 0 && prof->form_stores[i] == 0) continue;
+
+		fprintf(out, ";   %-10s %12llu %12llu\n",
+		        i == EA_DIRECT ? "direct" : i == MEMPROF_IMPLICIT ? "implicit" : get_ea_name(i),
+		        (unsigned long long)prof->form_loads[i], (unsigned long long)prof->form_stores[i]);
+	}
+}
+
+static void report_sites(FILE *out, const struct memprof *prof, uint8 *memory, uint size)
+{
+	const struct memprof_site *s;
+	Instruction instruction;
+	uint32   top[MEMPROF_SITES];
+	uint64_t keys[MEMPROF_SITES];
+	uint     i, count = 0;
+	char     line[DECODE_MAX_LINE + 1];
+	FILE    *text;
+	size_t   len;
+
+	for (i = 0; i < prof->site_count; ++i) {
+		if (prof->sites[i].accesses == 0) continue;
+		count = insert_top(top, keys, count, MEMPROF_SITES, i, prof->sites[i].accesses);
+	}
+
+	if (count == 0) return;
+
+	text = fmemopen(line, sizeof(line), "w");
+	if (!text) return;
+
+	fprintf(out, ";   %-7s  %-32s %10s %8s %6s %8s\n", "address", "instruction", "accesses",
+	        "stride", "share", "odd");
+
+	for (i = 0; i < count; ++i) {
+		s = prof->sites + top[i];
+
+		rewind(text);
+		if (parse_instruction(&instruction, memory, size, prof->code_start + top[i]) >= 0) {
+			decode_instruction(text, &instruction);
+		} else {
+			fputs("?", text);
+		}
+		fflush(text);
+		len = ftell(text);
+		if (len >= sizeof(line)) len = sizeof(line) - 1;
+
+		fprintf(out, ";   0x%05X  %-32.*s %10u", prof->code_start + top[i], (int)len, line,
+		        s->accesses);
+
+		// share of the differences after the first that repeated the one before
+		if (s->executions > 2) {
+			fprintf(out, " %+8d %5u%%", s->stride,
+			        (uint)((uint64_t)s->strided * 100 / (s->executions - 2)));
+		} else {
+			fprintf(out, " %8s %6s", "-", "-");
+		}
+
+		fprintf(out, " %8u\n", s->odd);
+	}
+
+	fclose(text);
+}
+
+void memprof_report(FILE *out, const struct memprof *prof, uint8 *memory, uint size)
+{
+	uint64_t loads = 0, stores = 0;
+	uint     i;
+
+	for (i = 0; i < MEMPROF_FORMS; ++i) {
+		loads  += prof->form_loads[i];
+		stores += prof->form_stores[i];
+	}
+
+	fprintf(out, "; memory: %llu loads, %llu stores, %llu of %llu word accesses at odd addresses\n",
+	        (unsigned long long)loads, (unsigned long long)stores,
+	        (unsigned long long)prof->odd, (unsigned long long)prof->words);
+
+	if (prof->odd) {
+		fprintf(out, "; odd word accesses take a second bus cycle on the 8086, %llu extra clocks\n",
+		        (unsigned long long)prof->odd * 4);
+	}
+
+	report_heatmap(out, prof);
+	report_forms(out, prof);
+	report_sites(out, prof, memory, size);
+}
@@ -0,0 +1,65 @@
+#if !defined MEMPROF_H
+#define MEMPROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// heatmap granularity over the 1M address space
+#define MEMPROF_BUCKET_SHIFT 8
+#define MEMPROF_BUCKETS      ((1u << 20) >> MEMPROF_BUCKET_SHIFT)
+
+// access forms: the eight ea_base forms, EA_DIRECT, and accesses with no
+// modrm at all (stack, string ops, xlat)
+#define MEMPROF_IMPLICIT (EA_DIRECT + 1)
+#define MEMPROF_FORMS    (EA_DIRECT + 2)
+
+// rows the report lists: hottest buckets, busiest instructions
+#define MEMPROF_ROWS  32
+#define MEMPROF_SITES 16
+
+#define MEMPROF_REPORT_SIZE (256 + MEMPROF_ROWS * 96 + MEMPROF_FORMS * 64 + \
+                             MEMPROF_SITES * (DECODE_MAX_LINE + 64))
+
+// per instruction: the stride between the addresses its first access goes to
+// on consecutive executions
+struct memprof_site
+{
+	uint32  last;      // address of the last execution's first access
+	int32_t stride;    // last difference seen
+	uint32  accesses;
+	uint32  executions;
+	uint32  strided;   // executions whose difference repeated the one before
+	uint32  odd;       // word accesses at odd addresses
+};
+
+// flat counters, nothing allocated while the simulation runs
+struct memprof
+{
+	uint32   loads[MEMPROF_BUCKETS];
+	uint32   stores[MEMPROF_BUCKETS];
+	uint64_t form_loads[MEMPROF_FORMS];
+	uint64_t form_stores[MEMPROF_FORMS];
+	uint64_t words;
+	uint64_t odd;
+
+	uint32   code_start; // linear address of site 0
+	uint     site_count; // one site per image byte
+	struct memprof_site *sites;
+};
+
+// buffer memprof_init_buf needs for an image of `size` bytes
+#define MEMPROF_BUF_SIZE(size) ((size_t)(size) * sizeof(struct memprof_site))
+
+extern void memprof_init_buf(struct memprof *prof, uint32 code_start, uint size, void *buf);
+
+// one load or store; `first` is set for the first access of an execution of site
+extern void memprof_access(struct memprof *prof, uint32 site, int first, uint32 address,
+                           uint8 width, uint8 form, int store);
+
+// hottest buckets as a bar chart, the per-form table and the busiest
+// instructions with their strides, decoded from memory
+extern void memprof_report(FILE *out, const struct memprof *prof, uint8 *memory, uint size);
+
+#endif // MEMPROF_H
@@ -0,0 +1,238 @@
+#include "profile.h"
+
+#if defined PROFILE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#define READ_TSC() __rdtsc()
+#else
+#define READ_TSC() 0
+#endif
+
+struct phase_totals
+{
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t ns;
+	uint64_t tsc;
+	uint64_t counters[COUNTER_COUNT];
+};
+
+int profile_enabled = 0;
+
+static const char *phase_names[PHASE_COUNT] = { "read", "decode", "labels", "render" };
+static struct phase_totals totals[PHASE_COUNT];
+// probed by profile_start, cleared (atomically) by any thread whose counters fail to open
+static int counters_available = 1;
+
+// perf fds are per thread, opened the first time a thread enters a phase and
+// closed when it exits; fds[0] leads the group
+static _Thread_local int group_fd = -2;
+static _Thread_local int fds[COUNTER_COUNT] = { -1, -1, -1, -1 };
+static pthread_key_t     fds_key;
+
+#if defined __linux__
+static int open_counter(uint64_t config, int leader)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type           = PERF_TYPE_HARDWARE;
+	attr.size           = sizeof(attr);
+	attr.config         = config;
+	attr.disabled       = leader == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	attr.read_format    = PERF_FORMAT_GROUP;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+#endif
+
+static void close_counters(void *arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = COUNTER_COUNT - 1; i >= 0; --i) {
+		if (fds[i] >= 0) close(fds[i]);
+		fds[i] = -1;
+	}
+
+	group_fd = -2;
+}
+
+static void close_main_counters(void)
+{
+	close_counters(NULL);
+}
+
+static void counters_failed(void)
+{
+	close_counters(NULL);
+	group_fd = -1;
+	__atomic_store_n(&counters_available, 0, __ATOMIC_RELAXED);
+}
+
+static void open_counters(void)
+{
+#if defined __linux__
+	static const uint64_t configs[COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+	int i;
+
+	group_fd = -1;
+	if (!__atomic_load_n(&counters_available, __ATOMIC_RELAXED)) return;
+
+	for (i = 0; i < COUNTER_COUNT; ++i) {
+		fds[i] = open_counter(configs[i], i ? fds[0] : -1);
+		if (fds[i] < 0) {
+			counters_failed();
+			return;
+		}
+	}
+
+	// the key's destructor closes them when this thread exits
+	pthread_setspecific(fds_key, fds);
+
+	group_fd = fds[0];
+	ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+	counters_failed();
+#endif
+}
+
+static void read_counters(uint64_t counters[COUNTER_COUNT])
+{
+	uint64_t buf[1 + COUNTER_COUNT];
+
+	if (group_fd == -2) open_counters();
+
+	if (group_fd < 0 || read(group_fd, buf, sizeof(buf)) != sizeof(buf)) {
+		memset(counters, 0, COUNTER_COUNT * sizeof(*counters));
+		return;
+	}
+
+	// buf[0] is the number of events in the group
+	memcpy(counters, buf + 1, COUNTER_COUNT * sizeof(*counters));
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void profile_begin(struct profile_mark *mark)
+{
+	read_counters(mark->counters);
+	mark->ns  = now_ns();
+	mark->tsc = READ_TSC();
+}
+
+void profile_end(int phase, struct profile_mark *mark, uint64_t bytes)
+{
+	uint64_t tsc = READ_TSC();
+	uint64_t ns  = now_ns();
+	uint64_t counters[COUNTER_COUNT];
+	struct phase_totals *t = totals + phase;
+	int i;
+
+	read_counters(counters);
+
+	// phases run on every batch worker at once
+	__atomic_fetch_add(&t->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&t->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&t->ns, ns - mark->ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&t->tsc, tsc - mark->tsc, __ATOMIC_RELAXED);
+	for (i = 0; i < COUNTER_COUNT; ++i)
+		__atomic_fetch_add(&t->counters[i], counters[i] - mark->counters[i], __ATOMIC_RELAXED);
+}
+
+int profile_start(void)
+{
+	uint64_t counters[COUNTER_COUNT];
+
+	memset(totals, 0, sizeof(totals));
+	pthread_key_create(&fds_key, close_counters);
+	atexit(close_main_counters);
+
+	// open this thread's counters now, so counters_available is settled
+	// before any worker reads it
+	read_counters(counters);
+
+	profile_enabled = 1;
+	return 0;
+}
+
+void profile_report(FILE *out)
+{
+	struct phase_totals *t;
+	double cycles;
+	int available = __atomic_load_n(&counters_available, __ATOMIC_RELAXED);
+	int i;
+
+	if (!profile_enabled) return;
+
+	fprintf(out, "%-8s %8s %12s %12s %14s %10s %6s %12s %12s\n",
+	        "phase", "calls", "bytes", "usec", "tsc", "bytes/cyc", "ipc",
+	        "br-miss", "cache-miss");
+
+	for (i = 0; i < PHASE_COUNT; ++i) {
+		t = totals + i;
+
+		// prefer core cycles, the tsc ticks at a fixed rate
+		cycles = available ? t->counters[COUNTER_CYCLES] : t->tsc;
+
+		fprintf(out, "%-8s %8llu %12llu %12.1f %14llu %10.3f ", phase_names[i],
+		        (unsigned long long)t->calls, (unsigned long long)t->bytes,
+		        t->ns / 1000.0, (unsigned long long)t->tsc,
+		        cycles ? t->bytes / cycles : 0.0);
+
+		if (available) {
+			fprintf(out, "%6.2f %12llu %12llu\n",
+			        cycles ? t->counters[COUNTER_INSTRUCTIONS] / cycles : 0.0,
+			        (unsigned long long)t->counters[COUNTER_BRANCH_MISSES],
+			        (unsigned long long)t->counters[COUNTER_CACHE_MISSES]);
+		} else {
+			fprintf(out, "%6s %12s %12s\n", "-", "-", "-");
+		}
+	}
+
+	if (!available)
+		fprintf(out, "(perf_event_open unavailable, bytes/cyc uses the tsc)\n");
+}
+
+#else
+
+int profile_start(void)
+{
+	return -1;
+}
+
+void profile_report(FILE *out)
+{
+	(void)out;
+}
+
+#endif // PROFILE
@@ -0,0 +1,59 @@
+#if !defined PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum {
+	PHASE_READ,
+	PHASE_DECODE,
+	PHASE_LABELS,
+	PHASE_RENDER,
+	PHASE_COUNT,
+};
+
+#if defined PROFILE
+
+enum {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_CACHE_MISSES,
+	COUNTER_COUNT,
+};
+
+struct profile_mark
+{
+	uint64_t ns;
+	uint64_t tsc;
+	uint64_t counters[COUNTER_COUNT];
+};
+
+extern int profile_enabled;
+
+extern void profile_begin(struct profile_mark *mark);
+extern void profile_end(int phase, struct profile_mark *mark, uint64_t bytes);
+
+#define PROFILE_BEGIN(mark) \
+	struct profile_mark mark; \
+	if (profile_enabled) profile_begin(&mark)
+#define PROFILE_END(phase, mark, bytes) \
+	do { if (profile_enabled) profile_end((phase), &mark, (bytes)); } while (0)
+// start the next span on a mark PROFILE_BEGIN declared
+#define PROFILE_RESTART(mark) \
+	do { if (profile_enabled) profile_begin(&mark); } while (0)
+
+#else
+
+#define PROFILE_BEGIN(mark)
+#define PROFILE_END(phase, mark, bytes)
+#define PROFILE_RESTART(mark)
+
+#endif // PROFILE
+
+// fails with -1 when built without -DPROFILE (make PROFILE=1); call it
+// before any thread starts a phase
+extern int  profile_start(void);
+extern void profile_report(FILE *out);
+
+#endif // PROFILE_H
@@ -0,0 +1,58 @@
+#include <assert.h>
+
+#include "resync.h"
+
+void resync_range(struct resync *resync, FILE *log, const char *path, uint start, uint end)
+{
+	assert(start < end);
+
+	if (resync->listed == 0) resync->files++;
+
+	resync->ranges++;
+	resync->bytes += end - start;
+
+	if (resync->listed < RESYNC_LOG_RANGES) {
+		fprintf(log, "%s: invalid bytes 0x%X-0x%X (%u)\n", path ? path : "-", start, end - 1,
+		        end - start);
+	} else if (resync->listed == RESYNC_LOG_RANGES) {
+		fprintf(log, "%s: more invalid ranges, not listed\n", path ? path : "-");
+	}
+
+	resync->listed++;
+}
+
+void resync_scan(struct resync *resync, FILE *log, const char *path,
+                 const Instruction *instructions, uint count)
+{
+	uint i, start = 0, end = 0;
+
+	resync->listed = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (instructions[i].structure.type != UNKNOWN) continue;
+
+		// records are back to back, so adjacent db records share an edge
+		if (start == end || instructions[i].offset != end) {
+			if (start != end) resync_range(resync, log, path, start, end);
+			start = instructions[i].offset;
+		}
+
+		end = instructions[i].offset + instructions[i].structure.size;
+	}
+
+	if (start != end) resync_range(resync, log, path, start, end);
+}
+
+void resync_merge(struct resync *into, const struct resync *from)
+{
+	into->files  += from->files;
+	into->ranges += from->ranges;
+	into->bytes  += from->bytes;
+}
+
+void resync_print(FILE *out, const struct resync *resync)
+{
+	fprintf(out, "invalid: %llu bytes in %llu ranges, %llu files\n",
+	        (unsigned long long)resync->bytes, (unsigned long long)resync->ranges,
+	        (unsigned long long)resync->files);
+}
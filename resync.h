@@ -0,0 +1,30 @@
+#if !defined RESYNC_H
+#define RESYNC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// ranges listed per file before the log only counts them
+#define RESYNC_LOG_RANGES 16
+
+// byte ranges a tolerant scan turned into db records
+struct resync
+{
+	uint64_t files;  // files with at least one range
+	uint64_t ranges;
+	uint64_t bytes;
+
+	uint     listed; // ranges logged for the current file
+};
+
+// count one range [start, end) of the current file, logging the first few
+extern void resync_range(struct resync *resync, FILE *log, const char *path, uint start, uint end);
+// count the runs of adjacent db records in a scanned file
+extern void resync_scan(struct resync *resync, FILE *log, const char *path,
+                        const Instruction *instructions, uint count);
+extern void resync_merge(struct resync *into, const struct resync *from);
+extern void resync_print(FILE *out, const struct resync *resync);
+
+#endif // RESYNC_H
@@ -0,0 +1,446 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "serve.h"
+#include "session.h"
+
+// a path sent as SERVE_PATH or a name with SERVE_FD
+#define SERVE_NAME_MAX 4096
+// descriptors read_request makes room for, to close those past the first
+#define SERVE_MAX_FDS  8
+
+// one per connection, kept for every request on it so the arena stays warm
+struct connection
+{
+	int            fd;
+	struct session session;
+	char           name[SERVE_NAME_MAX];
+};
+
+// 0 once len bytes are in, 1 on end of file before the first byte
+static int read_full(int fd, void *buf, size_t len)
+{
+	uint8  *p = buf;
+	ssize_t n;
+	size_t  done = 0;
+
+	while (done < len) {
+		n = read(fd, p + done, len - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		if (n == 0) return done == 0 ? 1 : -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const uint8 *p = buf;
+	ssize_t n;
+	size_t  done = 0;
+
+	while (done < len) {
+		// a client that went away shouldn't take the server down with SIGPIPE
+		n = send(fd, p + done, len - done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+// the header, and the descriptor that came with it (-1 if none); 1 when the
+// client closed the connection between requests. A request takes one
+// descriptor: any more are closed, and one whose control data didn't fit
+// (MSG_CTRUNC) is refused, since the kernel dropped descriptors from it.
+static int read_request(int fd, struct serve_request *request, int *passed)
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+	} control;
+	struct iovec    iov = { request, sizeof(*request) };
+	struct msghdr   msg = { 0 };
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	size_t  i, count;
+	int     received;
+
+	*passed = -1;
+
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0) return -1;
+	if (n == 0) return 1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; ++i) {
+			memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (*passed < 0) *passed = received;
+			else             close(received);
+		}
+	}
+
+	if (msg.msg_flags & MSG_CTRUNC) {
+		fprintf(stderr, "request with truncated control data, closing the connection\n");
+		if (*passed >= 0) close(*passed);
+		return -1;
+	}
+
+	if ((size_t)n < sizeof(*request) &&
+	    read_full(fd, (uint8 *)request + n, sizeof(*request) - n) != 0) {
+		if (*passed >= 0) close(*passed);
+		return -1;
+	}
+
+	return 0;
+}
+
+// load the image a request names or carries; `broken` when the rest of the
+// request couldn't be read and the connection can't go on
+static int load_request(struct connection *c, const struct serve_request *request, int passed,
+                        int *broken)
+{
+	struct session *s = &c->session;
+	uint8 *raw;
+	int    fd, rc;
+
+	*broken = 1;
+
+	switch (request->kind) {
+	case SERVE_BYTES:
+		if (request->size > SERVE_MAX_SIZE) return -1;
+
+		// straight from the socket into the arena
+		raw = session_reserve(s, request->flags & SERVE_COM ? "-.com" : "-", request->size);
+		if (!raw) return -3;
+		if (read_full(c->fd, raw, request->size) != 0) return -1;
+
+		*broken = 0;
+		return session_open(s);
+	case SERVE_PATH:
+	case SERVE_FD:
+		if (request->size >= SERVE_NAME_MAX) return -1;
+		if (read_full(c->fd, c->name, request->size) != 0) return -1;
+		c->name[request->size] = '\0';
+
+		*broken = 0;
+		if (request->kind == SERVE_FD && passed < 0) return -1;
+
+		fd = request->kind == SERVE_FD ? passed : open(c->name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return -1;
+		if (request->flags & SERVE_COM) strcpy(c->name, "-.com");
+
+		rc = session_read(s, fd, c->name);
+		if (fd != passed) close(fd);
+		return rc < 0 ? rc : session_open(s);
+	default:
+		assert(0);
+		return -1;
+	}
+}
+
+// read past the body of a request that can't be served, so the next one lines up
+static int skip_body(struct connection *c, uint32_t size)
+{
+	uint32_t n;
+
+	if (size > SERVE_MAX_SIZE) return -1;
+
+	for (; size; size -= n) {
+		n = size < SERVE_NAME_MAX ? size : SERVE_NAME_MAX;
+		if (read_full(c->fd, c->name, n) != 0) return -1;
+	}
+
+	return 0;
+}
+
+static int handle_request(struct connection *c, const struct serve_request *request, int passed)
+{
+	struct session    *s = &c->session;
+	struct serve_reply reply = { -1, 0 };
+	int broken;
+
+	s->output = request->output;
+	s->flags  = 0;
+	if (request->flags & SERVE_TOLERANT) s->flags |= SCAN_TOLERANT;
+	if ((request->flags & SERVE_XREF) && s->output == OUTPUT_TEXT) s->flags |= SESSION_XREF;
+
+	if (request->output <= OUTPUT_BIN && request->kind <= SERVE_FD)
+		reply.status = load_request(c, request, passed, &broken);
+	else
+		broken = skip_body(c, request->size) < 0;
+	if (passed >= 0) close(passed);
+
+	if (broken) {
+		// whatever body is left can't be skipped reliably, answer and hang up
+		write_full(c->fd, &reply, sizeof(reply));
+		return -1;
+	}
+
+	if (reply.status == 0) reply.status = session_decode(s);
+	if (reply.status == 0) reply.status = session_render(s);
+	if (reply.status == 0) reply.size = s->text_size;
+
+	if (write_full(c->fd, &reply, sizeof(reply)) < 0) return -1;
+	if (reply.size && write_full(c->fd, s->text, reply.size) < 0) return -1;
+
+	// keep the arena for the next request
+	session_reset(s);
+	return 0;
+}
+
+static void *connection_run(void *arg)
+{
+	struct connection   *c = arg;
+	struct serve_request request;
+	int passed;
+
+	while (read_request(c->fd, &request, &passed) == 0) {
+		if (handle_request(c, &request, passed) < 0) break;
+	}
+
+	session_free(&c->session);
+	close(c->fd);
+	free(c);
+	return NULL;
+}
+
+static void *accept_run(void *arg)
+{
+	struct connection *c;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int listener = *(int *)arg, fd;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (;;) {
+		fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		c = malloc(sizeof(*c));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		session_init(&c->session, OUTPUT_TEXT, 0);
+
+		if (pthread_create(&thread, &attr, connection_run, c) != 0) {
+			close(fd);
+			free(c);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+	return NULL;
+}
+
+static int socket_address(struct sockaddr_un *address, const char *path)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(address->sun_path)) {
+		fprintf(stderr, "socket path '%s' is too long\n", path);
+		return -1;
+	}
+
+	strcpy(address->sun_path, path);
+	return 0;
+}
+
+int serve(const char *path)
+{
+	struct sockaddr_un address;
+	struct stat st;
+	pthread_t   acceptor;
+	sigset_t    signals;
+	int listener, sig;
+
+	if (socket_address(&address, path) < 0) return -1;
+
+	// a socket left behind by a server that didn't get to clean up; anything
+	// else at that path is someone's file
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) return -1;
+
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0) {
+		fprintf(stderr, "failed to listen on '%s'\n", path);
+		close(listener);
+		return -1;
+	}
+
+	// every thread inherits the mask, the signals only ever reach sigwait
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	if (pthread_create(&acceptor, NULL, accept_run, &listener) != 0) {
+		close(listener);
+		unlink(path);
+		return -3;
+	}
+
+	fprintf(stderr, "listening on %s\n", path);
+	sigwait(&signals, &sig);
+
+	// connections still open are cut off when the process exits
+	close(listener);
+	unlink(path);
+	return 0;
+}
+
+static int send_fd(int sock, const struct serve_request *request, int fd, const char *name)
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec    iov[2] = { { (void *)request, sizeof(*request) }, { (void *)name, request->size } };
+	struct msghdr   msg = { 0 };
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov        = iov;
+	msg.msg_iovlen     = 2;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg             = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	do n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0) return -1;
+
+	// the descriptor went with the first byte, the rest is plain data
+	if ((size_t)n < sizeof(*request) + request->size) {
+		if ((size_t)n < sizeof(*request)) {
+			if (write_full(sock, (const uint8 *)request + n, sizeof(*request) - n) < 0) return -1;
+			n = sizeof(*request);
+		}
+		return write_full(sock, name + (n - sizeof(*request)), request->size - (n - sizeof(*request)));
+	}
+
+	return 0;
+}
+
+int serve_client(FILE *out, const char *socket_path, char **paths, uint count, uint8 output,
+                 uint16 flags, int headers)
+{
+	struct sockaddr_un   address;
+	struct serve_request request;
+	struct serve_reply   reply;
+	struct writer header;
+	char  buf[4352], *text = NULL, *tmp;
+	size_t capacity = 0;
+	uint  i;
+	int   sock, fd, rc = 0;
+
+	if (socket_address(&address, socket_path) < 0) return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) return -1;
+
+	if (connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		fprintf(stderr, "failed to connect to '%s'\n", socket_path);
+		close(sock);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		header = (struct writer){ buf, 0, sizeof(buf), out };
+
+		fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "failed to read '%s'\n", paths[i]);
+			format_header(&header, output, headers ? paths[i] : NULL, -1, 0);
+			writer_flush(&header);
+			if (headers && output == OUTPUT_TEXT) fputc('\n', out);
+			rc = -1;
+			continue;
+		}
+
+		request = (struct serve_request){ SERVE_FD, output, flags, strlen(paths[i]) };
+		if (request.size >= SERVE_NAME_MAX) request.size = 0;
+
+		if (send_fd(sock, &request, fd, paths[i]) < 0 || read_full(sock, &reply, sizeof(reply)) != 0) {
+			fprintf(stderr, "lost the connection to '%s'\n", socket_path);
+			close(fd);
+			rc = -1;
+			break;
+		}
+		close(fd);
+
+		if (reply.size > capacity) {
+			tmp = realloc(text, reply.size);
+			if (!tmp) {
+				rc = -3;
+				break;
+			}
+			text     = tmp;
+			capacity = reply.size;
+		}
+
+		if (reply.size && read_full(sock, text, reply.size) != 0) {
+			rc = -1;
+			break;
+		}
+
+		// the same layout run_batch writes
+		format_header(&header, output, headers ? paths[i] : NULL, reply.status, reply.size);
+		writer_flush(&header);
+
+		if (reply.status == 0) {
+			fwrite(text, 1, reply.size, out);
+		} else {
+			fprintf(stderr, "failed to decode '%s'\n", paths[i]);
+			rc = -1;
+		}
+
+		if (headers && output == OUTPUT_TEXT) fputc('\n', out);
+	}
+
+	free(text);
+	close(sock);
+	fflush(out);
+	return rc;
+}
@@ -0,0 +1,52 @@
+#if !defined SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// what follows a request header
+typedef enum {
+	SERVE_BYTES, // `size` bytes of image
+	SERVE_PATH,  // `size` bytes of path, no NUL, opened by the server
+	SERVE_FD,    // `size` bytes of file name (for the .com check, may be 0); the
+	             // descriptor comes with the header as SCM_RIGHTS and is read
+} SERVE_KIND;
+
+// request flags
+#define SERVE_TOLERANT 0x1 // --tolerant
+#define SERVE_XREF     0x2 // --xref, text output only
+#define SERVE_COM      0x4 // a .com image whatever its name
+
+// largest image or path a request may send
+#define SERVE_MAX_SIZE (64u << 20)
+
+// every request on a connection starts with this, in host byte order; a
+// connection carries any number of them, one reply each, in order
+struct serve_request
+{
+	uint8    kind;   // SERVE_KIND
+	uint8    output; // OUTPUT
+	uint16   flags;  // SERVE_*
+	uint32_t size;
+};
+
+// then `size` bytes of listing or records, nothing if status < 0
+struct serve_reply
+{
+	int32_t  status; // 0 or what session_load / session_decode returned
+	uint32_t size;
+};
+
+// listen on a unix socket at `path` until SIGINT or SIGTERM, one thread and
+// one session per connection; the socket file is removed on the way out
+extern int serve(const char *path);
+
+// send every path to the server at `socket_path` as SERVE_FD and write the
+// replies to out in order, each after a header line like run_batch's if
+// `headers` is set
+extern int serve_client(FILE *out, const char *socket_path, char **paths, uint count,
+                        uint8 output, uint16 flags, int headers);
+
+#endif // SERVE_H
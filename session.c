@@ -0,0 +1,419 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "session.h"
+
+// "bits 16\n\n" plus the mz summary line
+#define TEXT_HEADER  96
+// "\n; segment 0x1234\n"
+#define SEGMENT_LINE 24
+
+// segment headers in a listing: one per distinct paragraph plus 64K splits
+#define SEGMENT_LINES(size) ((size_t)(size) / 16 + 2)
+
+void session_init(struct session *s, OUTPUT output, uint flags)
+{
+	memset(s, 0, sizeof(*s));
+	s->output = output;
+	s->flags  = flags;
+}
+
+void session_free(struct session *s)
+{
+	arena_free(&s->arena);
+	session_init(s, s->output, s->flags);
+}
+
+void session_reset(struct session *s)
+{
+	struct arena arena = s->arena;
+
+	arena_reset(&arena);
+	session_init(s, s->output, s->flags);
+	s->arena = arena;
+}
+
+size_t session_footprint(uint size, OUTPUT output, uint flags)
+{
+	size_t extra = 0;
+
+	// one branch per record at most, each listed on a label line at most once
+	if (flags & SESSION_XREF)
+		extra += ARENA_SIZE(XREF_BUF_SIZE(size)) + (size_t)size * (XREF_ENTRY + XREF_TAIL);
+
+	// the report replaces the listing, LIVE_LINE per record at most
+	if (flags & SESSION_LIVE)
+		extra += ARENA_SIZE(LIVE_BUF_SIZE(size)) + ARENA_SIZE((size_t)size * LIVE_LINE + TEXT_HEADER);
+
+	// blocks first, then dominators and loops over them
+	if (flags & SESSION_ESTIMATE)
+		extra += ARENA_SIZE(LIVE_BUF_SIZE(size)) + ARENA_SIZE(ESTIMATE_BUF_SIZE(size)) +
+		         ARENA_SIZE(ESTIMATE_REPORT_SIZE(size));
+
+	// blocks from live_solve, then a line per record at most
+	if (flags & SESSION_SHRINK)
+		extra += ARENA_SIZE(LIVE_BUF_SIZE(size)) + ARENA_SIZE(SHRINK_REPORT_SIZE(size));
+
+	if (flags & SESSION_INDEX)
+		extra += ARENA_SIZE(BOUNDARY_BUF_SIZE(size));
+
+	if (flags & SESSION_SIM)
+		extra += ARENA_SIZE(SIM_REPORT_SIZE);
+
+	// sites for every image byte, and the report after the registers
+	if (flags & SESSION_MEMPROF)
+		extra += ARENA_SIZE(MEMPROF_BUF_SIZE(size)) + ARENA_SIZE(MEMPROF_REPORT_SIZE);
+
+	if (flags & SESSION_CLOCKS)
+		extra += ARENA_SIZE(TIMING_REPORT_SIZE);
+
+	if (flags & SESSION_COMPARE)
+		extra += ARENA_SIZE(TIMING_COMPARE_SIZE);
+
+	// the lane count isn't known here, room for as many as --lanes allows
+	if (flags & SESSION_LANES)
+		extra += ARENA_SIZE(LANES_REPORT_SIZE(LANES_MAX));
+
+	// every instruction is at least one byte long, so `size` records is the
+	// worst case for both the record array and the text
+	return extra + ARENA_SIZE(size) +
+	       ARENA_SIZE((size_t)IMAGE_MAX_SEGMENTS(size) * sizeof(uint16)) +
+	       ARENA_SIZE((size_t)size * sizeof(Instruction)) +
+	       ARENA_SIZE(BITMAP_WORDS((size_t)size + 1) * sizeof(uint32_t)) +
+	       ARENA_SIZE((size_t)size * output_max_record(output) + TEXT_HEADER +
+	                  SEGMENT_LINES(size) * SEGMENT_LINE);
+}
+
+uint8 *session_reserve(struct session *s, const char *path, uint size)
+{
+	session_reset(s);
+	s->path = path;
+
+	if (arena_reserve(&s->arena, session_footprint(size, s->output, s->flags)) < 0) return NULL;
+
+	s->size = size;
+	s->raw  = arena_push(&s->arena, size);
+	return s->raw;
+}
+
+int session_read(struct session *s, int fd, const char *path)
+{
+	struct stat st;
+	uint8  *raw;
+	ssize_t n;
+	size_t  done = 0;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > UINT32_MAX) return -1;
+
+	raw = session_reserve(s, path, st.st_size);
+	if (!raw) return -3;
+
+	// a copy, so a file cut short under us is a short read instead of SIGBUS
+	while (done < (size_t)st.st_size) {
+		n = pread(fd, raw + done, st.st_size - done, done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			fprintf(stderr, "%s: short read at %zu of %zu bytes\n", path, done, (size_t)st.st_size);
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+int session_open(struct session *s)
+{
+	uint16 *segments;
+	uint    len = s->size;
+	int     rc;
+
+	// everything after this works on the load module, not the file
+	segments = arena_push(&s->arena, IMAGE_MAX_SEGMENTS(len) * sizeof(uint16));
+	rc = image_load(&s->image, s->raw, len, s->path, segments);
+	if (rc < 0) return rc;
+
+	s->raw  = s->image.data;
+	s->size = s->image.size;
+	return 0;
+}
+
+int session_load(struct session *s, const char *path)
+{
+	FILE   *f;
+	long    len;
+	uint    size;
+	uint8  *raw;
+	int     rc;
+
+	session_reset(s);
+
+	PROFILE_BEGIN(read);
+
+	f = fopen(path, "rb");
+	if (!f) return -1;
+
+	// the image size is a uint, so anything past 4 GiB can't be held
+	if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || (uint64_t)len > UINT32_MAX) {
+		fclose(f);
+		return -1;
+	}
+	rewind(f);
+	size = len;
+
+	raw = session_reserve(s, path, size);
+	if (!raw) {
+		fclose(f);
+		return -3;
+	}
+
+	if (size > 0 && fread(raw, size, 1, f) != 1) {
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+
+	rc = session_open(s);
+	if (rc < 0) return rc;
+
+	PROFILE_END(PHASE_READ, read, size);
+	return 0;
+}
+
+// the text is sized for the worst case; one that fills it up was cut short,
+// so it fails instead of going out truncated
+static int text_fits(struct session *s, size_t len, size_t capacity, int error)
+{
+	if (error || len >= capacity) {
+		fprintf(stderr, "%s: output doesn't fit its %zu byte buffer\n", s->path, capacity);
+		s->text_size = 0;
+		return -3;
+	}
+
+	s->text_size = len;
+	return 0;
+}
+
+// finish a report written into s->text through fmemopen
+static int close_text(struct session *s, FILE *out, size_t capacity)
+{
+	long len;
+	int  error;
+
+	fflush(out);
+	len   = ftell(out);
+	error = ferror(out) || len < 0;
+	fclose(out);
+
+	return text_fits(s, len < 0 ? 0 : len, capacity, error);
+}
+
+int session_decode(struct session *s)
+{
+	uint32_t *words;
+	int       count;
+
+	assert(s->arena.base != NULL);
+
+	s->instructions = arena_push(&s->arena, (size_t)s->size * sizeof(Instruction));
+	words           = arena_push(&s->arena, BITMAP_WORDS((size_t)s->size + 1) * sizeof(uint32_t));
+	bitmap_init_buf(&s->labels, (size_t)s->size + 1, words);
+
+	if (s->flags & SESSION_XREF)
+		xref_init_buf(&s->xref, s->size, arena_push(&s->arena, XREF_BUF_SIZE(s->size)));
+
+	// single pass, the arena is already sized for the worst case
+	count = scan_segments(s->instructions, s->size, s->raw, s->size, &s->labels,
+	                      s->image.segments, s->image.segment_count, s->flags,
+	                      s->flags & SESSION_XREF ? &s->xref : NULL);
+	if (count < 0) return count;
+
+	s->count = count;
+	return 0;
+}
+
+int session_render(struct session *s)
+{
+	size_t capacity = (size_t)s->count * output_max_record(s->output) + TEXT_HEADER +
+	                  SEGMENT_LINES(s->size) * SEGMENT_LINE;
+	const struct xref *xref = NULL;
+	struct writer w;
+	FILE  *out;
+	uint   i;
+	int    rc;
+
+	if (s->flags & SESSION_XREF) {
+		xref      = &s->xref;
+		capacity += (size_t)xref->count * (XREF_ENTRY + XREF_TAIL);
+	}
+
+	s->text = arena_push(&s->arena, capacity);
+
+	PROFILE_BEGIN(render);
+
+	if (s->output != OUTPUT_TEXT) {
+		w = (struct writer){ s->text, 0, capacity, NULL };
+		for (i = 0; i < s->count; ++i)
+			format_instruction(&w, s->output, s->instructions + i, s->raw);
+
+		rc = text_fits(s, w.len, capacity, 0);
+	} else {
+		out = fmemopen(s->text, capacity, "w");
+		if (!out) return -3;
+
+		if (s->image.kind == IMAGE_MZ) {
+			fprintf(out, "; mz image, entry 0x%04X:0x%04X, %u relocations\n",
+			        s->image.entry_cs, s->image.entry_ip, s->image.relocations);
+		}
+
+		render_instructions(out, s->instructions, s->count, xref);
+		rc = close_text(s, out, capacity);
+	}
+
+	PROFILE_END(PHASE_RENDER, render, s->size);
+	return rc;
+}
+
+int session_index(struct session *s)
+{
+	struct boundary boundary;
+
+	boundary_init_buf(&boundary, s->size, arena_push(&s->arena, BOUNDARY_BUF_SIZE(s->size)));
+	boundary_build(&boundary, s->instructions, s->count, s->flags & SCAN_TOLERANT);
+	return boundary_save(&boundary, s->path);
+}
+
+int session_live(struct session *s, struct liveness *totals)
+{
+	struct live live;
+	size_t capacity = (size_t)s->count * LIVE_LINE + TEXT_HEADER;
+	FILE  *out;
+
+	live_init_buf(&live, s->count, arena_push(&s->arena, LIVE_BUF_SIZE(s->count)));
+	live_solve(&live, s->instructions, s->count);
+
+	s->text = arena_push(&s->arena, capacity);
+
+	out = fmemopen(s->text, capacity, "w");
+	if (!out) return -3;
+
+	live_report(out, &live, s->instructions, totals);
+	return close_text(s, out, capacity);
+}
+
+int session_estimate(struct session *s, const struct estimate_trips *trips,
+                     struct estimation *totals)
+{
+	struct live     live;
+	struct estimate estimate;
+	size_t capacity = ESTIMATE_REPORT_SIZE(s->count);
+	FILE  *out;
+
+	live_init_buf(&live, s->count, arena_push(&s->arena, LIVE_BUF_SIZE(s->count)));
+	live_solve(&live, s->instructions, s->count);
+
+	estimate_init_buf(&estimate, s->count, arena_push(&s->arena, ESTIMATE_BUF_SIZE(s->count)));
+	estimate_solve(&estimate, &live, s->instructions, trips);
+
+	s->text = arena_push(&s->arena, capacity);
+
+	out = fmemopen(s->text, capacity, "w");
+	if (!out) return -3;
+
+	estimate_report(out, &estimate, &live, s->instructions, totals);
+	return close_text(s, out, capacity);
+}
+
+int session_shrink(struct session *s, struct shrinkage *totals)
+{
+	struct live live;
+	size_t capacity = SHRINK_REPORT_SIZE(s->count);
+	FILE  *out;
+
+	live_init_buf(&live, s->count, arena_push(&s->arena, LIVE_BUF_SIZE(s->count)));
+	live_solve(&live, s->instructions, s->count);
+
+	s->text = arena_push(&s->arena, capacity);
+
+	out = fmemopen(s->text, capacity, "w");
+	if (!out) return -3;
+
+	shrink_report(out, &live, s->instructions, s->raw, totals);
+	return close_text(s, out, capacity);
+}
+
+// file name without its directories, the rows are narrow
+static const char *compare_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+int session_simulate(struct session *s, struct sim *sim, struct trace *trace,
+                     const char *trace_path, uint64_t max_steps, struct simulation *totals)
+{
+	size_t capacity = SIM_REPORT_SIZE;
+	FILE  *out;
+	int    rc = 0;
+
+	sim_load(sim, &s->image);
+
+	if (sim->prof) {
+		memprof_init_buf(sim->prof, sim->code_start, sim->code_end - sim->code_start,
+		                 arena_push(&s->arena, MEMPROF_BUF_SIZE(sim->code_end - sim->code_start)));
+		capacity += MEMPROF_REPORT_SIZE;
+	}
+
+	if (sim->timing) capacity += TIMING_REPORT_SIZE;
+	if (s->flags & SESSION_COMPARE) capacity = TIMING_COMPARE_SIZE;
+
+	if (trace_path) {
+		rc = trace_open(trace, trace_path, sim);
+		if (rc < 0) return rc;
+	}
+
+	sim_run(sim, max_steps, trace_path ? trace : NULL);
+	if (trace_path) rc = trace_close(trace);
+
+	s->text = arena_push(&s->arena, capacity);
+
+	out = fmemopen(s->text, capacity, "w");
+	if (!out) return -3;
+
+	if (s->flags & SESSION_COMPARE) {
+		sim_tally(totals, sim);
+		timing_compare_row(out, compare_name(s->path), sim->timing, sim->steps,
+		                   sim_stopped_early(sim->stop) ? sim_stop_name(sim->stop) : NULL);
+		goto done;
+	}
+
+	sim_report(out, sim, totals);
+	if (sim->timing) timing_report(out, sim->timing, sim->steps);
+	if (sim->prof) memprof_report(out, sim->prof, sim->memory, SIM_MEMORY);
+
+done:
+	if (close_text(s, out, capacity) < 0) return -3;
+	return rc;
+}
+
+int session_lanes(struct session *s, struct lanes *lanes, uint count, uint64_t seed,
+                  uint64_t max_steps, struct simulation *totals)
+{
+	size_t capacity = LANES_REPORT_SIZE(count);
+	FILE  *out;
+	int    rc;
+
+	s->text = arena_push(&s->arena, capacity);
+
+	out = fmemopen(s->text, capacity, "w");
+	if (!out) return -3;
+
+	rc = lanes_run(out, lanes, &s->image, count, seed, max_steps, totals);
+	if (close_text(s, out, capacity) < 0) return -3;
+	return rc;
+}
@@ -0,0 +1,100 @@
+#if !defined SESSION_H
+#define SESSION_H
+
+#include "arena.h"
+#include "bitmap.h"
+#include "boundary.h"
+#include "decode.h"
+#include "estimate.h"
+#include "format.h"
+#include "image.h"
+#include "lanes.h"
+#include "live.h"
+#include "memprof.h"
+#include "shrink.h"
+#include "sim.h"
+#include "trace.h"
+#include "xref.h"
+
+// session flags on top of SCAN_*: build s->xref and comment label lines with it
+#define SESSION_XREF 0x100
+// session_live reports dead register writes instead of a listing
+#define SESSION_LIVE 0x200
+// session_simulate runs the image instead of decoding it
+#define SESSION_SIM  0x400
+// with SESSION_SIM: room for a memprof report after the registers
+#define SESSION_MEMPROF 0x800
+// with SESSION_SIM: room for the clock totals
+#define SESSION_CLOCKS  0x1000
+// with SESSION_CLOCKS: one --compare row instead of the registers
+#define SESSION_COMPARE 0x2000
+// session_lanes runs many instances of the image instead of decoding it
+#define SESSION_LANES   0x4000
+// session_estimate reports static clocks per block and loop instead of a listing
+#define SESSION_ESTIMATE 0x8000
+// room for session_index after session_decode
+#define SESSION_INDEX    0x10000
+// session_shrink reports records with a shorter encoding instead of a listing
+#define SESSION_SHRINK   0x20000
+
+// everything one image needs lives in a single arena: raw bytes, decoded
+// records, label bits and the rendered text. session_reset() drops it all.
+struct session
+{
+	struct arena  arena;
+	OUTPUT        output;
+	uint          flags;    // SCAN_* for session_decode, SESSION_*
+
+	const char   *path;     // as given to session_load, owned by the caller
+	uint8        *raw;      // load module, image.data
+	uint          size;
+	struct image  image;
+
+	Instruction  *instructions;
+	uint          count;
+	struct bitmap labels;
+	struct xref   xref;     // SESSION_XREF only
+
+	char         *text;
+	size_t        text_size;
+};
+
+extern void session_init(struct session *s, OUTPUT output, uint flags);
+extern void session_free(struct session *s);
+extern void session_reset(struct session *s);
+
+// arena bytes needed for an image of `size` bytes
+extern size_t session_footprint(uint size, OUTPUT output, uint flags);
+
+extern int session_load(struct session *s, const char *path);
+// session_load in two steps, for bytes that don't come from a path: reserve
+// the arena for a `size` byte file and return where it goes (NULL when out
+// of memory), fill it, then session_open parses it into s->image
+extern uint8 *session_reserve(struct session *s, const char *path, uint size);
+extern int    session_open(struct session *s);
+// instead of session_reserve: read the regular file behind fd into the arena
+extern int    session_read(struct session *s, int fd, const char *path);
+extern int session_decode(struct session *s);
+extern int session_render(struct session *s);
+// write the record boundaries of the decoded image to <path>.idx (see boundary.h)
+extern int session_index(struct session *s);
+extern int session_live(struct session *s, struct liveness *totals);
+// clocks per block and loop from the tables, without running the image;
+// trips may be NULL
+extern int session_estimate(struct session *s, const struct estimate_trips *trips,
+                            struct estimation *totals);
+// records with a shorter encoding, per block, and the fetch clocks they'd save
+extern int session_shrink(struct session *s, struct shrinkage *totals);
+// run the loaded image on sim (tracing every step to trace_path if it isn't
+// NULL) and report the final registers instead of a listing, followed by
+// the memory profile if sim->prof is set and the clocks if sim->timing is.
+// SESSION_COMPARE makes it one timing_compare_row instead.
+extern int session_simulate(struct session *s, struct sim *sim, struct trace *trace,
+                            const char *trace_path, uint64_t max_steps,
+                            struct simulation *totals);
+// run `count` instances of the loaded image in lockstep (see lanes.h) and
+// report every lane's registers
+extern int session_lanes(struct session *s, struct lanes *lanes, uint count, uint64_t seed,
+                         uint64_t max_steps, struct simulation *totals);
+
+#endif // SESSION_H
@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include "shrink.h"
+#include "timing.h"
+
+static const char *const kind_names[SHRINK_KINDS] = {
+	"imm8", "acc", "reg-imm", "acc-mem", "reg", "disp8", "disp0",
+};
+
+// prefetch clocks `bytes` cost: one bus cycle per byte on the 8088, per
+// word on the 8086
+#define FETCH_8088(bytes) ((bytes) * TIMING_BUS_CYCLE)
+#define FETCH_8086(bytes) ((bytes) * TIMING_BUS_CYCLE / 2)
+
+static int fits8(uint16 value)
+{
+	return (int16)value == (int8)value;
+}
+
+static int same_operand(const Operand *a, const Operand *b)
+{
+	uint32 mask = a->width == 1 ? 0xFF : 0xFFFF;
+
+	return a->kind == b->kind && a->reg == b->reg && a->width == b->width &&
+	       a->segment == b->segment && ((uint32)a->value & mask) == ((uint32)b->value & mask);
+}
+
+// the same instruction whatever the encoding: mnemonic, prefixes and the
+// operands decode_instruction would print, xchg either way round
+static int same_instruction(const Instruction *instruction, Instruction *shorter)
+{
+	const uint8 folded = PFX_LOCK | PFX_REP | PFX_REPNE | PFX_SGMNT | PFX_SGMNT_DS;
+	Instruction original = *instruction;
+	Operand a[2], b[2];
+
+	if (original.structure.type != shorter->structure.type) return 0;
+	if ((original.structure.prefixes ^ shorter->structure.prefixes) & folded) return 0;
+
+	shorter->segment = original.segment;
+	shorter->offset  = original.offset;
+
+	if (get_operands(&original, a) != get_operands(shorter, b)) return 0;
+	if (same_operand(a, b) && same_operand(a + 1, b + 1)) return 1;
+
+	return original.structure.type == XCHG && same_operand(a, b + 1) && same_operand(a + 1, b);
+}
+
+int shrink_record(const Instruction *instruction, const uint8 *bytes,
+                  uint8 out[DECODE_MAX_SIZE], uint *why)
+{
+	const InstructionData *structure = &instruction->structure;
+	Instruction shorter;
+	const uint8 *imm;
+	uint8  op, mod, reg, rm;
+	uint   p = PREFIX_SIZE(instruction->prefix_order), disp_size, imm_size, len;
+	uint16 disp = 0, data;
+
+	*why = 0;
+
+	switch (structure->format) {
+	case RM:
+	case RM_V:
+	case RM_SR:
+	case RM_REG:
+	case RM_IMM:
+		break;
+	default:
+		return 0;
+	}
+
+	op  = bytes[p];
+	mod = MOD(bytes[p + 1]);
+	reg = REG(bytes[p + 1]);
+	rm  = RM(bytes[p + 1]);
+
+	disp_size = mod == MODE_MEM8 ? 1 : mod == MODE_MEM16 || (mod == MODE_MEM0 && rm == 0b110) ? 2 : 0;
+	if (disp_size == 1) disp = (int8)bytes[p + 2];
+	if (disp_size == 2) disp = bytes[p + 2] | bytes[p + 3] << 8;
+
+	imm      = bytes + p + 2 + disp_size;
+	imm_size = structure->size - p - 2 - disp_size;
+	data     = imm_size == 2 ? imm[0] | imm[1] << 8 : imm_size ? imm[0] : 0;
+
+	// the displacement first, the opcode rules below keep whatever it became
+	if ((mod == MODE_MEM8 || mod == MODE_MEM16) && disp == 0 && rm != 0b110) {
+		mod       = MODE_MEM0;
+		disp_size = 0;
+		*why     |= SHRINK_DISP0;
+	} else if (mod == MODE_MEM16 && fits8(disp)) {
+		mod       = MODE_MEM8;
+		disp_size = 1;
+		*why     |= SHRINK_DISP8;
+	}
+
+	memcpy(out, bytes, p);
+	len = p;
+
+	// forms without a ModRM byte: the opcode, then its immediate or address
+	if (mod == MODE_REG && (op == 0x80 || op == 0x81 || op == 0x82) && rm == 0) {
+		out[len++] = reg << 3 | 0x04 | (op & 1);
+		*why       = SHRINK_ACC;
+	} else if (mod == MODE_REG && (op == 0xF6 || op == 0xF7) && reg == 0 && rm == 0) {
+		out[len++] = 0xA8 | (op & 1);
+		*why       = SHRINK_ACC;
+	} else if (mod == MODE_REG && (op == 0xC6 || op == 0xC7) && reg == 0) {
+		out[len++] = 0xB0 | (op & 1) << 3 | rm;
+		*why       = SHRINK_REG_IMM;
+	} else if (mod == MODE_REG && op == 0xFF && (reg == 0 || reg == 1 || reg == 6)) {
+		out[len++] = (reg == 6 ? 0x50 : 0x40 | reg << 3) | rm;
+		*why       = SHRINK_REG;
+	} else if (mod == MODE_REG && op == 0x8F && reg == 0) {
+		out[len++] = 0x58 | rm;
+		*why       = SHRINK_REG;
+	} else if (mod == MODE_REG && op == 0x87 && (reg == 0 || rm == 0)) {
+		out[len++] = 0x90 | reg | rm;
+		*why       = SHRINK_REG;
+	} else if (mod == MODE_MEM0 && rm == 0b110 && reg == 0 && op >= 0x88 && op <= 0x8B) {
+		// 0x8A/0x8B load into al/ax, 0xA0/0xA1 too; the stores go to 0xA2/0xA3
+		out[len++] = 0xA0 | (op & 2 ? 0 : 2) | (op & 1);
+		out[len++] = disp & 0xFF;
+		out[len++] = disp >> 8;
+		*why       = SHRINK_ACC_MEM;
+		imm_size   = 0;
+	} else {
+		if (op == 0x81 && fits8(data)) {
+			op        = 0x83;
+			imm_size  = 1;
+			*why     |= SHRINK_IMM8;
+		}
+
+		out[len++] = op;
+		out[len++] = mod << 6 | reg << 3 | rm;
+		if (disp_size >= 1) out[len++] = disp & 0xFF;
+		if (disp_size == 2) out[len++] = disp >> 8;
+	}
+
+	if (imm_size >= 1) out[len++] = data & 0xFF;
+	if (imm_size == 2) out[len++] = data >> 8;
+
+	// only what decodes back to the same instruction, in fewer bytes, counts
+	if (!*why || len >= structure->size || parse_instruction(&shorter, out, len, 0) < 0 ||
+	    shorter.structure.size != len || !same_instruction(instruction, &shorter)) {
+		*why = 0;
+		return 0;
+	}
+
+	return len;
+}
+
+static void put_bytes(FILE *out, const uint8 *bytes, uint count)
+{
+	uint i;
+
+	for (i = 0; i < count; ++i) fprintf(out, i ? " %02X" : "%02X", bytes[i]);
+}
+
+void shrink_report(FILE *out, const struct live *live, Instruction *instructions,
+                   const uint8 *data, struct shrinkage *totals)
+{
+	const struct live_block *block;
+	Instruction unlabeled;
+	const char *separator;
+	uint8 bytes[DECODE_MAX_SIZE];
+	uint  b, i, k, why, shorter = 0, saved = 0, blocks = 0, block_shorter, block_saved;
+	int   len;
+
+	fprintf(out, "; shorter encodings; fetch clocks: a bus cycle per byte on the 8088, per word "
+	             "on the 8086\n");
+
+	for (b = 0; b < live->block_count; ++b) {
+		block         = live->blocks + b;
+		block_shorter = block_saved = 0;
+
+		for (i = block->first; i <= block->last; ++i) {
+			len = shrink_record(instructions + i, data + instructions[i].offset, bytes, &why);
+			if (len == 0) continue;
+
+			unlabeled = instructions[i];
+			unlabeled.structure.flags &= ~MASK_LB;
+
+			fprintf(out, "0x%04X  ", instructions[i].offset);
+			decode_instruction(out, &unlabeled);
+			fputs(" ; ", out);
+			put_bytes(out, data + instructions[i].offset, instructions[i].structure.size);
+			fputs(" -> ", out);
+			put_bytes(out, bytes, len);
+
+			for (k = 0, separator = ", "; k < SHRINK_KINDS; ++k) {
+				if (!(why & 1u << k)) continue;
+
+				fprintf(out, "%s%s", separator, kind_names[k]);
+				separator = " ";
+				totals->kinds[k]++;
+			}
+
+			fputc('\n', out);
+			block_shorter++;
+			block_saved += instructions[i].structure.size - len;
+		}
+
+		if (!block_shorter) continue;
+
+		fprintf(out, "; block 0x%04X..0x%04X: %u of %u instructions, %u bytes, "
+		             "%u clocks on the 8088, %u on the 8086\n",
+		        instructions[block->first].offset, instructions[block->last].offset, block_shorter,
+		        block->last - block->first + 1, block_saved, FETCH_8088(block_saved),
+		        FETCH_8086(block_saved));
+
+		shorter += block_shorter;
+		saved   += block_saved;
+		blocks++;
+	}
+
+	fprintf(out, "; %u of %u instructions in %u of %u blocks have a shorter form: %u bytes, "
+	             "%u clocks on the 8088, %u on the 8086\n",
+	        shorter, live->count, blocks, live->block_count, saved, FETCH_8088(saved),
+	        FETCH_8086(saved));
+
+	totals->files++;
+	totals->instructions += live->count;
+	totals->shorter      += shorter;
+	totals->bytes        += saved;
+}
+
+void shrink_merge(struct shrinkage *into, const struct shrinkage *from)
+{
+	uint k;
+
+	into->files        += from->files;
+	into->instructions += from->instructions;
+	into->shorter      += from->shorter;
+	into->bytes        += from->bytes;
+
+	for (k = 0; k < SHRINK_KINDS; ++k) into->kinds[k] += from->kinds[k];
+}
+
+void shrink_print(FILE *out, const struct shrinkage *totals)
+{
+	uint k;
+
+	fprintf(out, "shrink: %llu of %llu instructions have a shorter form, %llu bytes, "
+	        "%llu clocks on the 8088, %llu on the 8086 (",
+	        (unsigned long long)totals->shorter, (unsigned long long)totals->instructions,
+	        (unsigned long long)totals->bytes, (unsigned long long)FETCH_8088(totals->bytes),
+	        (unsigned long long)FETCH_8086(totals->bytes));
+
+	for (k = 0; k < SHRINK_KINDS; ++k)
+		fprintf(out, "%s%s %llu", k ? ", " : "", kind_names[k], (unsigned long long)totals->kinds[k]);
+
+	fprintf(out, "), %llu files\n", (unsigned long long)totals->files);
+}
@@ -0,0 +1,50 @@
+#if !defined SHRINK_H
+#define SHRINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "live.h"
+
+// why a record has a shorter encoding, any combination of them
+#define SHRINK_IMM8    0x01 // 0x81 whose imm16 fits 0x83's sign-extended imm8
+#define SHRINK_ACC     0x02 // al/ax and an immediate through ModRM (0x80..0x82, 0xF6, 0xF7)
+#define SHRINK_REG_IMM 0x04 // mov r, imm through 0xC6/0xC7 instead of 0xB0..0xBF
+#define SHRINK_ACC_MEM 0x08 // mov al/ax to or from a direct address through ModRM
+#define SHRINK_REG     0x10 // inc, dec, push, pop or xchg ax on a word register through ModRM
+#define SHRINK_DISP8   0x20 // mod=10 whose disp16 fits mod=01's disp8
+#define SHRINK_DISP0   0x40 // a zero displacement mod=00 can drop, [bp] aside
+#define SHRINK_KINDS   7
+
+// "0x1234  <record> ; 81 C0 05 00 -> 05 05 00, acc disp8" and the block
+// line that follows the last record of a block
+#define SHRINK_LINE       (16 + DECODE_MAX_LINE + 80)
+#define SHRINK_BLOCK_LINE 96
+#define SHRINK_REPORT_SIZE(count) (256 + (size_t)(count) * (SHRINK_LINE + SHRINK_BLOCK_LINE))
+
+// totals over every file, merged after the batch like struct liveness
+struct shrinkage
+{
+	uint64_t files;
+	uint64_t instructions;
+	uint64_t shorter;
+	uint64_t bytes;
+	uint64_t kinds[SHRINK_KINDS];
+};
+
+// the shortest encoding of the record at `bytes` that decodes to the same
+// instruction, in out; its length, or 0 (and *why 0) if there is none
+extern int shrink_record(const Instruction *instruction, const uint8 *bytes,
+                         uint8 out[DECODE_MAX_SIZE], uint *why);
+
+// every record with a shorter form, block by block with what each block
+// saves: bytes, and the prefetch clocks they cost (a bus cycle per byte on
+// the 8088, per word on the 8086); counts into totals
+extern void shrink_report(FILE *out, const struct live *live, Instruction *instructions,
+                          const uint8 *data, struct shrinkage *totals);
+extern void shrink_merge(struct shrinkage *into, const struct shrinkage *from);
+extern void shrink_print(FILE *out, const struct shrinkage *totals);
+
+#endif // SHRINK_H
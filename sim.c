@@ -0,0 +1,939 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memprof.h"
+#include "sim.h"
+#include "trace.h"
+
+#define MEMORY_MASK (SIM_MEMORY - 1)
+
+#define GPR(s, r) ((s)->state.regs[SIM_##r])
+#define SEG(s, r) ((s)->state.sregs[SIM_##r])
+
+int sim_init(struct sim *sim)
+{
+	memset(sim, 0, sizeof(*sim));
+
+	sim->memory = malloc(SIM_MEMORY);
+	return sim->memory ? 0 : -3;
+}
+
+void sim_free(struct sim *sim)
+{
+	free(sim->memory);
+	sim->memory = NULL;
+}
+
+static uint32 linear(uint16 segment, uint16 offset)
+{
+	return ((uint32)segment * 16 + offset) & MEMORY_MASK;
+}
+
+void sim_load(struct sim *sim, const struct image *image)
+{
+	memset(sim->memory, 0, SIM_MEMORY);
+	sim_place(sim, image);
+}
+
+void sim_place(struct sim *sim, const struct image *image)
+{
+	uint32 load = image->kind == IMAGE_COM ? 0x100 : 0;
+	uint   size = image->size;
+
+	memset(&sim->state, 0, sizeof(sim->state));
+
+	if (size > SIM_MEMORY - load) size = SIM_MEMORY - load;
+	memcpy(sim->memory + load, image->data, size);
+
+	sim->code_start  = load;
+	sim->code_end    = load + size;
+	sim->steps       = 0;
+	sim->stop        = SIM_RUNNING;
+	sim->write_width = 0;
+
+	sim->state.ip            = image->entry_ip;
+	sim->state.sregs[SIM_CS] = image->entry_cs;
+
+	switch (image->kind) {
+	case IMAGE_COM:
+		// a ret from the program pops the 0 DOS leaves on the stack and lands
+		// outside the image
+		GPR(sim, SP) = 0xFFFE;
+		break;
+	case IMAGE_MZ:
+		sim->state.sregs[SIM_SS] = image->entry_ss;
+		sim->state.regs[SIM_SP]  = image->entry_sp;
+		break;
+	case IMAGE_RAW:
+		break;
+	}
+
+	sim->initial_sp = GPR(sim, SP);
+
+	if (sim->timing) timing_reset(sim->timing, linear(SEG(sim, CS), sim->state.ip));
+}
+
+static void profile(struct sim *sim, uint32 address, uint8 width, int store)
+{
+	// strides follow the first access of each execution
+	memprof_access(sim->prof, sim->site, !sim->accessed, address, width, sim->form, store);
+	sim->accessed = 1;
+}
+
+// bus transfers of the current step, for the timing model
+static void count_transfer(struct sim *sim, uint32 address, uint8 width)
+{
+	sim->cost.transfers++;
+	sim->cost.words += width == 2;
+	sim->cost.odd   += width == 2 && (address & 1);
+}
+
+static uint16 read_mem(struct sim *sim, uint16 segment, uint16 offset, uint8 width)
+{
+	uint16 value = sim->memory[linear(segment, offset)];
+
+	if (sim->prof) profile(sim, linear(segment, offset), width, 0);
+	count_transfer(sim, linear(segment, offset), width);
+
+	// the offset wraps inside the segment
+	if (width == 2) value |= sim->memory[linear(segment, offset + 1)] << 8;
+	return value;
+}
+
+static void mark_page(uint32 *dirty, uint32 address)
+{
+	address >>= SIM_PAGE_SHIFT;
+	dirty[address / 32] |= 1u << (address % 32);
+}
+
+static void write_mem(struct sim *sim, uint16 segment, uint16 offset, uint8 width, uint16 value)
+{
+	sim->memory[linear(segment, offset)] = value & 0xFF;
+	if (width == 2) sim->memory[linear(segment, offset + 1)] = value >> 8;
+
+	if (sim->dirty) {
+		mark_page(sim->dirty, linear(segment, offset));
+		if (width == 2) mark_page(sim->dirty, linear(segment, offset + 1));
+	}
+
+	sim->write_addr  = linear(segment, offset);
+	sim->write_value = width == 2 ? value : value & 0xFF;
+	sim->write_width = width;
+
+	if (sim->prof) profile(sim, sim->write_addr, width, 1);
+	count_transfer(sim, sim->write_addr, width);
+}
+
+static uint16 read_reg(struct sim *sim, uint8 reg, uint8 width)
+{
+	if (width == 2) return sim->state.regs[reg];
+
+	// al cl dl bl, then ah ch dh bh
+	return reg < 4 ? sim->state.regs[reg] & 0xFF : sim->state.regs[reg - 4] >> 8;
+}
+
+static void write_reg(struct sim *sim, uint8 reg, uint8 width, uint16 value)
+{
+	uint16 *word;
+
+	if (width == 2) {
+		sim->state.regs[reg] = value;
+		return;
+	}
+
+	word  = sim->state.regs + (reg & 0b11);
+	*word = reg < 4 ? (*word & 0xFF00) | (value & 0xFF) : (*word & 0x00FF) | (value & 0xFF) << 8;
+}
+
+// segment the data access of `instruction` goes through when bp isn't involved
+static uint16 data_segment(struct sim *sim, const Instruction *instruction, uint8 sr)
+{
+	if (instruction->structure.prefixes & PFX_SGMNT)
+		sr = SGMNT_OP(instruction->structure.prefixes);
+
+	return sim->state.sregs[sr];
+}
+
+// offset and segment of a memory operand
+static uint16 effective_address(struct sim *sim, const Instruction *instruction,
+                                const Operand *op, uint16 *segment)
+{
+	uint16 *r = sim->state.regs;
+	uint16  base;
+	uint8   sr = SIM_DS;
+
+	switch (op->reg) {
+	case 0: base = r[SIM_BX] + r[SIM_SI]; break;
+	case 1: base = r[SIM_BX] + r[SIM_DI]; break;
+	case 2: base = r[SIM_BP] + r[SIM_SI]; sr = SIM_SS; break;
+	case 3: base = r[SIM_BP] + r[SIM_DI]; sr = SIM_SS; break;
+	case 4: base = r[SIM_SI]; break;
+	case 5: base = r[SIM_DI]; break;
+	case 6: base = r[SIM_BP]; sr = SIM_SS; break;
+	case 7: base = r[SIM_BX]; break;
+	default: base = 0; break; // EA_DIRECT, value is the address
+	}
+
+	*segment  = data_segment(sim, instruction, sr);
+	sim->form = op->reg;
+	return base + (uint16)op->value;
+}
+
+static uint16 read_op(struct sim *sim, const Instruction *instruction, const Operand *op)
+{
+	uint16 segment, offset;
+
+	switch (op->kind) {
+	case OPERAND_REG:
+		return read_reg(sim, op->reg, op->width);
+	case OPERAND_SREG:
+		return sim->state.sregs[op->reg];
+	case OPERAND_MEM:
+		offset = effective_address(sim, instruction, op, &segment);
+		return read_mem(sim, segment, offset, op->width);
+	case OPERAND_IMM:
+		return op->width == 2 ? (uint16)op->value : op->value & 0xFF;
+	default:
+		return 0;
+	}
+}
+
+static void write_op(struct sim *sim, const Instruction *instruction, const Operand *op,
+                     uint16 value)
+{
+	uint16 segment, offset;
+
+	switch (op->kind) {
+	case OPERAND_REG:
+		write_reg(sim, op->reg, op->width, value);
+		break;
+	case OPERAND_SREG:
+		sim->state.sregs[op->reg] = value;
+		break;
+	case OPERAND_MEM:
+		offset = effective_address(sim, instruction, op, &segment);
+		write_mem(sim, segment, offset, op->width, value);
+		break;
+	default:
+		assert(0 && "not a destination");
+		break;
+	}
+}
+
+static void push(struct sim *sim, uint16 value)
+{
+	sim->form = MEMPROF_IMPLICIT;
+	GPR(sim, SP) -= 2;
+	write_mem(sim, SEG(sim, SS), GPR(sim, SP), 2, value);
+}
+
+static uint16 pop(struct sim *sim)
+{
+	uint16 value;
+
+	sim->form = MEMPROF_IMPLICIT;
+	value     = read_mem(sim, SEG(sim, SS), GPR(sim, SP), 2);
+
+	GPR(sim, SP) += 2;
+	return value;
+}
+
+static void set_flag(struct sim *sim, uint16 bit, int on)
+{
+	if (on) sim->state.flags |= bit;
+	else    sim->state.flags &= ~bit;
+}
+
+static int flag(const struct sim *sim, uint16 bit)
+{
+	return !!(sim->state.flags & bit);
+}
+
+// sign, zero and parity (of the low byte) of a result
+static void set_szp(struct sim *sim, uint16 result, uint8 width)
+{
+	uint16 sign = width == 2 ? 0x8000 : 0x80;
+	uint8  low  = result & 0xFF;
+
+	low ^= low >> 4;
+
+	set_flag(sim, SIM_SF, result & sign);
+	set_flag(sim, SIM_ZF, (result & (width == 2 ? 0xFFFF : 0xFF)) == 0);
+	set_flag(sim, SIM_PF, !((0x6996 >> (low & 0xF)) & 1));
+}
+
+// add, adc, sub, sbb, cmp and the logic ops, flags included
+static uint16 alu(struct sim *sim, TYPE type, uint16 a, uint16 b, uint8 width)
+{
+	uint32 mask  = width == 2 ? 0xFFFF : 0xFF;
+	uint32 sign  = width == 2 ? 0x8000 : 0x80;
+	uint32 carry = 0, r;
+
+	switch (type) {
+	case ADC:
+		carry = flag(sim, SIM_CF);
+		// fallthrough
+	case ADD:
+		r = (uint32)a + b + carry;
+		set_flag(sim, SIM_CF, r > mask);
+		set_flag(sim, SIM_OF, (a ^ r) & (b ^ r) & sign);
+		set_flag(sim, SIM_AF, (a ^ b ^ r) & 0x10);
+		break;
+	case SBB:
+		carry = flag(sim, SIM_CF);
+		// fallthrough
+	case SUB:
+	case CMP:
+	case CMPSB:
+	case CMPSW:
+	case SCASB:
+	case SCASW:
+		r = (uint32)a - b - carry;
+		set_flag(sim, SIM_CF, (uint32)b + carry > a);
+		set_flag(sim, SIM_OF, (a ^ b) & (a ^ r) & sign);
+		set_flag(sim, SIM_AF, (a ^ b ^ r) & 0x10);
+		break;
+	case AND:
+	case TEST:
+		r = a & b;
+		goto logic;
+	case OR:
+		r = a | b;
+		goto logic;
+	case XOR:
+		r = a ^ b;
+	logic:
+		sim->state.flags &= ~(SIM_CF | SIM_OF | SIM_AF);
+		break;
+	default:
+		assert(0 && "not an alu op");
+		return 0;
+	}
+
+	r &= mask;
+	set_szp(sim, r, width);
+	return r;
+}
+
+// rol ror rcl rcr shl shr sar by count, one bit at a time like the 8086
+static uint16 shift(struct sim *sim, TYPE type, uint16 value, uint8 count, uint8 width)
+{
+	uint16 sign = width == 2 ? 0x8000 : 0x80;
+	uint16 mask = width == 2 ? 0xFFFF : 0xFF;
+	uint16 r = value & mask;
+	int    cf = flag(sim, SIM_CF), of = flag(sim, SIM_OF), in;
+
+	if (count == 0) return r;
+
+	while (count--) {
+		switch (type) {
+		case ROL: cf = !!(r & sign); r = (r << 1) | cf;                      break;
+		case ROR: cf = r & 1;        r = (r >> 1) | (cf ? sign : 0);         break;
+		case RCL: in = cf; cf = !!(r & sign); r = (r << 1) | in;             break;
+		case RCR: in = cf; cf = r & 1; r = (r >> 1) | (in ? sign : 0);       break;
+		case SHL: cf = !!(r & sign); r <<= 1;                                break;
+		case SHR: of = !!(r & sign); cf = r & 1; r >>= 1;                    break;
+		case SAR: cf = r & 1; r = (r >> 1) | (r & sign);                     break;
+		default:  assert(0 && "not a shift"); return r;
+		}
+		r &= mask;
+	}
+
+	// the overflow flag is only defined for one-bit shifts, this is what a
+	// one-bit shift of the last value gives
+	switch (type) {
+	case ROL: case RCL: case SHL: of = !!(r & sign) ^ cf;                 break;
+	case ROR: case RCR:           of = !!(r & sign) ^ !!(r & (sign >> 1)); break;
+	case SAR:                     of = 0;                                 break;
+	default: break;
+	}
+
+	set_flag(sim, SIM_CF, cf);
+	set_flag(sim, SIM_OF, of);
+	if (type == SHL || type == SHR || type == SAR) set_szp(sim, r, width);
+	return r;
+}
+
+static SIM_STOP multiply(struct sim *sim, TYPE type, uint16 value, uint8 width)
+{
+	uint32 r;
+	int32_t s;
+	int    over;
+
+	if (width == 1) {
+		if (type == MUL) {
+			r    = (GPR(sim, AX) & 0xFF) * (value & 0xFF);
+			over = r > 0xFF;
+		} else {
+			s    = (int8)GPR(sim, AX) * (int8)value;
+			r    = (uint32)s;
+			over = s != (int8)s;
+		}
+		GPR(sim, AX) = r;
+	} else {
+		if (type == MUL) {
+			r    = (uint32)GPR(sim, AX) * value;
+			over = r > 0xFFFF;
+		} else {
+			s    = (int32_t)(int16)GPR(sim, AX) * (int16)value;
+			r    = (uint32)s;
+			over = s != (int16)s;
+		}
+		GPR(sim, AX) = r;
+		GPR(sim, DX) = r >> 16;
+	}
+
+	set_flag(sim, SIM_CF, over);
+	set_flag(sim, SIM_OF, over);
+	return SIM_RUNNING;
+}
+
+static SIM_STOP divide(struct sim *sim, TYPE type, uint16 value, uint8 width)
+{
+	uint32 n, q, r;
+	int32_t sn, sd, sq;
+
+	if (type == DIV) {
+		if (width == 1) {
+			n = GPR(sim, AX);
+			if ((value & 0xFF) == 0 || n / (value & 0xFF) > 0xFF) return SIM_DIVIDE;
+			q = n / (value & 0xFF);
+			r = n % (value & 0xFF);
+			GPR(sim, AX) = (r << 8) | q;
+		} else {
+			n = (uint32)GPR(sim, DX) << 16 | GPR(sim, AX);
+			if (value == 0 || n / value > 0xFFFF) return SIM_DIVIDE;
+			GPR(sim, AX) = n / value;
+			GPR(sim, DX) = n % value;
+		}
+		return SIM_RUNNING;
+	}
+
+	if (width == 1) {
+		sn = (int16)GPR(sim, AX);
+		sd = (int8)value;
+		if (sd == 0) return SIM_DIVIDE;
+		sq = sn / sd;
+		if (sq > 127 || sq < -127) return SIM_DIVIDE;
+		GPR(sim, AX) = ((uint16)(sn % sd) & 0xFF) << 8 | ((uint16)sq & 0xFF);
+	} else {
+		sn = (int32_t)((uint32)GPR(sim, DX) << 16 | GPR(sim, AX));
+		sd = (int16)value;
+		if (sd == 0 || (sd == -1 && sn == INT32_MIN)) return SIM_DIVIDE;
+		sq = sn / sd;
+		if (sq > 32767 || sq < -32767) return SIM_DIVIDE;
+		GPR(sim, AX) = sq;
+		GPR(sim, DX) = sn % sd;
+	}
+
+	return SIM_RUNNING;
+}
+
+// daa das aaa aas aam aad, al/ah only
+static SIM_STOP adjust(struct sim *sim, TYPE type, uint8 base)
+{
+	uint8 al = GPR(sim, AX) & 0xFF, ah = GPR(sim, AX) >> 8, old = al;
+	int   cf = flag(sim, SIM_CF), low = (al & 0xF) > 9 || flag(sim, SIM_AF);
+
+	switch (type) {
+	case DAA:
+	case DAS:
+		if (low) al += type == DAA ? 6 : -6;
+		set_flag(sim, SIM_AF, low);
+		if (old > 0x99 || cf) {
+			al += type == DAA ? 0x60 : -0x60;
+			cf  = 1;
+		} else {
+			cf  = 0;
+		}
+		set_flag(sim, SIM_CF, cf);
+		set_szp(sim, al, 1);
+		break;
+	case AAA:
+	case AAS:
+		if (low) {
+			al += type == AAA ? 6 : -6;
+			ah += type == AAA ? 1 : -1;
+		}
+		al &= 0xF;
+		set_flag(sim, SIM_AF, low);
+		set_flag(sim, SIM_CF, low);
+		break;
+	case AAM:
+		if (base == 0) return SIM_DIVIDE;
+		ah = al / base;
+		al = al % base;
+		set_szp(sim, al, 1);
+		break;
+	case AAD:
+		al = al + ah * base;
+		ah = 0;
+		set_szp(sim, al, 1);
+		break;
+	default:
+		assert(0 && "not an adjust op");
+		break;
+	}
+
+	GPR(sim, AX) = ah << 8 | al;
+	return SIM_RUNNING;
+}
+
+static int condition(const struct sim *sim, TYPE type)
+{
+	int cf = flag(sim, SIM_CF), zf = flag(sim, SIM_ZF), sf = flag(sim, SIM_SF);
+	int of = flag(sim, SIM_OF), pf = flag(sim, SIM_PF);
+
+	switch (type) {
+	case JO:  return of;
+	case JNO: return !of;
+	case JB:  return cf;
+	case JAE: return !cf;
+	case JE:  return zf;
+	case JNE: return !zf;
+	case JBE: return cf || zf;
+	case JA:  return !cf && !zf;
+	case JS:  return sf;
+	case JNS: return !sf;
+	case JP:  return pf;
+	case JPO: return !pf;
+	case JL:  return sf != of;
+	case JGE: return sf == of;
+	case JLE: return zf || sf != of;
+	case JG:  return !zf && sf == of;
+	default:  return 1;
+	}
+}
+
+// one iteration of movs/cmps/scas/lods/stos; 1 if a rep prefix repeats it
+static int string_op(struct sim *sim, const Instruction *instruction)
+{
+	TYPE   type   = instruction->structure.type;
+	uint8  width  = (type == MOVSW || type == CMPSW || type == SCASW ||
+	                 type == LODSW || type == STOSW) ? 2 : 1;
+	uint8  rep    = instruction->structure.prefixes & (PFX_REP | PFX_REPNE);
+	uint16 step   = flag(sim, SIM_DF) ? -width : width;
+	uint16 source = data_segment(sim, instruction, SIM_DS);
+	uint16 a, b;
+
+	// rep with cx already 0 does nothing
+	if (rep && GPR(sim, CX) == 0) return 0;
+
+	switch (type) {
+	case MOVSB:
+	case MOVSW:
+		a = read_mem(sim, source, GPR(sim, SI), width);
+		write_mem(sim, SEG(sim, ES), GPR(sim, DI), width, a);
+		GPR(sim, SI) += step;
+		GPR(sim, DI) += step;
+		break;
+	case CMPSB:
+	case CMPSW:
+		a = read_mem(sim, source, GPR(sim, SI), width);
+		b = read_mem(sim, SEG(sim, ES), GPR(sim, DI), width);
+		alu(sim, type, a, b, width);
+		GPR(sim, SI) += step;
+		GPR(sim, DI) += step;
+		break;
+	case SCASB:
+	case SCASW:
+		b = read_mem(sim, SEG(sim, ES), GPR(sim, DI), width);
+		alu(sim, type, read_reg(sim, SIM_AX, width), b, width);
+		GPR(sim, DI) += step;
+		break;
+	case LODSB:
+	case LODSW:
+		write_reg(sim, SIM_AX, width, read_mem(sim, source, GPR(sim, SI), width));
+		GPR(sim, SI) += step;
+		break;
+	case STOSB:
+	case STOSW:
+		write_mem(sim, SEG(sim, ES), GPR(sim, DI), width, read_reg(sim, SIM_AX, width));
+		GPR(sim, DI) += step;
+		break;
+	default:
+		assert(0 && "not a string op");
+		return 0;
+	}
+
+	if (!rep || --GPR(sim, CX) == 0) return 0;
+
+	// repe/repne stop on the compare result
+	if (type == CMPSB || type == CMPSW || type == SCASB || type == SCASW)
+		return (rep & PFX_REP) ? flag(sim, SIM_ZF) : !flag(sim, SIM_ZF);
+
+	return 1;
+}
+
+// far pointer at a memory operand: offset, then segment
+static void read_far(struct sim *sim, const Instruction *instruction, const Operand *op,
+                     uint16 *offset, uint16 *segment)
+{
+	uint16 sr, at = effective_address(sim, instruction, op, &sr);
+
+	*offset  = read_mem(sim, sr, at, 2);
+	*segment = read_mem(sim, sr, at + 2, 2);
+}
+
+SIM_STOP sim_step(struct sim *sim)
+{
+	Instruction *instruction = &sim->current;
+	Operand  ops[2];
+	TYPE     type;
+	uint16   next, a, b, offset, segment;
+	uint8    width;
+	uint32   at = linear(SEG(sim, CS), sim->state.ip);
+	int      rc, jump = 0;
+
+	if (at < sim->code_start || at >= sim->code_end) return SIM_END;
+
+	rc = parse_instruction(instruction, sim->memory, SIM_MEMORY, at);
+	if (rc < 0 || instruction->structure.type == UNKNOWN) return SIM_INVALID;
+
+	type  = instruction->structure.type;
+	next  = sim->state.ip + instruction->structure.size;
+	width = W(instruction->structure.flags) + 1;
+
+	get_operands(instruction, ops);
+	sim->write_width = 0;
+	sim->site        = at - sim->code_start;
+	sim->form        = MEMPROF_IMPLICIT;
+	sim->accessed    = 0;
+	memset(&sim->cost, 0, sizeof(sim->cost));
+
+	switch (type) {
+	case MOV:
+		write_op(sim, instruction, ops, read_op(sim, instruction, ops + 1));
+		break;
+	case ADD: case ADC: case SUB: case SBB: case AND: case OR: case XOR:
+		a = alu(sim, type, read_op(sim, instruction, ops), read_op(sim, instruction, ops + 1),
+		        ops[0].width);
+		write_op(sim, instruction, ops, a);
+		break;
+	case CMP: case TEST:
+		alu(sim, type, read_op(sim, instruction, ops), read_op(sim, instruction, ops + 1),
+		    ops[0].width);
+		break;
+	case INC:
+	case DEC:
+		// cf is left alone
+		b = flag(sim, SIM_CF);
+		a = alu(sim, type == INC ? ADD : SUB, read_op(sim, instruction, ops), 1, ops[0].width);
+		set_flag(sim, SIM_CF, b);
+		write_op(sim, instruction, ops, a);
+		break;
+	case NEG:
+		a = alu(sim, SUB, 0, read_op(sim, instruction, ops), ops[0].width);
+		write_op(sim, instruction, ops, a);
+		break;
+	case NOT:
+		write_op(sim, instruction, ops, ~read_op(sim, instruction, ops));
+		break;
+	case ROL: case ROR: case RCL: case RCR: case SHL: case SHR: case SAR:
+		sim->cost.count = read_op(sim, instruction, ops + 1) & 0xFF;
+		a = shift(sim, type, read_op(sim, instruction, ops), sim->cost.count, ops[0].width);
+		write_op(sim, instruction, ops, a);
+		break;
+	case MUL:
+	case IMUL:
+		multiply(sim, type, read_op(sim, instruction, ops), ops[0].width);
+		break;
+	case DIV:
+	case IDIV:
+		if (divide(sim, type, read_op(sim, instruction, ops), ops[0].width) != SIM_RUNNING)
+			return SIM_DIVIDE;
+		break;
+	case DAA: case DAS: case AAA: case AAS: case AAD:
+		adjust(sim, type, instruction->data & 0xFF);
+		break;
+	case AAM:
+		if (adjust(sim, type, instruction->data & 0xFF) != SIM_RUNNING) return SIM_DIVIDE;
+		break;
+	case CBW:
+		GPR(sim, AX) = (uint16)(int8)GPR(sim, AX);
+		break;
+	case CWD:
+		GPR(sim, DX) = (GPR(sim, AX) & 0x8000) ? 0xFFFF : 0;
+		break;
+	case XCHG:
+		a = read_op(sim, instruction, ops);
+		b = read_op(sim, instruction, ops + 1);
+		write_op(sim, instruction, ops, b);
+		write_op(sim, instruction, ops + 1, a);
+		break;
+	case LEA:
+		a = effective_address(sim, instruction, ops + 1, &segment);
+		write_op(sim, instruction, ops, a);
+		break;
+	case LDS:
+	case LES:
+		read_far(sim, instruction, ops + 1, &offset, &segment);
+		write_op(sim, instruction, ops, offset);
+		sim->state.sregs[type == LDS ? SIM_DS : SIM_ES] = segment;
+		break;
+	case XLAT:
+		a = read_mem(sim, data_segment(sim, instruction, SIM_DS),
+		             GPR(sim, BX) + (GPR(sim, AX) & 0xFF), 1);
+		write_reg(sim, SIM_AX, 1, a);
+		break;
+
+	case PUSH:
+		push(sim, read_op(sim, instruction, ops));
+		break;
+	case POP:
+		write_op(sim, instruction, ops, pop(sim));
+		break;
+	case PUSHF:
+		push(sim, sim->state.flags | SIM_FLAGS_FIXED);
+		break;
+	case POPF:
+		sim->state.flags = pop(sim) & ~SIM_FLAGS_FIXED;
+		break;
+	case LAHF:
+		write_reg(sim, 4, 1, (sim->state.flags & 0xFF) | 0x02);
+		break;
+	case SAHF:
+		sim->state.flags = (sim->state.flags & 0xFF00) | (GPR(sim, AX) >> 8 & 0xD5);
+		break;
+	case CLC: set_flag(sim, SIM_CF, 0); break;
+	case STC: set_flag(sim, SIM_CF, 1); break;
+	case CMC: set_flag(sim, SIM_CF, !flag(sim, SIM_CF)); break;
+	case CLD: set_flag(sim, SIM_DF, 0); break;
+	case STD: set_flag(sim, SIM_DF, 1); break;
+	case CLI: set_flag(sim, SIM_IF, 0); break;
+	case STI: set_flag(sim, SIM_IF, 1); break;
+
+	case MOVSB: case MOVSW: case CMPSB: case CMPSW: case SCASB: case SCASW:
+	case LODSB: case LODSW: case STOSB: case STOSW:
+		// a repeating string op runs again from the same ip
+		if (string_op(sim, instruction)) {
+			next             = sim->state.ip;
+			sim->cost.repeat = 1;
+		}
+		sim->cost.count = sim->cost.transfers != 0;
+		break;
+
+	case IN:
+		// nothing is attached to any port, the bus floats high
+		write_reg(sim, SIM_AX, width, 0xFFFF);
+		break;
+	case OUT:
+		break;
+
+	case JO: case JNO: case JB: case JAE: case JE: case JNE: case JBE: case JA:
+	case JS: case JNS: case JP: case JPO: case JL: case JGE: case JLE: case JG:
+		jump = condition(sim, type);
+		break;
+	case LOOP:
+		jump = --GPR(sim, CX) != 0;
+		break;
+	case LOOPZ:
+		jump = --GPR(sim, CX) != 0 && flag(sim, SIM_ZF);
+		break;
+	case LOOPNZ:
+		jump = --GPR(sim, CX) != 0 && !flag(sim, SIM_ZF);
+		break;
+	case JCXZ:
+		jump = GPR(sim, CX) == 0;
+		break;
+
+	case CALL:
+	case JMP:
+		sim->cost.flush = 1;
+		if (instruction->structure.format == JMP_FAR) {
+			if (type == CALL) {
+				push(sim, SEG(sim, CS));
+				push(sim, next);
+			}
+			SEG(sim, CS) = instruction->data_ext;
+			next          = instruction->data;
+			break;
+		}
+
+		if (instruction->structure.format == RM) {
+			if (instruction->structure.prefixes & PFX_FAR) {
+				if (ops[0].kind != OPERAND_MEM) return SIM_INVALID;
+				read_far(sim, instruction, ops, &offset, &segment);
+				if (type == CALL) {
+					push(sim, SEG(sim, CS));
+					push(sim, next);
+				}
+				SEG(sim, CS) = segment;
+				next          = offset;
+			} else {
+				offset = read_op(sim, instruction, ops);
+				if (type == CALL) push(sim, next);
+				next = offset;
+			}
+			break;
+		}
+
+		if (type == CALL) push(sim, next);
+		jump = 1;
+		break;
+	case RET:
+	case RETF:
+	case IRET:
+		// listings are often a function body run on its own
+		if (GPR(sim, SP) == sim->initial_sp) return SIM_RETURN;
+		sim->cost.flush = 1;
+
+		next = pop(sim);
+		if (type != RET) SEG(sim, CS) = pop(sim);
+		if (type == IRET) sim->state.flags = pop(sim) & ~SIM_FLAGS_FIXED;
+		if (instruction->structure.format == IMM) GPR(sim, SP) += instruction->data;
+		break;
+
+	case INT:
+	case INT3:
+		return SIM_INT;
+	case INTO:
+		if (flag(sim, SIM_OF)) return SIM_INT;
+		break;
+	case HLT:
+		return SIM_HALT;
+
+	// prefixes that didn't fold, and esc with no 8087 to run it
+	case NOP: case WAIT: case LOCK: case REP: case REPNE: case SGMNT: case ESC:
+		break;
+
+	default:
+		return SIM_INVALID;
+	}
+
+	// relative branches are ip-relative inside the code segment
+	if (jump) {
+		if (instruction->structure.format == JMP_SHORT)
+			next += (int8)(instruction->data & 0xFF);
+		else
+			next += instruction->data;
+	}
+
+	if (sim->timing) {
+		sim->cost.taken  = jump;
+		sim->cost.flush |= jump;
+		timing_step(sim->timing, instruction, ops, &sim->cost, linear(SEG(sim, CS), next));
+	}
+
+	sim->state.ip = next;
+	sim->steps++;
+	return SIM_RUNNING;
+}
+
+SIM_STOP sim_run(struct sim *sim, uint64_t max_steps, struct trace *trace)
+{
+	struct sim_state before;
+	SIM_STOP stop = SIM_RUNNING;
+
+	if (trace) {
+		while (sim->steps < max_steps) {
+			before = sim->state;
+			stop   = sim_step(sim);
+			if (stop != SIM_RUNNING) break;
+
+			trace_step(trace, &before, sim);
+		}
+	} else {
+		while (sim->steps < max_steps && (stop = sim_step(sim)) == SIM_RUNNING) {}
+	}
+
+	sim->stop = stop == SIM_RUNNING ? SIM_STEPS : stop;
+	return sim->stop;
+}
+
+const char *sim_stop_name(SIM_STOP stop)
+{
+	switch (stop) {
+	case SIM_RUNNING: return "running";
+	case SIM_END:     return "end of image";
+	case SIM_HALT:    return "hlt";
+	case SIM_RETURN:  return "returned";
+	case SIM_INT:     return "interrupt";
+	case SIM_DIVIDE:  return "divide error";
+	case SIM_INVALID: return "invalid instruction";
+	case SIM_STEPS:   return "step limit";
+	default:          return "?";
+	}
+}
+
+int sim_flag_names(char *buf, uint16 flags)
+{
+	static const struct { uint16 bit; char name; } names[] = {
+		{ SIM_CF, 'C' }, { SIM_PF, 'P' }, { SIM_AF, 'A' }, { SIM_ZF, 'Z' }, { SIM_SF, 'S' },
+		{ SIM_TF, 'T' }, { SIM_IF, 'I' }, { SIM_DF, 'D' }, { SIM_OF, 'O' },
+	};
+	uint i;
+	int  len = 0;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+		if (flags & names[i].bit) buf[len++] = names[i].name;
+
+	buf[len] = '\0';
+	return len;
+}
+
+void sim_report(FILE *out, const struct sim *sim, struct simulation *totals)
+{
+	static const char *const sregs[] = { "es", "cs", "ss", "ds" };
+	char flags[16];
+	uint i;
+
+	fprintf(out, "; %llu instructions, stopped at %04X:%04X: %s",
+	        (unsigned long long)sim->steps, sim->state.sregs[SIM_CS], sim->state.ip,
+	        sim_stop_name(sim->stop));
+
+	if (sim->stop == SIM_INVALID) {
+		fprintf(out, " (byte 0x%02X)",
+		        sim->memory[linear(sim->state.sregs[SIM_CS], sim->state.ip)]);
+	} else if (sim->stop == SIM_INT || sim->stop == SIM_DIVIDE) {
+		fputs(" (", out);
+		decode_instruction(out, (Instruction *)&sim->current);
+		fputc(')', out);
+	}
+	fputc('\n', out);
+
+	for (i = 0; i < 8; ++i) {
+		if (sim->state.regs[i] == 0) continue;
+		fprintf(out, "%8s: 0x%04x (%u)\n", get_register_name(1, i), sim->state.regs[i],
+		        sim->state.regs[i]);
+	}
+
+	for (i = 0; i < 4; ++i) {
+		if (sim->state.sregs[i] == 0) continue;
+		fprintf(out, "%8s: 0x%04x (%u)\n", sregs[i], sim->state.sregs[i], sim->state.sregs[i]);
+	}
+
+	fprintf(out, "%8s: 0x%04x (%u)\n", "ip", sim->state.ip, sim->state.ip);
+
+	if (sim_flag_names(flags, sim->state.flags))
+		fprintf(out, "%8s: %s\n", "flags", flags);
+
+	sim_tally(totals, sim);
+}
+
+void sim_tally(struct simulation *totals, const struct sim *sim)
+{
+	totals->files++;
+	totals->steps += sim->steps;
+	if (sim_stopped_early(sim->stop)) totals->stopped++;
+}
+
+int sim_stopped_early(SIM_STOP stop)
+{
+	return stop != SIM_END && stop != SIM_HALT && stop != SIM_RETURN && stop != SIM_INT;
+}
+
+void sim_merge(struct simulation *into, const struct simulation *from)
+{
+	into->files   += from->files;
+	into->steps   += from->steps;
+	into->stopped += from->stopped;
+}
+
+void sim_print(FILE *out, const struct simulation *totals)
+{
+	fprintf(out, "simulated: %llu instructions in %llu files, %llu stopped early\n",
+	        (unsigned long long)totals->steps, (unsigned long long)totals->files,
+	        (unsigned long long)totals->stopped);
+}
@@ -0,0 +1,131 @@
+#if !defined SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "image.h"
+#include "timing.h"
+
+struct memprof;
+struct trace;
+
+// the whole 8086 address space, linear addresses wrap at 1M
+#define SIM_MEMORY (1u << 20)
+
+// granularity of the pages sim->dirty tracks
+#define SIM_PAGE_SHIFT 12
+#define SIM_PAGES      (SIM_MEMORY >> SIM_PAGE_SHIFT)
+
+// stop after this many steps unless told otherwise
+#define SIM_MAX_STEPS 100000000ull
+
+// upper bound on the text sim_report emits: stop line, 12 registers, ip and flags
+#define SIM_REPORT_SIZE (96 + DECODE_MAX_LINE + 14 * 32)
+
+// register file order is the modrm reg encoding (word registers) and the sr field
+enum { SIM_AX, SIM_CX, SIM_DX, SIM_BX, SIM_SP, SIM_BP, SIM_SI, SIM_DI };
+enum { SIM_ES, SIM_CS, SIM_SS, SIM_DS };
+
+#define SIM_CF 0x0001
+#define SIM_PF 0x0004
+#define SIM_AF 0x0010
+#define SIM_ZF 0x0040
+#define SIM_SF 0x0080
+#define SIM_TF 0x0100
+#define SIM_IF 0x0200
+#define SIM_DF 0x0400
+#define SIM_OF 0x0800
+
+// bits pushf sets that no instruction can clear
+#define SIM_FLAGS_FIXED 0xF002
+
+struct sim_state
+{
+	uint16 regs[8];
+	uint16 sregs[4];
+	uint16 ip;
+	uint16 flags;
+};
+
+typedef enum {
+	SIM_RUNNING,
+	SIM_END,      // ip left the loaded image
+	SIM_HALT,     // hlt
+	SIM_RETURN,   // ret with nothing pushed since the start
+	SIM_INT,      // int, int3 or into with OF: no interrupt table to go through
+	SIM_DIVIDE,   // divide error
+	SIM_INVALID,  // opcode that doesn't decode
+	SIM_STEPS,    // step limit
+} SIM_STOP;
+
+// one image loaded into its own 1M of memory; the memory is kept between images
+struct sim
+{
+	struct sim_state state;
+	uint8   *memory;
+	uint32   code_start;  // linear range the image was loaded to
+	uint32   code_end;
+	uint16   initial_sp;  // a ret from here leaves the program
+
+	uint64_t steps;
+	SIM_STOP stop;
+
+	// last memory write of the current step, write_width 0 for none
+	uint32   write_addr;
+	uint16   write_value;
+	uint8    write_width;
+
+	Instruction current;  // record being executed, or the one that stopped it
+
+	// every load and store goes here when it isn't NULL (see memprof.h)
+	struct memprof *prof;
+	uint32   site;        // image offset of the current instruction
+	uint8    form;        // ea_base form of the access being made, or MEMPROF_IMPLICIT
+	uint8    accessed;    // the current instruction made an access already
+
+	// every step is timed here when it isn't NULL (see timing.h)
+	struct timing *timing;
+	struct timing_info cost; // what the current step did besides its record
+
+	// one bit per SIM_PAGE_SHIFT page written, when it isn't NULL
+	uint32  *dirty;
+};
+
+// totals over every file, flat so per-thread copies merge with a straight add
+struct simulation
+{
+	uint64_t files;
+	uint64_t steps;
+	uint64_t stopped;     // sim_stopped_early
+};
+
+extern int  sim_init(struct sim *sim);
+extern void sim_free(struct sim *sim);
+
+// copy the image where DOS would put it: com at 0000:0100 with sp at FFFE,
+// mz and raw images at linear 0 starting from their entry point
+extern void sim_load(struct sim *sim, const struct image *image);
+// sim_load over memory the caller already cleared
+extern void sim_place(struct sim *sim, const struct image *image);
+
+// decode and execute one instruction (one iteration of a rep string op);
+// returns SIM_RUNNING or why it couldn't, with the state left before it
+extern SIM_STOP sim_step(struct sim *sim);
+// step until something stops it or max_steps, every step goes to trace if set
+extern SIM_STOP sim_run(struct sim *sim, uint64_t max_steps, struct trace *trace);
+
+extern const char *sim_stop_name(SIM_STOP stop);
+// the step limit, an invalid opcode or a divide error cut the run short
+extern int  sim_stopped_early(SIM_STOP stop);
+// "CPAZSTIDO" letters of the set flags
+extern int  sim_flag_names(char *buf, uint16 flags);
+// stop reason, then every register that isn't 0, ip and flags
+extern void sim_report(FILE *out, const struct sim *sim, struct simulation *totals);
+// count a finished run in totals without printing it
+extern void sim_tally(struct simulation *totals, const struct sim *sim);
+extern void sim_merge(struct simulation *into, const struct simulation *from);
+extern void sim_print(FILE *out, const struct simulation *totals);
+
+#endif // SIM_H
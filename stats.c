@@ -0,0 +1,171 @@
+#include <string.h>
+
+#include "stats.h"
+
+static const char *format_names[JMP_FAR + 1] = {
+	"NONE",    "RM",       "RM_V",     "RM_SR",    "RM_REG",  "RM_IMM",
+	"RM_ESC",  "ACC_DX",   "ACC_IMM8", "ACC_IMM",  "ACC_REG", "ACC_MEM",
+	"REG",     "REG_IMM",  "SR",       "IMM",      "JMP_SHORT",
+	"JMP_NEAR", "JMP_FAR",
+};
+
+static const char *prefix_names[STATS_PFX_COUNT] = {
+	"lock", "rep", "repne", "es:", "cs:", "ss:", "ds:",
+};
+
+static uint distance_bucket(uint distance)
+{
+	uint bucket = 0;
+
+	while (distance && bucket < STATS_DISTANCE_BUCKETS - 1) {
+		distance >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+int stats_scan(struct stats *stats, uint8 *const data, uint size, uint flags)
+{
+	Instruction instruction;
+	uint  offset = 0;
+	int   target, distance;
+	uint8 prefixes;
+
+	stats->files++;
+
+	while (offset < size) {
+		if (parse_instruction(&instruction, data, size, offset) < 0 ||
+		    instruction.structure.type == UNKNOWN) {
+			if (flags & SCAN_TOLERANT) {
+				parse_invalid(&instruction, data, size, offset);
+				stats->invalid += instruction.structure.size;
+				offset         += instruction.structure.size;
+				continue;
+			}
+
+			stats->errors++;
+			return -1;
+		}
+
+		stats->instructions++;
+		stats->opcodes[data[offset + PREFIX_SIZE(instruction.prefix_order)]]++;
+		stats->types[instruction.structure.type]++;
+		stats->formats[instruction.structure.format]++;
+
+		// folded prefixes, plus the odd one that decoded on its own
+		prefixes = instruction.structure.prefixes;
+		switch (instruction.structure.type) {
+		case LOCK:  prefixes |= PFX_LOCK;  break;
+		case REP:   prefixes |= PFX_REP;   break;
+		case REPNE: prefixes |= PFX_REPNE; break;
+		case SGMNT: prefixes |= PFX_SGMNT | (instruction.structure.flags & PFX_SGMNT_DS); break;
+		default: break;
+		}
+
+		if (prefixes & PFX_LOCK)  stats->prefixes[STATS_PFX_LOCK]++;
+		if (prefixes & PFX_REP)   stats->prefixes[STATS_PFX_REP]++;
+		if (prefixes & PFX_REPNE) stats->prefixes[STATS_PFX_REPNE]++;
+		if (prefixes & PFX_SGMNT) stats->prefixes[STATS_PFX_ES + SGMNT_OP(prefixes)]++;
+
+		switch (instruction.structure.format) {
+		case RM:
+		case RM_V:
+		case RM_SR:
+		case RM_REG:
+		case RM_IMM:
+		case RM_ESC:
+			stats->mod[FIELD_MOD(instruction.fields)]++;
+			break;
+		default: break;
+		}
+
+		target = get_jmp_offset(&instruction);
+		if (target >= 0) {
+			distance = target - (int)(offset + instruction.structure.size);
+			if (distance < 0) stats->branch_back[distance_bucket(-distance)]++;
+			else              stats->branch_fwd[distance_bucket(distance)]++;
+		}
+
+		offset += instruction.structure.size;
+	}
+
+	stats->bytes += size;
+	return 0;
+}
+
+void stats_merge(struct stats *into, const struct stats *from)
+{
+	uint64_t       *dst = (uint64_t *)into;
+	const uint64_t *src = (const uint64_t *)from;
+	size_t i;
+
+	// every member is a uint64_t counter
+	for (i = 0; i < sizeof(*into) / sizeof(uint64_t); ++i) dst[i] += src[i];
+}
+
+static void print_row(FILE *out, const char *name, uint64_t count, uint64_t total)
+{
+	fprintf(out, "  %-12s %12llu %6.2f%%\n", name, (unsigned long long)count,
+	        total ? 100.0 * count / total : 0.0);
+}
+
+void stats_print(FILE *out, const struct stats *stats)
+{
+	char     name[32];
+	uint64_t total;
+	uint     i;
+
+	fprintf(out, "files        %llu (%llu failed)\n", (unsigned long long)stats->files,
+	        (unsigned long long)stats->errors);
+	fprintf(out, "bytes        %llu\n", (unsigned long long)stats->bytes);
+	fprintf(out, "instructions %llu\n", (unsigned long long)stats->instructions);
+	if (stats->invalid) fprintf(out, "invalid      %llu bytes\n", (unsigned long long)stats->invalid);
+
+	fprintf(out, "\nby mnemonic:\n");
+	for (i = UNKNOWN + 1; i < EXTD; ++i) {
+		if (!stats->types[i] || i == SGMNT) continue;
+		print_row(out, get_instruction_name(i), stats->types[i], stats->instructions);
+	}
+
+	fprintf(out, "\nby format:\n");
+	for (i = 0; i <= JMP_FAR; ++i) {
+		if (!stats->formats[i]) continue;
+		print_row(out, format_names[i], stats->formats[i], stats->instructions);
+	}
+
+	fprintf(out, "\nby opcode:\n");
+	for (i = 0; i < 256; ++i) {
+		if (!stats->opcodes[i]) continue;
+		snprintf(name, sizeof(name), "0x%02X", i);
+		print_row(out, name, stats->opcodes[i], stats->instructions);
+	}
+
+	fprintf(out, "\nprefixes:\n");
+	for (i = 0; i < STATS_PFX_COUNT; ++i) {
+		print_row(out, prefix_names[i], stats->prefixes[i], stats->instructions);
+	}
+
+	for (i = 0, total = 0; i < 4; ++i) total += stats->mod[i];
+	fprintf(out, "\nmodrm mod:\n");
+	for (i = 0; i < 4; ++i) {
+		snprintf(name, sizeof(name), "mod=%u%u", (i >> 1) & 1, i & 1);
+		print_row(out, name, stats->mod[i], total);
+	}
+
+	for (i = 0, total = 0; i < STATS_DISTANCE_BUCKETS; ++i)
+		total += stats->branch_back[i] + stats->branch_fwd[i];
+
+	fprintf(out, "\nbranch distance (bytes past the branch):\n");
+	for (i = STATS_DISTANCE_BUCKETS; i-- > 1;) {
+		if (!stats->branch_back[i]) continue;
+		snprintf(name, sizeof(name), "-%u..-%u", (1u << i) - 1, 1u << (i - 1));
+		print_row(out, name, stats->branch_back[i], total);
+	}
+	if (stats->branch_fwd[0]) print_row(out, "0", stats->branch_fwd[0], total);
+	for (i = 1; i < STATS_DISTANCE_BUCKETS; ++i) {
+		if (!stats->branch_fwd[i]) continue;
+		snprintf(name, sizeof(name), "%u..%u", 1u << (i - 1), (1u << i) - 1);
+		print_row(out, name, stats->branch_fwd[i], total);
+	}
+}
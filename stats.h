@@ -0,0 +1,45 @@
+#if !defined STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#include "decode.h"
+
+#define STATS_DISTANCE_BUCKETS 17
+
+enum {
+	STATS_PFX_LOCK,
+	STATS_PFX_REP,
+	STATS_PFX_REPNE,
+	STATS_PFX_ES,
+	STATS_PFX_CS,
+	STATS_PFX_SS,
+	STATS_PFX_DS,
+	STATS_PFX_COUNT,
+};
+
+// flat counters only, so per-thread copies merge with a straight add
+struct stats
+{
+	uint64_t files;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t instructions;
+	uint64_t invalid;      // bytes SCAN_TOLERANT skipped as db
+
+	uint64_t types[EXTD + 1];
+	uint64_t formats[JMP_FAR + 1];
+	uint64_t opcodes[256];
+	uint64_t prefixes[STATS_PFX_COUNT];
+	uint64_t mod[4];
+
+	// bucket k holds |distance| in [2^(k-1), 2^k), bucket 0 is distance 0
+	uint64_t branch_back[STATS_DISTANCE_BUCKETS];
+	uint64_t branch_fwd[STATS_DISTANCE_BUCKETS];
+};
+
+extern int  stats_scan(struct stats *stats, uint8 *const data, uint size, uint flags);
+extern void stats_merge(struct stats *into, const struct stats *from);
+extern void stats_print(FILE *out, const struct stats *stats);
+
+#endif // STATS_H
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "decode.h"
+#include "profile.h"
+#include "resync.h"
+#include "stream.h"
+
+// input ring, must be a power of two
+#define STREAM_RING    (1 << 16)
+// decoded records waiting for a possible label
+#define STREAM_HOLD    256
+// label bits kept around the decode position, must be a power of two
+#define STREAM_LABELS  1024
+// longest record parse_instruction reads, prefixes included
+#define STREAM_MAX_INS DECODE_MAX_SIZE
+// a short jump at j reaches back to j + 2 - 128, so a record that far
+// behind the decode position can never gain a label
+#define STREAM_REACH   126
+
+struct stream
+{
+	int         fd;
+	FILE       *out;
+	int         eof;
+
+	uint8       ring[STREAM_RING];
+	uint        head; // absolute offset of the next byte to decode
+	uint        tail; // absolute offset one past the last byte read
+	uint        span; // head at the last read, where the current profile spans start
+
+	Instruction pending[STREAM_HOLD];
+	uint        first;
+	uint        count;
+
+	uint32      labels[STREAM_LABELS / 32];
+
+	struct resync *resync;  // NULL stops at the first invalid opcode
+	uint           bad;     // start of the open run of db records
+	uint           bad_end; // one past it, == bad when there's none
+};
+
+static int stream_fill(struct stream *s)
+{
+	uint    at, space;
+	ssize_t n;
+
+	at    = s->tail & (STREAM_RING - 1);
+	space = STREAM_RING - (s->tail - s->head);
+	if (space > STREAM_RING - at) space = STREAM_RING - at;
+
+	// whatever is decoded so far goes out before we block on more input
+	PROFILE_BEGIN(flush);
+	fflush(s->out);
+	PROFILE_END(PHASE_RENDER, flush, s->head - s->span);
+
+	PROFILE_BEGIN(fill);
+	do {
+		n = read(s->fd, s->ring + at, space);
+	} while (n < 0 && errno == EINTR);
+	PROFILE_END(PHASE_READ, fill, n > 0 ? n : 0);
+
+	if (n < 0) return -1;
+	if (n == 0) s->eof = 1;
+
+	s->tail += n;
+	return 0;
+}
+
+#define LABEL_WORD(offset) (((offset) & (STREAM_LABELS - 1)) / 32)
+#define LABEL_BIT(offset)  (1u << ((offset) & 31))
+
+static void stream_emit(struct stream *s)
+{
+	Instruction *instruction = s->pending + s->first;
+	uint i, offset = instruction->offset;
+
+	if (s->labels[LABEL_WORD(offset)] & LABEL_BIT(offset))
+		instruction->structure.flags |= MASK_LB;
+
+	// targets inside the instruction never get a label, drop them as well
+	for (i = 0; i < instruction->structure.size; ++i)
+		s->labels[LABEL_WORD(offset + i)] &= ~LABEL_BIT(offset + i);
+
+	emit_instruction(s->out, instruction);
+
+	s->first = (s->first + 1) % STREAM_HOLD;
+	s->count--;
+}
+
+static void stream_label(struct stream *s, Instruction *instruction)
+{
+	int  target = get_jmp_offset(instruction);
+	uint start;
+
+	if (target < 0) return;
+
+	// near jumps can land outside the window; those are printed as plain
+	// offsets anyway, so losing the label line doesn't change the encoding
+	start = s->count ? s->pending[s->first].offset : s->head;
+	if ((uint)target - start >= STREAM_LABELS) return;
+
+	s->labels[LABEL_WORD(target)] |= LABEL_BIT(target);
+}
+
+// copy the bytes at head out of the ring, returns how many there are
+static uint stream_window(struct stream *s, uint8 window[STREAM_MAX_INS])
+{
+	uint i, avail = s->tail - s->head;
+
+	if (avail > STREAM_MAX_INS) avail = STREAM_MAX_INS;
+	for (i = 0; i < avail; ++i)
+		window[i] = s->ring[(s->head + i) & (STREAM_RING - 1)];
+
+	return avail;
+}
+
+static int stream_step(struct stream *s, uint8 *window, uint avail)
+{
+	Instruction *instruction;
+	int          rc;
+
+	instruction = s->pending + (s->first + s->count) % STREAM_HOLD;
+	rc = parse_instruction(instruction, window, avail, 0);
+	if (rc < 0 || instruction->structure.type == UNKNOWN) {
+		if (!s->resync && rc < 0) {
+			fprintf(stderr, "truncated instruction at offset %u\n", s->head);
+			return -1;
+		}
+
+		if (!s->resync) {
+			fprintf(stderr, "unknown instruction encountered: "
+			        "0x%02X\n", window[0]);
+			return -2;
+		}
+
+		// any decoded record closes the run, so an open one always ends at head
+		parse_invalid(instruction, window, avail, 0);
+		if (s->bad == s->bad_end) s->bad = s->head;
+		s->bad_end = s->head + instruction->structure.size;
+	} else if (s->bad != s->bad_end) {
+		resync_range(s->resync, stderr, NULL, s->bad, s->bad_end);
+		s->bad = s->bad_end = 0;
+	}
+
+	instruction->offset = s->head;
+	s->count++;
+
+	stream_label(s, instruction);
+	s->head += instruction->structure.size;
+
+	while (s->count && s->head - s->pending[s->first].offset > STREAM_REACH)
+		stream_emit(s);
+
+	return 0;
+}
+
+int stream_decode(int fd, FILE *out, struct resync *resync)
+{
+	struct stream *s;
+	uint8 window[STREAM_MAX_INS];
+	uint  avail;
+	int   rc = 0;
+
+	// allocated once, the footprint doesn't depend on the input length
+	s = calloc(1, sizeof(*s));
+	if (!s) return -3;
+
+	s->fd     = fd;
+	s->out    = out;
+	s->resync = resync;
+
+	fprintf(out, "bits 16\n\n");
+
+	// decoding, labels and formatting interleave record by record here, so
+	// the decode phase is everything between two reads and render is the
+	// flush in front of each read; the label phase has no span of its own
+	PROFILE_BEGIN(decode);
+
+	for (;;) {
+		// read only until the instruction at head is complete, so a pipe
+		// that stops on an instruction boundary doesn't stall its output
+		avail = stream_window(s, window);
+		while (!s->eof && instruction_length(window, avail) == 0) {
+			PROFILE_END(PHASE_DECODE, decode, s->head - s->span);
+			rc = stream_fill(s);
+			s->span = s->head;
+			PROFILE_RESTART(decode);
+
+			if (rc < 0) {
+				fprintf(stderr, "failed to read input: %s\n", strerror(errno));
+				break;
+			}
+			avail = stream_window(s, window);
+		}
+
+		if (rc < 0 || avail == 0) break;
+
+		rc = stream_step(s, window, avail);
+		if (rc < 0) break;
+	}
+
+	while (s->count) stream_emit(s);
+	if (s->bad != s->bad_end) resync_range(s->resync, stderr, NULL, s->bad, s->bad_end);
+	PROFILE_END(PHASE_DECODE, decode, s->head - s->span);
+
+	PROFILE_BEGIN(flush);
+	fflush(out);
+	PROFILE_END(PHASE_RENDER, flush, s->head - s->span);
+
+	free(s);
+	return rc;
+}
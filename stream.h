@@ -0,0 +1,13 @@
+#if !defined STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+
+#include "resync.h"
+
+// decode a byte stream (pipe, socket, tty...) with constant memory, writing
+// instructions as soon as no later short jump can still reach back to them;
+// with a resync, invalid bytes become db records and are counted there
+extern int stream_decode(int fd, FILE *out, struct resync *resync);
+
+#endif // STREAM_H
@@ -0,0 +1,651 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "encode.h"
+#include "sweep.h"
+
+// prefix bytes put in front of the encoding: runs of up to DECODE_MAX_PREFIXES
+// of them, in every order and with repeats
+static const uint8 sweep_prefixes[] = { 0xF0, 0xF2, 0xF3, 0x26, 0x2E, 0x36, 0x3E };
+// value of every byte after the modrm, zero and sign-extending displacements
+static const uint8 sweep_fills[] = { 0x00, 0xFF };
+
+// failures logged per category before going quiet
+#define SWEEP_LOG_LIMIT 16
+
+static const char *failure_names[SWEEP_FAILURES] = {
+	"fault", "assert", "size", "encode", "text", "fold",
+};
+
+struct sweep_shared
+{
+	pthread_mutex_t lock;
+	uint            next;   // next opcode to claim
+	FILE           *log;
+	struct sweep   *total;
+};
+
+struct sweep_worker
+{
+	pthread_t            thread;
+	struct sweep_shared *shared;
+	struct sweep         sweep;
+
+	uint8               *page;  // encodings end right before a PROT_NONE page
+	size_t               page_size;
+
+	char                 text[2][256];
+	FILE                *text_out[2];
+};
+
+static _Thread_local sigjmp_buf *sweep_jump;
+
+static void sweep_signal(int sig)
+{
+	if (sweep_jump) siglongjmp(*sweep_jump, sig);
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void sweep_fail(struct sweep_worker *w, int failure, const uint8 *bytes, uint len)
+{
+	uint i;
+
+	w->sweep.failures[failure]++;
+	if (w->sweep.failures[failure] > SWEEP_LOG_LIMIT || !w->shared->log) return;
+
+	pthread_mutex_lock(&w->shared->lock);
+	fprintf(w->shared->log, "%-6s", failure_names[failure]);
+	for (i = 0; i < len; ++i) fprintf(w->shared->log, " %02X", bytes[i]);
+	fputc('\n', w->shared->log);
+	pthread_mutex_unlock(&w->shared->lock);
+}
+
+static int same_record(const Instruction *a, const Instruction *b)
+{
+	return a->structure.type     == b->structure.type &&
+	       a->structure.format   == b->structure.format &&
+	       a->structure.flags    == b->structure.flags &&
+	       a->structure.prefixes == b->structure.prefixes &&
+	       a->structure.size     == b->structure.size &&
+	       a->data == b->data && a->data_ext == b->data_ext &&
+	       a->displacement == b->displacement &&
+	       a->fields == b->fields && a->segment == b->segment &&
+	       a->prefix_order == b->prefix_order &&
+	       a->offset == b->offset;
+}
+
+// decode the (prefixed) instruction at data, 0 if not valid
+static int sweep_decode(Instruction *instruction, uint8 *data, uint size)
+{
+	if (parse_instruction(instruction, data, size, 0) < 0) return 0;
+	return instruction->structure.type != UNKNOWN;
+}
+
+// prefix that didn't fold, instruction_length can't tell it from a truncated run
+static int lone_prefix(const Instruction *instruction)
+{
+	switch (instruction->structure.type) {
+	case LOCK:
+	case REP:
+	case REPNE:
+	case SGMNT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// the prefix bits a run of prefix bytes leaves, folded by hand in the order
+// they came: a later rep/repne or segment replaces an earlier one
+static uint8 fold_in_order(const uint8 *bytes, uint run)
+{
+	uint8 prefixes = 0;
+	uint  i;
+
+	for (i = 0; i < run; ++i) {
+		switch (bytes[i]) {
+		case 0xF0:
+			prefixes |= PFX_LOCK;
+			break;
+		case 0xF2:
+			prefixes = (prefixes & ~PFX_REP) | PFX_REPNE;
+			break;
+		case 0xF3:
+			prefixes = (prefixes & ~PFX_REPNE) | PFX_REP;
+			break;
+		default:
+			prefixes = (prefixes & ~PFX_SGMNT_DS) | PFX_SGMNT | SR(bytes[i]) << 4;
+			break;
+		}
+	}
+
+	return prefixes;
+}
+
+// the record has to take in every byte of the run and end up with the
+// prefixes the in-order fold gives; an opcode that is itself a prefix
+// byte extends the run
+static int sweep_fold(const Instruction *instruction, const uint8 *bytes, uint run)
+{
+	uint8 prefixes = instruction->structure.prefixes;
+	uint  size     = PREFIX_SIZE(instruction->prefix_order);
+
+	if (lone_prefix(instruction)) return 1;
+	if (size < run) return 0;
+
+	prefixes &= PFX_LOCK | PFX_REP | PFX_REPNE | PFX_SGMNT | PFX_SGMNT_DS;
+	if (!(prefixes & PFX_SGMNT)) prefixes &= ~PFX_SGMNT_DS;
+
+	return prefixes == fold_in_order(bytes, size);
+}
+
+static long sweep_text(struct sweep_worker *w, int i, Instruction *instruction)
+{
+	rewind(w->text_out[i]);
+	decode_instruction(w->text_out[i], instruction);
+	fputc('\0', w->text_out[i]);
+	fflush(w->text_out[i]);
+	return ftell(w->text_out[i]) - 1;
+}
+
+// what sweep_reparse reads back out of one listing line
+struct sweep_line
+{
+	uint8   prefixes;   // lock, rep, repne and a segment, in front or on the memory operand
+	int     far;
+	int     sized;      // byte/word in front of the memory operand
+	char    mnemonic[8];
+	int     count;
+	Operand ops[2];     // a plain number is OPERAND_IMM, a $-relative target OPERAND_REL with reg 1
+	uint8   bytes[DECODE_MAX_SIZE];
+	uint    byte_count; // db lines only
+};
+
+// skip word if *at starts with it and, unless ends is NULL, the end of the
+// line or one of ends comes right after it
+static int take(const char **at, const char *word, const char *ends)
+{
+	size_t len = strlen(word);
+
+	if (strncmp(*at, word, len) != 0) return 0;
+	if (ends && (*at)[len] && !strchr(ends, (*at)[len])) return 0;
+
+	*at += len;
+	return 1;
+}
+
+static int take_number(const char **at, int32_t *value)
+{
+	char *end;
+	long  n;
+
+	if (!(**at >= '0' && **at <= '9') && **at != '-') return 0;
+
+	n = strtol(*at, &end, 10);
+	if (end == *at) return 0;
+
+	*value = n;
+	*at    = end;
+	return 1;
+}
+
+// "[bx + si - 12]" or "[1234]", after the optional size and segment
+static int take_memory(const char **at, Operand *op)
+{
+	int32_t disp = 0;
+	uint    rm;
+
+	if (!take(at, "[", NULL)) return 0;
+
+	op->kind = OPERAND_MEM;
+	if (take_number(at, &op->value)) {
+		op->reg = EA_DIRECT;
+		return take(at, "]", NULL);
+	}
+
+	// "bx + si" before "bx"
+	for (rm = 0; rm < 8; ++rm) {
+		if (take(at, get_ea_name(rm), " ]")) break;
+	}
+	if (rm == 8) return 0;
+
+	op->reg = rm;
+	if (take(at, " + ", NULL)) {
+		if (!take_number(at, &disp) || disp <= 0) return 0;
+	} else if (take(at, " - ", NULL)) {
+		if (!take_number(at, &disp) || disp <= 0) return 0;
+		disp = -disp;
+	}
+
+	op->value = disp;
+	return take(at, "]", NULL);
+}
+
+static int take_operand(const char **at, struct sweep_line *line, Operand *op)
+{
+	uint w, r;
+
+	memset(op, 0, sizeof(*op));
+
+	if (take(at, "byte ", NULL))      op->width = 1;
+	else if (take(at, "word ", NULL)) op->width = 2;
+	if (op->width) line->sized = 1;
+
+	for (r = 0; r < 4; ++r) {
+		if (strncmp(*at, get_segment_name(r), 2) != 0 || (*at)[2] != ':') continue;
+		if (line->prefixes & PFX_SGMNT) return 0;
+
+		*at += 3;
+		line->prefixes |= PFX_SGMNT | r << 4;
+		return take_memory(at, op);
+	}
+
+	if (**at == '[') return take_memory(at, op);
+	if (op->width) return 0;
+
+	for (w = 0; w < 2; ++w) {
+		for (r = 0; r < 8; ++r) {
+			if (!take(at, get_register_name(w, r), ",")) continue;
+			*op = (Operand){ OPERAND_REG, r, w + 1, 0, 0 };
+			return 1;
+		}
+	}
+
+	for (r = 0; r < 4; ++r) {
+		if (!take(at, get_segment_name(r), ",")) continue;
+		*op = (Operand){ OPERAND_SREG, r, 2, 0, 0 };
+		return 1;
+	}
+
+	if (take(at, "label_", NULL)) {
+		op->kind = OPERAND_REL;
+		return take_number(at, &op->value);
+	}
+
+	if (take(at, "$", NULL)) {
+		op->kind = OPERAND_REL;
+		op->reg  = 1;
+		if (**at == '+') ++*at;
+		return take_number(at, &op->value);
+	}
+
+	if (!take_number(at, &op->value)) return 0;
+	op->kind = OPERAND_IMM;
+
+	if (take(at, ":", NULL)) {
+		op->kind    = OPERAND_FAR;
+		op->segment = op->value;
+		return take_number(at, &op->value);
+	}
+
+	return 1;
+}
+
+// read a listing line back the way an assembler would see it; 0 if it doesn't parse
+static int sweep_reparse(const char *text, struct sweep_line *line)
+{
+	const char *at = text;
+	uint        r, i;
+	int32_t     byte;
+
+	memset(line, 0, sizeof(*line));
+
+	if (take(&at, "db ", NULL)) {
+		do {
+			if (!take(&at, "0x", NULL) || line->byte_count == DECODE_MAX_SIZE) return 0;
+			byte = strtol(at, (char **)&at, 16);
+			if (byte < 0 || byte > 0xFF) return 0;
+			line->bytes[line->byte_count++] = byte;
+		} while (take(&at, ", ", NULL));
+
+		return *at == '\0';
+	}
+
+	// prefixes, unless the word is all there is: a prefix that didn't fold
+	for (;;) {
+		const char *word = at;
+
+		if (take(&at, "lock ", NULL))       line->prefixes |= PFX_LOCK;
+		else if (take(&at, "rep ", NULL))   line->prefixes |= PFX_REP;
+		else if (take(&at, "repne ", NULL)) line->prefixes |= PFX_REPNE;
+		else {
+			for (r = 0; r < 4; ++r) {
+				if (take(&at, get_segment_name(r), " ") && take(&at, " ", NULL)) break;
+				at = word;
+			}
+			if (r == 4) break;
+			line->prefixes |= PFX_SGMNT | r << 4;
+		}
+	}
+
+	for (i = 0; *at && *at != ' '; ++i) {
+		if (i + 1 == sizeof(line->mnemonic)) return 0;
+		line->mnemonic[i] = *at++;
+	}
+
+	if (take(&at, " far", " ")) line->far = 1;
+	if (!*at) return 1;
+
+	do {
+		if (line->count == 2 || !take(&at, line->count ? ", " : " ", NULL)) return 0;
+		if (!take_operand(&at, line, line->ops + line->count)) return 0;
+		line->count++;
+	} while (*at);
+
+	return 1;
+}
+
+// an immediate the assembler reads as `value` and stores in `width` bytes
+static int fits(int32_t value, uint width)
+{
+	return width == 1 ? value >= -128 && value <= 0xFF : value >= -32768 && value <= 0xFFFF;
+}
+
+static int same_operand(const Instruction *instruction, const Operand *want, const Operand *got)
+{
+	uint32 mask = want->width == 1 ? 0xFF : 0xFFFF;
+
+	switch (want->kind) {
+	case OPERAND_REG:
+	case OPERAND_SREG:
+		return got->kind == want->kind && got->reg == want->reg && got->width == want->width;
+	case OPERAND_MEM:
+		if (got->kind != OPERAND_MEM || got->reg != want->reg) return 0;
+		if (got->width && got->width != want->width) return 0;
+		if (want->reg == EA_DIRECT) return fits(got->value, 2) && (uint16)got->value == (uint16)want->value;
+		return got->value == want->value;
+	case OPERAND_IMM:
+		return got->kind == OPERAND_IMM && fits(got->value, want->width) &&
+		       ((got->value ^ want->value) & mask) == 0;
+	case OPERAND_REL:
+		// near targets are printed as the ip they land on
+		if (got->kind == OPERAND_IMM)
+			return got->value == want->value - instruction->segment * 16;
+		if (got->kind != OPERAND_REL) return 0;
+		if (got->reg) return (int32_t)instruction->offset + got->value == want->value;
+		return instruction->segment == 0 && got->value == want->value;
+	case OPERAND_FAR:
+		return got->kind == OPERAND_FAR && fits(got->segment, 2) && fits(got->value, 2) &&
+		       got->segment == want->segment && (uint16)got->value == (uint16)want->value;
+	default:
+		return 0;
+	}
+}
+
+// the listing line has to carry the whole record: db lines the input bytes,
+// everything else the prefixes, mnemonic and operands get_operands reports
+static int sweep_round_trip(Instruction *instruction, const char *text,
+                            const uint8 *bytes, uint len)
+{
+	struct sweep_line line;
+	Operand ops[2];
+	uint8   prefixes = instruction->structure.prefixes;
+	const char *name;
+	int     count, i, memory = 0;
+
+	if (!sweep_reparse(text, &line)) return 0;
+
+	if (instruction->structure.format == RM_ESC)
+		return line.byte_count == len && memcmp(line.bytes, bytes, len) == 0;
+	if (line.byte_count) return 0;
+
+	name = instruction->structure.type == SGMNT ?
+	       get_segment_name(SR_OP(instruction->structure.flags)) :
+	       get_instruction_name(instruction->structure.type);
+	if (strcmp(line.mnemonic, name) != 0) return 0;
+
+	prefixes &= PFX_LOCK | PFX_REP | PFX_REPNE | PFX_SGMNT | PFX_SGMNT_DS;
+	if (!(prefixes & PFX_SGMNT)) prefixes &= ~PFX_SGMNT_DS;
+	if (line.prefixes != prefixes) return 0;
+	if (line.far != !!(instruction->structure.prefixes & PFX_FAR)) return 0;
+
+	count = get_operands(instruction, ops);
+	if (line.count != count) return 0;
+
+	for (i = 0; i < count; ++i) {
+		if (!same_operand(instruction, ops + i, line.ops + i)) return 0;
+		if (ops[i].kind == OPERAND_MEM) memory = 1;
+	}
+
+	// an unsized memory operand takes its size from a register next to it
+	if (memory && line.sized != !!(instruction->structure.prefixes & PFX_WIDE)) return 0;
+	if (memory && !line.sized && count == 2 &&
+	    line.ops[0].kind != OPERAND_REG && line.ops[0].kind != OPERAND_SREG &&
+	    line.ops[1].kind != OPERAND_REG && line.ops[1].kind != OPERAND_SREG) return 0;
+
+	return 1;
+}
+
+// bytes starts with a run of `run` prefix bytes
+static void sweep_one(struct sweep_worker *w, const uint8 *bytes, uint run)
+{
+	// volatile: read back after siglongjmp
+	volatile uint len = 0;
+	uint8       encoded[ENCODE_MAX];
+	uint8       roomy[16];
+	uint8      *exact;
+	Instruction a, b;
+	sigjmp_buf  jump;
+	long        text_len[2];
+	int         sig, enc;
+
+	memcpy(roomy, bytes, sizeof(roomy));
+	w->sweep.encodings++;
+
+	sweep_jump = &jump;
+	sig = sigsetjmp(jump, 1);
+	if (sig) {
+		sweep_jump = NULL;
+		sweep_fail(w, sig == SIGABRT ? SWEEP_ASSERT : SWEEP_FAULT, bytes, len ? len : 8);
+		return;
+	}
+
+	if (!sweep_decode(&a, roomy, sizeof(roomy))) {
+		sweep_jump = NULL;
+		w->sweep.invalid++;
+		if (a.structure.type == UNKNOWN && instruction_length(roomy, sizeof(roomy)) >= 0)
+			sweep_fail(w, SWEEP_SIZE, bytes, 8);
+		return;
+	}
+
+	w->sweep.valid++;
+	len = a.structure.size;
+
+	if (instruction_length(roomy, sizeof(roomy)) != (int)len) {
+		sweep_jump = NULL;
+		sweep_fail(w, SWEEP_SIZE, bytes, len);
+		return;
+	}
+
+	if (len < 1 || len > DECODE_MAX_SIZE) {
+		sweep_jump = NULL;
+		sweep_fail(w, SWEEP_SIZE, bytes, 8);
+		return;
+	}
+
+	// same bytes, nothing readable after them
+	exact = w->page + w->page_size - len;
+	memcpy(exact, bytes, len);
+
+	if (!sweep_decode(&b, exact, len) || !same_record(&a, &b) ||
+	    instruction_length(exact, len) != (lone_prefix(&a) ? 0 : (int)len) ||
+	    instruction_length(exact, len - 1) != 0) {
+		sweep_jump = NULL;
+		sweep_fail(w, SWEEP_SIZE, bytes, len);
+		return;
+	}
+
+	if (!sweep_fold(&a, bytes, run)) sweep_fail(w, SWEEP_FOLD, bytes, len);
+
+	text_len[0] = sweep_text(w, 0, &a);
+	text_len[1] = sweep_text(w, 1, &b);
+	sweep_jump = NULL;
+
+	if (text_len[0] != text_len[1] || text_len[0] >= DECODE_MAX_LINE ||
+	    strcmp(w->text[0], w->text[1]) != 0 || !sweep_round_trip(&a, w->text[0], bytes, len)) {
+		sweep_fail(w, SWEEP_TEXT, bytes, len);
+	}
+
+	enc = encode_instruction(&a, encoded);
+	if (enc != (int)len || memcmp(encoded, bytes, enc) != 0)
+		sweep_fail(w, SWEEP_ENCODE, bytes, len);
+}
+
+static void sweep_opcode(struct sweep_worker *w, uint opcode)
+{
+	uint8 bytes[16];
+	uint  run, runs, r, n, f, modrm, at;
+
+	for (run = 0, runs = 1; run <= DECODE_MAX_PREFIXES; ++run, runs *= sizeof(sweep_prefixes)) {
+		for (r = 0; r < runs; ++r) {
+			for (f = 0; f < sizeof(sweep_fills); ++f) {
+				for (modrm = 0; modrm < 256; ++modrm) {
+					// longer runs only change the prefixes: every reg and mod, and
+					// r/m for [bx + si] and for the direct/bp forms
+					if (run > 1 && RM(modrm) != 0b000 && RM(modrm) != 0b110) continue;
+
+					memset(bytes, sweep_fills[f], sizeof(bytes));
+
+					// digit `at` of r, base sizeof(sweep_prefixes), picks the prefix byte
+					for (at = 0, n = r; at < run; ++at, n /= sizeof(sweep_prefixes))
+						bytes[at] = sweep_prefixes[n % sizeof(sweep_prefixes)];
+					bytes[at++] = opcode;
+					bytes[at++] = modrm;
+
+					sweep_one(w, bytes, run);
+				}
+			}
+		}
+	}
+}
+
+static void *sweep_worker_run(void *arg)
+{
+	struct sweep_worker *w = arg;
+	struct sweep_shared *s = w->shared;
+	uint opcode;
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		opcode = s->next++;
+		pthread_mutex_unlock(&s->lock);
+
+		if (opcode >= 256) break;
+		sweep_opcode(w, opcode);
+	}
+
+	return NULL;
+}
+
+static int sweep_worker_init(struct sweep_worker *w, struct sweep_shared *shared)
+{
+	int i;
+
+	memset(w, 0, sizeof(*w));
+	w->shared    = shared;
+	w->page_size = sysconf(_SC_PAGESIZE);
+
+	w->page = mmap(NULL, w->page_size * 2, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (w->page == MAP_FAILED) return -1;
+	if (mprotect(w->page + w->page_size, w->page_size, PROT_NONE) < 0) return -1;
+
+	for (i = 0; i < 2; ++i) {
+		w->text_out[i] = fmemopen(w->text[i], sizeof(w->text[i]), "w");
+		if (!w->text_out[i]) return -1;
+	}
+
+	return 0;
+}
+
+static void sweep_worker_free(struct sweep_worker *w)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		if (w->text_out[i]) fclose(w->text_out[i]);
+	}
+
+	if (w->page && w->page != MAP_FAILED) munmap(w->page, w->page_size * 2);
+}
+
+int run_sweep(struct sweep *sweep, uint threads, FILE *log)
+{
+	struct sweep_shared  shared;
+	struct sweep_worker *workers;
+	struct sigaction     sa, old_segv, old_bus, old_abrt;
+	uint i, j, started = 0;
+	int  rc = 0;
+
+	if (threads == 0) threads = 1;
+	if (threads > 256) threads = 256;
+
+	memset(&shared, 0, sizeof(shared));
+	pthread_mutex_init(&shared.lock, NULL);
+	shared.log   = log;
+	shared.total = sweep;
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers) return -3;
+
+	for (i = 0; i < threads && rc == 0; ++i) rc = sweep_worker_init(workers + i, &shared);
+
+	// faults and asserts jump back into sweep_one instead of killing the run
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sweep_signal;
+	sa.sa_flags   = SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &old_segv);
+	sigaction(SIGBUS,  &sa, &old_bus);
+	sigaction(SIGABRT, &sa, &old_abrt);
+
+	for (i = 1; rc == 0 && i < threads; ++i, ++started) {
+		if (pthread_create(&workers[i].thread, NULL, sweep_worker_run, workers + i) != 0) break;
+	}
+
+	if (rc == 0) sweep_worker_run(workers);
+
+	for (i = 1; i <= started; ++i) pthread_join(workers[i].thread, NULL);
+
+	sigaction(SIGSEGV, &old_segv, NULL);
+	sigaction(SIGBUS,  &old_bus,  NULL);
+	sigaction(SIGABRT, &old_abrt, NULL);
+
+	for (i = 0; i < threads; ++i) {
+		sweep->encodings += workers[i].sweep.encodings;
+		sweep->valid     += workers[i].sweep.valid;
+		sweep->invalid   += workers[i].sweep.invalid;
+		for (j = 0; j < SWEEP_FAILURES; ++j) sweep->failures[j] += workers[i].sweep.failures[j];
+
+		sweep_worker_free(workers + i);
+	}
+
+	free(workers);
+	pthread_mutex_destroy(&shared.lock);
+
+	if (rc < 0) return rc;
+	for (j = 0; j < SWEEP_FAILURES; ++j) {
+		if (sweep->failures[j]) return -1;
+	}
+
+	return 0;
+}
+
+void sweep_print(FILE *out, const struct sweep *sweep)
+{
+	uint i;
+
+	fprintf(out, "encodings %llu: %llu valid, %llu invalid\n",
+	        (unsigned long long)sweep->encodings, (unsigned long long)sweep->valid,
+	        (unsigned long long)sweep->invalid);
+
+	for (i = 0; i < SWEEP_FAILURES; ++i)
+		fprintf(out, "  %-8s %llu\n", failure_names[i], (unsigned long long)sweep->failures[i]);
+}
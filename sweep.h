@@ -0,0 +1,30 @@
+#if !defined SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+
+#include "decode.h"
+
+enum {
+	SWEEP_FAULT,   // read past the encoding or crashed
+	SWEEP_ASSERT,  // assert() fired
+	SWEEP_SIZE,    // record changes with only its own bytes, or instruction_length disagrees
+	SWEEP_ENCODE,  // re-encoding doesn't reproduce the input
+	SWEEP_TEXT,    // text differs between decodes, overflows DECODE_MAX_LINE or doesn't parse back to the record
+	SWEEP_FOLD,    // record's prefixes aren't the prefix bytes folded in order, last one winning
+	SWEEP_FAILURES,
+};
+
+struct sweep
+{
+	uint64_t encodings;
+	uint64_t valid;
+	uint64_t invalid;
+	uint64_t failures[SWEEP_FAILURES];
+};
+
+// decode every opcode x modrm x prefix run x fill combination on `threads` workers
+extern int  run_sweep(struct sweep *sweep, uint threads, FILE *log);
+extern void sweep_print(FILE *out, const struct sweep *sweep);
+
+#endif // SWEEP_H
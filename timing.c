@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include "timing.h"
+
+#define ADDRESS_MASK ((1u << 20) - 1)
+
+// prefetch queue length per cpu
+static const uint8 queue_size[TIMING_CPUS] = { 6, 4 };
+
+uint timing_ea_clocks(const Instruction *instruction, const Operand *op)
+{
+	// bx+si and bp+di add a clock less than bx+di and bp+si
+	static const uint8 base[8] = { 7, 8, 8, 7, 5, 5, 5, 5 };
+	uint8 mod = FIELD_MOD(instruction->fields);
+
+	if (op->kind != OPERAND_MEM) return 0;
+	if (op->reg == EA_DIRECT) return 6;
+
+	return base[op->reg] + (mod == MODE_MEM8 || mod == MODE_MEM16 ? 4 : 0);
+}
+
+uint timing_clocks(const Instruction *instruction, const Operand ops[2], uint count,
+                   int taken, int first)
+{
+	const InstructionData *structure = &instruction->structure;
+	uint8 prefixes = structure->prefixes;
+	uint8 rep      = prefixes & (PFX_REP | PFX_REPNE);
+	int   dst      = ops[0].kind == OPERAND_MEM;
+	int   mem      = dst || ops[1].kind == OPERAND_MEM;
+	uint  ea       = 0, clocks, iteration;
+
+	// mov al, [addr] has its address in the opcode, no ea to work out
+	if (mem && structure->format != ACC_MEM) ea = timing_ea_clocks(instruction, dst ? ops : ops + 1);
+
+	// the figures themselves are the clocks columns of instructions.def
+	switch (structure->type) {
+	case UNKNOWN:
+		return 0;
+
+	// rep costs 9 once, then the per-iteration figure; count is 0 when cx was
+	case MOVSB: case MOVSW: case CMPSB: case CMPSW: case SCASB: case SCASW:
+	case LODSB: case LODSW: case STOSB: case STOSW:
+		iteration = rep ? structure->clocks_alt : structure->clocks;
+		clocks    = (rep && first ? 9 : 0) + (count || !rep ? iteration : 0);
+		break;
+
+	case JO: case JNO: case JB: case JAE: case JE: case JNE: case JBE: case JA:
+	case JS: case JNS: case JP: case JPO: case JL: case JGE: case JLE: case JG:
+	case LOOP: case LOOPZ: case LOOPNZ: case JCXZ: case INTO:
+		clocks = taken ? structure->clocks_alt : structure->clocks;
+		break;
+
+	default:
+		clocks = mem ? structure->clocks_alt + ea : structure->clocks;
+		break;
+	}
+
+	// shifts and rotates by cl take 4 more per bit
+	if (structure->flags & MASK_V) clocks += 4 * count;
+
+	// a segment override or lock folded into the record costs what the prefix would
+	if (prefixes & PFX_SGMNT) clocks += 2;
+	if (prefixes & PFX_LOCK)  clocks += 2;
+	return clocks;
+}
+
+void timing_reset(struct timing *timing, uint32 start)
+{
+	uint i;
+
+	memset(timing, 0, sizeof(*timing));
+	for (i = 0; i < TIMING_CPUS; ++i) timing->biu[i].fetch = start & ADDRESS_MASK;
+}
+
+// bytes the next prefetch brings: the 8086 fetches aligned words
+static uint8 fetch_size(const struct biu *b, TIMING_CPU cpu)
+{
+	return cpu == TIMING_8086 && !(b->fetch & 1) ? 2 : 1;
+}
+
+static int has_room(const struct biu *b, TIMING_CPU cpu)
+{
+	return b->queue + fetch_size(b, cpu) <= queue_size[cpu];
+}
+
+static void prefetch(struct biu *b, TIMING_CPU cpu)
+{
+	uint8 n = fetch_size(b, cpu);
+
+	b->bus   += TIMING_BUS_CYCLE;
+	b->queue += n;
+	b->fetch  = (b->fetch + n) & ADDRESS_MASK;
+	b->fetches++;
+}
+
+// the prefetches that finish by `until`, as long as there's room for them
+static void run_until(struct biu *b, TIMING_CPU cpu, uint64_t until)
+{
+	while (has_room(b, cpu) && b->bus + TIMING_BUS_CYCLE <= until) prefetch(b, cpu);
+}
+
+// the execution unit takes one instruction byte from the queue
+static void take_byte(struct biu *b, TIMING_CPU cpu)
+{
+	run_until(b, cpu, b->now);
+
+	// empty queue: wait for the prefetch on the bus (or the one after the
+	// data transfer that holds it)
+	if (b->queue == 0) {
+		b->code_wait += b->bus + TIMING_BUS_CYCLE - b->now;
+		b->now        = b->bus + TIMING_BUS_CYCLE;
+		prefetch(b, cpu);
+	}
+
+	// a full queue left the bus idle, prefetching starts again from here
+	if (!has_room(b, cpu) && b->bus < b->now) b->bus = b->now;
+	b->queue--;
+}
+
+// data transfers wait for a prefetch already on the bus, never the other way round
+static void transfer(struct biu *b, TIMING_CPU cpu, uint cycles)
+{
+	run_until(b, cpu, b->now);
+	if (has_room(b, cpu) && b->bus < b->now) prefetch(b, cpu);
+
+	if (b->bus > b->now) {
+		b->bus_wait += b->bus - b->now;
+		b->now       = b->bus;
+	}
+
+	b->now      += (uint64_t)cycles * TIMING_BUS_CYCLE;
+	b->bus       = b->now;
+	b->transfers += cycles;
+}
+
+// the queue is thrown away; a prefetch in flight still finishes first
+static void flush(struct biu *b, TIMING_CPU cpu, uint32 target)
+{
+	run_until(b, cpu, b->now);
+	if (has_room(b, cpu) && b->bus < b->now) prefetch(b, cpu);
+	if (b->bus < b->now) b->bus = b->now;
+
+	b->queue = 0;
+	b->fetch = target & ADDRESS_MASK;
+}
+
+// a jump back to itself or earlier: the end of a loop body
+static int is_back_edge(const Instruction *instruction)
+{
+	switch (instruction->structure.type) {
+	case JO: case JNO: case JB: case JAE: case JE: case JNE: case JBE: case JA:
+	case JS: case JNS: case JP: case JPO: case JL: case JGE: case JLE: case JG:
+	case LOOP: case LOOPZ: case LOOPNZ: case JCXZ: case JMP:
+		break;
+	default:
+		return 0;
+	}
+
+	if (instruction->structure.format == JMP_SHORT) return (int8)(instruction->data & 0xFF) < 0;
+	if (instruction->structure.format == JMP_NEAR)  return (int16)instruction->data < 0;
+	return 0;
+}
+
+static void snapshot(const struct timing *timing, struct timing_snapshot *at)
+{
+	uint cpu;
+
+	for (cpu = 0; cpu < TIMING_CPUS; ++cpu) {
+		at->table[cpu] = timing->biu[cpu].table;
+		at->queue[cpu] = timing->biu[cpu].now;
+	}
+}
+
+static void count_loop(struct timing *timing, uint32 at)
+{
+	struct timing_loop *loop;
+	uint i, slot;
+
+	for (i = 0; i < TIMING_LOOPS; ++i) {
+		slot = (at + i) & (TIMING_LOOPS - 1);
+		loop = timing->loops + slot;
+
+		if (loop->count == 0) {
+			loop->at = at;
+			snapshot(timing, &loop->first);
+		} else if (loop->at != at) {
+			continue;
+		}
+
+		loop->count++;
+		snapshot(timing, &loop->last);
+		return;
+	}
+}
+
+void timing_step(struct timing *timing, const Instruction *instruction, const Operand ops[2],
+                 const struct timing_info *step, uint32 next)
+{
+	struct biu *b;
+	uint book, eu, cycles, i, cpu;
+
+	book = timing_clocks(instruction, ops, step->count, step->taken, !timing->repeat);
+
+	// the tables include 4 clocks for every transfer and assume the next
+	// instruction is in the queue; a taken jump also covers the first
+	// fetch at its target. Both are modelled here, so they come off.
+	eu = book > step->transfers * TIMING_BUS_CYCLE ? book - step->transfers * TIMING_BUS_CYCLE : 0;
+	if (step->flush) eu = eu > TIMING_BUS_CYCLE ? eu - TIMING_BUS_CYCLE : 0;
+
+	for (cpu = 0; cpu < TIMING_CPUS; ++cpu) {
+		b = timing->biu + cpu;
+
+		// a word on the 8088, or at an odd address on the 8086, is two bus cycles
+		cycles    = step->transfers + (cpu == TIMING_8086 ? step->odd : step->words);
+		b->table += book + (cycles - step->transfers) * TIMING_BUS_CYCLE;
+
+		// later iterations of a rep string op are still decoded
+		if (!timing->repeat) {
+			for (i = 0; i < instruction->structure.size; ++i) take_byte(b, cpu);
+		}
+
+		b->now += eu;
+		if (cycles) transfer(b, cpu, cycles);
+		if (step->flush) flush(b, cpu, next);
+	}
+
+	timing->flushes += step->flush;
+	timing->repeat   = step->repeat;
+
+	if (is_back_edge(instruction)) count_loop(timing, instruction->offset);
+}
+
+void timing_report(FILE *out, const struct timing *timing, uint64_t steps)
+{
+	const struct biu *b = timing->biu;
+	double per = steps ? (double)steps : 1.0;
+
+	fprintf(out, "; %-18s %12s %12s\n", "clocks", "8086", "8088");
+	fprintf(out, ";   %-16s %12llu %12llu\n", "tables", (unsigned long long)b[0].table,
+	        (unsigned long long)b[1].table);
+	fprintf(out, ";   %-16s %12llu %12llu\n", "prefetch queue", (unsigned long long)b[0].now,
+	        (unsigned long long)b[1].now);
+	fprintf(out, ";   %-16s %12.2f %12.2f\n", "per instruction", b[0].now / per, b[1].now / per);
+	fprintf(out, ";   %-16s %12llu %12llu\n", "waiting code", (unsigned long long)b[0].code_wait,
+	        (unsigned long long)b[1].code_wait);
+	fprintf(out, ";   %-16s %12llu %12llu\n", "waiting bus", (unsigned long long)b[0].bus_wait,
+	        (unsigned long long)b[1].bus_wait);
+	fprintf(out, ";   %-16s %12llu %12llu\n", "fetch cycles", (unsigned long long)b[0].fetches,
+	        (unsigned long long)b[1].fetches);
+	fprintf(out, ";   %-16s %12llu %12llu\n", "data cycles", (unsigned long long)b[0].transfers,
+	        (unsigned long long)b[1].transfers);
+	fprintf(out, "; %llu queue flushes\n", (unsigned long long)timing->flushes);
+}
+
+const struct timing_loop *timing_hottest_loop(const struct timing *timing)
+{
+	const struct timing_loop *hottest = NULL;
+	uint i;
+
+	for (i = 0; i < TIMING_LOOPS; ++i) {
+		if (timing->loops[i].count < 2) continue;
+		if (!hottest || timing->loops[i].count > hottest->count) hottest = timing->loops + i;
+	}
+
+	return hottest;
+}
+
+void timing_compare_header(FILE *out)
+{
+	fprintf(out, "%-32s %12s %30s %10s %26s\n", "", "", "clocks", "loop", "clocks per iteration");
+	fprintf(out, "%-32s %12s %10s %10s %10s %10s %8s %8s %8s\n", "image", "instructions",
+	        "tables", "8086", "8088", "iterations", "tables", "8086", "8088");
+}
+
+void timing_compare_row(FILE *out, const char *name, const struct timing *timing,
+                        uint64_t steps, const char *stop)
+{
+	const struct timing_loop *loop = timing_hottest_loop(timing);
+	const struct biu *b = timing->biu;
+	double n;
+
+	fprintf(out, "%-32s %12llu %10llu %10llu %10llu", name, (unsigned long long)steps,
+	        (unsigned long long)b[TIMING_8086].table, (unsigned long long)b[TIMING_8086].now,
+	        (unsigned long long)b[TIMING_8088].now);
+
+	// from the first pass through the loop's jump to the last, so the
+	// setup before the loop and the code after it don't count
+	if (loop) {
+		n = (double)(loop->count - 1);
+		fprintf(out, " %10llu %8.1f %8.1f %8.1f", (unsigned long long)loop->count,
+		        (loop->last.table[TIMING_8086] - loop->first.table[TIMING_8086]) / n,
+		        (loop->last.queue[TIMING_8086] - loop->first.queue[TIMING_8086]) / n,
+		        (loop->last.queue[TIMING_8088] - loop->first.queue[TIMING_8088]) / n);
+	} else {
+		fprintf(out, " %10s %8s %8s %8s", "-", "-", "-", "-");
+	}
+
+	if (stop) fprintf(out, "  (%s)", stop);
+	fputc('\n', out);
+}
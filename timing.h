@@ -0,0 +1,103 @@
+#if !defined TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// both bus widths are modelled side by side from the same run
+typedef enum {
+	TIMING_8086,  // 16-bit bus, 6-byte queue, words at odd addresses take two cycles
+	TIMING_8088,  // 8-bit bus, 4-byte queue, every word takes two cycles
+	TIMING_CPUS,
+} TIMING_CPU;
+
+// one bus cycle, T1 to T4
+#define TIMING_BUS_CYCLE 4
+
+#define TIMING_REPORT_SIZE 640
+
+// backward jumps followed per run to time loop iterations
+#define TIMING_LOOPS 64
+
+// one --compare row: image name plus ten columns
+#define TIMING_COMPARE_SIZE (4096 + 160)
+
+// prefetch queue and bus of one cpu, times in clocks from the start of the run
+struct biu
+{
+	uint64_t now;        // where the execution unit is
+	uint64_t bus;        // the bus is free from here
+	uint32   fetch;      // linear address of the next prefetch
+	uint8    queue;      // bytes prefetched and not taken yet
+
+	uint64_t table;      // book clocks with this cpu's transfer penalties
+	uint64_t fetches;    // prefetch bus cycles, discarded ones included
+	uint64_t transfers;  // data bus cycles
+	uint64_t code_wait;  // clocks the execution unit waited for instruction bytes
+	uint64_t bus_wait;   // clocks it waited for a prefetch to get off the bus
+};
+
+// the clocks so far by each measure
+struct timing_snapshot
+{
+	uint64_t table[TIMING_CPUS];
+	uint64_t queue[TIMING_CPUS];
+};
+
+// a backward jump, taken or not: one execution per loop iteration
+struct timing_loop
+{
+	uint32   at;         // linear address of the jump
+	uint64_t count;      // 0 for a free slot
+	struct timing_snapshot first, last; // right after its first and last execution
+};
+
+struct timing
+{
+	struct biu biu[TIMING_CPUS];
+	uint64_t   flushes;  // queue flushes, the same for both
+	uint8      repeat;   // the last step was a rep iteration that runs again
+
+	// open addressing on the jump address, jumps past the first TIMING_LOOPS aren't followed
+	struct timing_loop loops[TIMING_LOOPS];
+};
+
+// what one executed step did besides its record: filled in by the simulator
+struct timing_info
+{
+	uint8 count;        // shift/rotate count; for string ops 1 if an iteration ran
+	uint8 taken;        // a conditional branch or loop jumped
+	uint8 transfers;    // memory accesses
+	uint8 words;        // ... of them word wide
+	uint8 odd;          // ... of them words at odd addresses
+	uint8 repeat;       // rep string op that runs again from the same ip
+	uint8 flush;        // a jump, call or return was taken: the queue starts over
+};
+
+// clocks the 8086 tables give for the effective address of a memory operand,
+// segment override included
+extern uint timing_ea_clocks(const Instruction *instruction, const Operand *op);
+
+// book clocks of one execution with aligned operands (the 8086 figures);
+// `first` is 0 for the second and later iterations of a rep string op
+extern uint timing_clocks(const Instruction *instruction, const Operand ops[2], uint count,
+                          int taken, int first);
+
+// start both models empty, fetching from linear address `start`
+extern void timing_reset(struct timing *timing, uint32 start);
+// account for one executed step; `next` is the linear address ip went to
+extern void timing_step(struct timing *timing, const Instruction *instruction,
+                        const Operand ops[2], const struct timing_info *step, uint32 next);
+extern void timing_report(FILE *out, const struct timing *timing, uint64_t steps);
+
+// the backward jump that ran most often, NULL if none ran twice
+extern const struct timing_loop *timing_hottest_loop(const struct timing *timing);
+
+// --compare: column headings, then one row per image
+extern void timing_compare_header(FILE *out);
+extern void timing_compare_row(FILE *out, const char *name, const struct timing *timing,
+                               uint64_t steps, const char *stop);
+
+#endif // TIMING_H
@@ -0,0 +1,329 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// records read back per fread when replaying
+#define REPLAY_BATCH 1024
+
+_Static_assert(sizeof(struct trace_record) == 24, "trace records are 24 bytes on disk");
+
+int trace_init(struct trace *trace)
+{
+	memset(trace, 0, sizeof(*trace));
+
+	trace->ring = malloc((size_t)TRACE_RING * sizeof(*trace->ring));
+	return trace->ring ? 0 : -3;
+}
+
+void trace_free(struct trace *trace)
+{
+	assert(trace->file == NULL && "trace_close first");
+
+	free(trace->ring);
+	trace->ring = NULL;
+}
+
+// write records [start, end) of the ring, wrapping at most once
+static int write_records(struct trace *trace, uint64_t start, uint64_t end)
+{
+	uint64_t at, n;
+
+	while (start < end) {
+		at = start & (TRACE_RING - 1);
+		n  = end - start;
+		if (n > TRACE_RING - at) n = TRACE_RING - at;
+
+		if (fwrite(trace->ring + at, sizeof(*trace->ring), n, trace->file) != n) return -1;
+		start += n;
+	}
+
+	return 0;
+}
+
+static void *trace_writer(void *arg)
+{
+	struct trace *trace = arg;
+	uint64_t start, end;
+	int      rc;
+
+	pthread_mutex_lock(&trace->lock);
+
+	for (;;) {
+		while (trace->published == trace->tail && !trace->closing)
+			pthread_cond_wait(&trace->ready, &trace->lock);
+
+		if (trace->published == trace->tail) break;
+
+		start = trace->tail;
+		end   = trace->published;
+		pthread_mutex_unlock(&trace->lock);
+
+		// the producer only writes past `published`, these slots are ours
+		rc = trace->failed ? -1 : write_records(trace, start, end);
+
+		pthread_mutex_lock(&trace->lock);
+		if (rc < 0) trace->failed = 1;
+		trace->tail = end;
+		pthread_cond_signal(&trace->drained);
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+	return NULL;
+}
+
+int trace_open(struct trace *trace, const char *path, const struct sim *sim)
+{
+	struct trace_header header;
+
+	assert(trace->ring != NULL && trace->file == NULL);
+
+	trace->file = fopen(path, "wb");
+	if (!trace->file) {
+		fprintf(stderr, "failed to create trace '%s'\n", path);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version     = TRACE_VERSION;
+	header.record_size = sizeof(struct trace_record);
+	header.load        = sim->code_start;
+	header.size        = sim->code_end - sim->code_start;
+	header.state       = sim->state;
+
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1 ||
+	    fwrite(sim->memory + header.load, 1, header.size, trace->file) != header.size) {
+		fprintf(stderr, "failed to write trace '%s'\n", path);
+		fclose(trace->file);
+		trace->file = NULL;
+		return -1;
+	}
+
+	trace->head      = 0;
+	trace->limit     = TRACE_CHUNK;
+	trace->published = 0;
+	trace->tail      = 0;
+	trace->closing   = 0;
+	trace->failed    = 0;
+
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_cond_init(&trace->ready, NULL);
+	pthread_cond_init(&trace->drained, NULL);
+
+	if (pthread_create(&trace->thread, NULL, trace_writer, trace) != 0) {
+		pthread_cond_destroy(&trace->drained);
+		pthread_cond_destroy(&trace->ready);
+		pthread_mutex_destroy(&trace->lock);
+		fclose(trace->file);
+		trace->file = NULL;
+		return -3;
+	}
+
+	return 0;
+}
+
+// hand the last chunk to the writer and make room for the next one
+static void trace_publish(struct trace *trace)
+{
+	pthread_mutex_lock(&trace->lock);
+
+	trace->published = trace->head;
+	pthread_cond_signal(&trace->ready);
+
+	while (trace->head + TRACE_CHUNK > trace->tail + TRACE_RING)
+		pthread_cond_wait(&trace->drained, &trace->lock);
+
+	pthread_mutex_unlock(&trace->lock);
+	trace->limit = trace->head + TRACE_CHUNK;
+}
+
+void trace_step(struct trace *trace, const struct sim_state *before, const struct sim *sim)
+{
+	struct trace_record *r;
+	uint16 values[12], changed = 0, bit;
+	uint   i, n = 0;
+
+	if (trace->head == trace->limit) trace_publish(trace);
+
+	r = trace->ring + (trace->head & (TRACE_RING - 1));
+
+	// branch-free: every register goes into values[], only changed ones advance n
+	for (i = 0; i < 8; ++i) {
+		bit        = sim->state.regs[i] != before->regs[i];
+		values[n]  = sim->state.regs[i];
+		changed   |= bit << i;
+		n         += bit;
+	}
+
+	for (i = 0; i < 4; ++i) {
+		bit        = sim->state.sregs[i] != before->sregs[i];
+		values[n]  = sim->state.sregs[i];
+		changed   |= bit << (8 + i);
+		n         += bit;
+	}
+
+	for (i = 0; i < TRACE_VALUES; ++i) r->value[i] = i < n ? values[i] : 0;
+
+	r->cs        = before->sregs[SIM_CS];
+	r->ip        = before->ip;
+	r->flags     = sim->state.flags;
+	r->changed   = changed;
+	r->size      = sim->current.structure.size;
+	r->mem_width = sim->write_width;
+	r->mem       = sim->write_width ? sim->write_addr : 0;
+	r->mem_value = sim->write_width ? sim->write_value : 0;
+	r->pad[0]    = r->pad[1] = 0;
+
+	trace->head++;
+}
+
+int trace_close(struct trace *trace)
+{
+	int rc;
+
+	if (!trace->file) return 0;
+
+	pthread_mutex_lock(&trace->lock);
+	trace->published = trace->head;
+	trace->closing   = 1;
+	pthread_cond_signal(&trace->ready);
+	pthread_mutex_unlock(&trace->lock);
+
+	pthread_join(trace->thread, NULL);
+
+	rc = trace->failed ? -1 : 0;
+	if (fclose(trace->file) != 0) rc = -1;
+	trace->file = NULL;
+
+	pthread_cond_destroy(&trace->drained);
+	pthread_cond_destroy(&trace->ready);
+	pthread_mutex_destroy(&trace->lock);
+
+	if (rc < 0) fprintf(stderr, "failed to write trace records\n");
+	return rc;
+}
+
+// " ax=0x0001 [0x00104]=0x41 flags=PZ" for what one record changed
+static void print_changes(FILE *out, const struct trace_record *r, uint16 *flags)
+{
+	char names[16];
+	uint i, n = 0;
+
+	for (i = 0; i < 12; ++i) {
+		if (!(r->changed & (1u << i))) continue;
+
+		fprintf(out, " %s=", i < 8 ? get_register_name(1, i) : get_segment_name(i - 8));
+		if (n < TRACE_VALUES) fprintf(out, "0x%04X", r->value[n++]);
+		else                  fputs("?", out);
+	}
+
+	if (r->mem_width == 1) fprintf(out, " [0x%05X]=0x%02X", r->mem, r->mem_value);
+	if (r->mem_width == 2) fprintf(out, " [0x%05X]=0x%04X", r->mem, r->mem_value);
+
+	if (r->flags != *flags) {
+		if (!sim_flag_names(names, r->flags)) strcpy(names, "-");
+		fprintf(out, " flags=%s", names);
+		*flags = r->flags;
+	}
+}
+
+int trace_replay(FILE *out, const char *path, uint64_t first, uint64_t count)
+{
+	struct trace_header header;
+	struct trace_record *records = NULL;
+	Instruction instruction;
+	uint8   *image = NULL;
+	char     line[DECODE_MAX_LINE + 1];
+	FILE    *f, *text = NULL;
+	long     end;
+	uint64_t total, i, n, at;
+	uint32   linear, span;
+	uint16   flags;
+	int      rc = -1;
+	size_t   len;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "failed to open trace '%s'\n", path);
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record) ||
+	    header.load > SIM_MEMORY || header.size > SIM_MEMORY - header.load) {
+		fprintf(stderr, "'%s' is not a trace file\n", path);
+		goto done;
+	}
+
+	// the image goes back where it was loaded so record addresses index it directly
+	span    = header.load + header.size;
+	image   = calloc(span ? span : 1, 1);
+	records = malloc(REPLAY_BATCH * sizeof(*records));
+	text    = fmemopen(line, sizeof(line), "w");
+	if (!image || !records || !text) {
+		rc = -3;
+		goto done;
+	}
+
+	if (fread(image + header.load, 1, header.size, f) != header.size ||
+	    fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < 0) {
+		fprintf(stderr, "truncated trace '%s'\n", path);
+		goto done;
+	}
+
+	total = ((uint64_t)end - sizeof(header) - header.size) / sizeof(struct trace_record);
+	if (first > total) first = total;
+	if (count == 0 || count > total - first) count = total - first;
+
+	fprintf(out, "; %s: %llu records, %u image bytes at 0x%05X, showing %llu from %llu\n",
+	        path, (unsigned long long)total, header.size, header.load,
+	        (unsigned long long)count, (unsigned long long)first);
+
+	if (fseek(f, (long)(sizeof(header) + header.size + first * sizeof(struct trace_record)),
+	          SEEK_SET) != 0)
+		goto done;
+
+	// flags are printed when they change; a window from the middle starts with them
+	flags = first ? 0xFFFF : header.state.flags;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < REPLAY_BATCH ? count - i : REPLAY_BATCH;
+		if (fread(records, sizeof(*records), n, f) != n) {
+			fprintf(stderr, "truncated trace '%s'\n", path);
+			goto done;
+		}
+
+		for (at = 0; at < n; ++at) {
+			linear = ((uint32)records[at].cs * 16 + records[at].ip) & (SIM_MEMORY - 1);
+
+			rewind(text);
+			if (linear >= header.load && linear < span &&
+			    parse_instruction(&instruction, image, span, linear) >= 0) {
+				instruction.segment = records[at].cs;
+				decode_instruction(text, &instruction);
+			} else {
+				fputs("?", text);
+			}
+			fflush(text);
+			len = ftell(text);
+			if (len >= sizeof(line)) len = sizeof(line) - 1;
+
+			fprintf(out, "%10llu  %04X:%04X  %-32.*s ;", (unsigned long long)(first + i + at),
+			        records[at].cs, records[at].ip, (int)len, line);
+			print_changes(out, records + at, &flags);
+			fputc('\n', out);
+		}
+	}
+
+	rc = 0;
+
+done:
+	if (text) fclose(text);
+	free(records);
+	free(image);
+	fclose(f);
+	return rc;
+}
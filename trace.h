@@ -0,0 +1,85 @@
+#if !defined TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim.h"
+
+#define TRACE_MAGIC   "T86\x1A"
+#define TRACE_VERSION 1
+
+// records per ring; the writer gets them TRACE_CHUNK at a time
+#define TRACE_RING  (1u << 16)
+#define TRACE_CHUNK (1u << 12)
+
+// new register values one record holds; no 8086 instruction changes more
+// than three registers besides ip and flags (rep movsw: si, di, cx)
+#define TRACE_VALUES 3
+
+// trace_record.changed bits: regs[] in modrm order, then sregs[]
+#define TRACE_REG(r)  (1u << (r))
+#define TRACE_SREG(r) (1u << (8 + (r)))
+
+// one executed instruction, fixed width so a window is a single seek
+struct trace_record
+{
+	uint16 cs;        // where the instruction was
+	uint16 ip;
+	uint32 mem;       // linear address of the last memory write
+	uint16 mem_value;
+	uint16 flags;     // after the step
+	uint16 changed;   // TRACE_REG/TRACE_SREG bits of registers it changed
+	uint16 value[TRACE_VALUES]; // their new values, lowest bit first
+	uint8  mem_width; // 0 if nothing was written, else 1 or 2
+	uint8  size;      // instruction bytes
+	uint8  pad[2];
+};
+
+// file layout: this header, `size` image bytes, then the records; host byte order
+struct trace_header
+{
+	char    magic[4];
+	uint16  version;
+	uint16  record_size;
+	uint32  load;     // linear address the image bytes were loaded to
+	uint32  size;
+	struct sim_state state; // before the first record
+};
+
+// a ring per worker, kept between files; a writer thread drains it to the
+// file while the simulation keeps going
+struct trace
+{
+	struct trace_record *ring;
+	uint64_t head;       // records added, owned by the simulating thread
+	uint64_t limit;      // head can reach this before it has to sync
+
+	pthread_mutex_t lock;
+	pthread_cond_t  ready;   // published moved, or closing
+	pthread_cond_t  drained; // tail moved
+	uint64_t  published; // records the writer may take
+	uint64_t  tail;      // records written out
+	int       closing;
+	int       failed;
+
+	FILE     *file;
+	pthread_t thread;
+};
+
+extern int  trace_init(struct trace *trace);
+extern void trace_free(struct trace *trace);
+
+// start a trace of the image sim has loaded and isn't running yet
+extern int  trace_open(struct trace *trace, const char *path, const struct sim *sim);
+// record the step sim just made from `before`
+extern void trace_step(struct trace *trace, const struct sim_state *before, const struct sim *sim);
+// flush everything and stop the writer; < 0 if anything failed to write
+extern int  trace_close(struct trace *trace);
+
+// print records [first, first + count) of a trace file with their instructions
+// decoded from the image it carries; count 0 for everything after first
+extern int  trace_replay(FILE *out, const char *path, uint64_t first, uint64_t count);
+
+#endif // TRACE_H
@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <string.h>
+
+#include "xref.h"
+
+void xref_init_buf(struct xref *xref, uint size, void *buf)
+{
+	uint *words = buf;
+
+	xref->size    = size;
+	xref->count   = 0;
+	xref->first   = words;
+	xref->sources = words + size + 1;
+	xref->edges   = words + size * 2 + 1;
+	xref->kinds   = (uint8 *)(words + size * 3 + 1);
+
+	// first holds the per-target counts until xref_build
+	memset(xref->first, 0, ((size_t)size + 1) * sizeof(uint));
+}
+
+int xref_target(Instruction *instruction)
+{
+	// far pointers are paragraph:offset, the image is loaded at paragraph 0
+	if (instruction->structure.format == JMP_FAR)
+		return (uint32)instruction->data_ext * 16 + instruction->data;
+
+	return get_jmp_offset(instruction);
+}
+
+uint8 xref_kind(const Instruction *instruction)
+{
+	uint8 kind;
+
+	switch (instruction->structure.format) {
+	case JMP_SHORT: kind = XREF_SHORT; break;
+	case JMP_NEAR:  kind = XREF_NEAR;  break;
+	case JMP_FAR:   kind = XREF_FAR;   break;
+	default:        return 0;
+	}
+
+	if (instruction->structure.type == CALL) kind |= XREF_CALL;
+	return kind;
+}
+
+const char *xref_kind_name(uint8 kind)
+{
+	switch (kind) {
+	case XREF_SHORT:            return "short";
+	case XREF_NEAR:             return "near";
+	case XREF_FAR:              return "far";
+	case XREF_CALL | XREF_NEAR: return "call";
+	case XREF_CALL | XREF_FAR:  return "call far";
+	default:                    return "?";
+	}
+}
+
+void xref_add(struct xref *xref, Instruction *instruction, uint index, int target)
+{
+	if (target < 0 && instruction->structure.format == JMP_FAR) target = xref_target(instruction);
+	if (target < 0 || (uint)target >= xref->size) return;
+
+	xref->first[target]++;
+	xref->edges[xref->count++] = index;
+}
+
+void xref_build(struct xref *xref, Instruction *instructions)
+{
+	uint t, i, n, sum = 0;
+	int  target;
+
+	// counts to row starts
+	for (t = 0; t <= xref->size; ++t) {
+		n = xref->first[t];
+		xref->first[t] = sum;
+		sum += n;
+	}
+
+	// edges are in offset order, so each row comes out sorted; first[t]
+	// ends up one row further along
+	for (i = 0; i < xref->count; ++i) {
+		target = xref_target(instructions + xref->edges[i]);
+		assert(target >= 0 && (uint)target < xref->size);
+
+		n = xref->first[target]++;
+		xref->sources[n] = xref->edges[i];
+		xref->kinds[n]   = xref_kind(instructions + xref->edges[i]);
+	}
+
+	memmove(xref->first + 1, xref->first, (size_t)xref->size * sizeof(uint));
+	xref->first[0] = 0;
+	xref->edges    = NULL;
+}
+
+uint xref_sources(const struct xref *xref, uint target, const uint **sources)
+{
+	assert(xref->edges == NULL && "xref_build first");
+
+	if (target >= xref->size) return 0;
+
+	*sources = xref->sources + xref->first[target];
+	return xref->first[target + 1] - xref->first[target];
+}
+
+void xref_comment(FILE *out, const struct xref *xref, const Instruction *instructions,
+                  uint target)
+{
+	const Instruction *source;
+	const uint *sources;
+	uint i, count, at;
+
+	count = xref_sources(xref, target, &sources);
+	if (count == 0) return;
+
+	at = sources - xref->sources;
+	fputs(" ; xref", out);
+
+	for (i = 0; i < count && i < XREF_LIST; ++i) {
+		source = instructions + sources[i];
+		fputs(i ? ", " : " ", out);
+
+		if (source->segment) {
+			fprintf(out, "%04X:%04X", source->segment, source->offset - source->segment * 16);
+		} else {
+			fprintf(out, "0x%04X", source->offset);
+		}
+
+		fprintf(out, " %s", xref_kind_name(xref->kinds[at + i]));
+	}
+
+	if (count > XREF_LIST) fprintf(out, ", +%u more", count - XREF_LIST);
+}
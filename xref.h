@@ -0,0 +1,57 @@
+#if !defined XREF_H
+#define XREF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "decode.h"
+
+// how a branch reaches its target; XREF_CALL goes with XREF_NEAR or XREF_FAR
+#define XREF_SHORT 0x1
+#define XREF_NEAR  0x2
+#define XREF_FAR   0x4
+#define XREF_CALL  0x8
+
+// sources listed on one label line before the rest are only counted
+#define XREF_LIST 8
+// text one listed source adds to a label line (", 1234:ABCD call far")
+#define XREF_ENTRY 24
+// " ; xref" plus ", +4294967295 more"
+#define XREF_TAIL  32
+
+// buffer xref_init_buf needs for an image of `size` bytes (at most `size` records)
+#define XREF_BUF_SIZE(size) (((size_t)(size) * 3 + 1) * sizeof(uint) + (size_t)(size))
+
+// branches grouped by target offset, compressed sparse rows: the branches
+// landing on offset t are sources[first[t] .. first[t + 1])
+struct xref
+{
+	uint   size;    // image bytes, first has size + 1 entries
+	uint   count;   // branches recorded
+	uint  *first;
+	uint  *sources; // record index of each branch, ascending per target
+	uint8 *kinds;   // XREF_* for each entry of sources
+
+	uint  *edges;   // record index of each branch in scan order, until xref_build
+};
+
+extern void xref_init_buf(struct xref *xref, uint size, void *buf);
+
+// image offset a branch record lands on (far targets too), -1 if none
+extern int   xref_target(Instruction *instruction);
+extern uint8 xref_kind(const Instruction *instruction);
+extern const char *xref_kind_name(uint8 kind);
+
+// record branch `index` to `target` (-1 for none); cheap, called once per record
+extern void xref_add(struct xref *xref, Instruction *instruction, uint index, int target);
+// group the recorded branches by target
+extern void xref_build(struct xref *xref, Instruction *instructions);
+
+// branches landing on `target`, their kinds are at xref->kinds + the same index
+extern uint xref_sources(const struct xref *xref, uint target, const uint **sources);
+
+// " ; xref <source> <kind>, ..." for the label at `target`
+extern void xref_comment(FILE *out, const struct xref *xref, const Instruction *instructions,
+                         uint target);
+
+#endif // XREF_H